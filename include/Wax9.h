@@ -39,21 +39,40 @@
 
 #pragma once
 
-#include "cinder/app/App.h"
-#include "cinder/Quaternion.h"
-#include "cinder/Thread.h"
-//#include "cinder/ConcurrentCircularBuffer.h"
-#include "cinder/Serial.h"
-#include "cinder/Utilities.h"
+#ifdef WAX9_HEADLESS
+    // only the math types, for daemons and tools without a Cinder app
+    #include "cinder/Cinder.h"
+    #include "cinder/CinderMath.h"
+    #include "cinder/Vector.h"
+    #include "cinder/Matrix.h"
+    #include "cinder/Quaternion.h"
+#else
+    #include "cinder/app/App.h"
+    #include "cinder/Quaternion.h"
+    #include "cinder/Thread.h"
+    //#include "cinder/ConcurrentCircularBuffer.h"
+    #include "cinder/Serial.h"
+    #include "cinder/Utilities.h"
+#endif
 
 #include <boost/circular_buffer.hpp>
 #include <sys/timeb.h>
+#include <chrono>
+#include <iostream>
 
 #include "ahrs.h"
+#include "Wax9AhrsEngine.h"
+#include "Wax9Clock.h"
+#include "Wax9Smoothing.h"
+#include "Wax9Pipeline.h"
+#include "Wax9Snapshot.h"
+#include "Wax9BufferPool.h"
+#include "Wax9Telemetry.h"
+#include "Wax9Transport.h"
+#include "Wax9Trace.h"
+#include "Wax9RateController.h"
 
 // Wax Structures
-#define BUFFER_SIZE 0xffff
-
 using namespace std;
 using namespace ci;
 
@@ -77,11 +96,90 @@ typedef struct
     //                                      // @36
 } Wax9Packet;
 
+// Keeps sample numbers and timestamps increasing across wrap-arounds and device resets
+class Wax9SequenceExtender {
+public:
+
+    Wax9SequenceExtender()                          { reset(); }
+    void        reset()                             { bFirst = true; bRestart = false; mSample = 0; mTimestamp = 0; }
+    void        reset(uint64_t sample, uint64_t timestamp);
+    void        extend(const Wax9Packet &packet)    { extend(packet.sampleNumber, packet.timestamp); }
+    void        extend(uint16_t sampleNumber, uint32_t timestamp);
+
+    // the device is about to restart its sample numbers, after a rate change. The first packet
+    // within a second that doesn't follow the last one continues the sequence by one
+    void        markRestart()                       { bRestart = !bFirst; mRestartTimestamp = mLastTimestamp; }
+
+    uint64_t    getSample() const                   { return mSample; }
+    uint64_t    getTimestamp() const                { return mTimestamp; }
+
+protected:
+
+    bool        bFirst;
+    bool        bRestart;
+    uint64_t    mSample;
+    uint64_t    mTimestamp;
+    uint16_t    mLastSample;
+    uint32_t    mLastTimestamp;
+    uint32_t    mRestartTimestamp;
+};
+
+// Frames and packets the decoder dropped, by reason. Nothing dropped reaches the AHRS
+typedef struct
+{
+    uint64_t    numFrames;          // SLIP frames read
+    uint64_t    numCorrupt;         // bad escape or too long, dropped up to the next SLIP_END
+    uint64_t    numMalformed;       // wrong length for their packet version
+    uint64_t    numSplit;           // packets recovered from two frames merged by a lost SLIP_END
+    uint64_t    numOutOfRange;      // values the sensors can't produce
+    uint64_t    numImplausible;     // sample number, timestamp or gyro jump inconsistent with the previous packet
+    uint64_t    numResyncs;         // new sequences accepted, after a device reset or a rate change
+} Wax9DecodeStats;
+
+// Limits for Wax9PacketValidator
+typedef struct
+{
+    float       maxGyro;            // deg/s, the gyro saturates at its 2000 deg/s range
+    float       maxMag;             // uT
+    float       maxGyroStep;        // deg/s between consecutive samples
+    float       periodTolerance;    // fraction of the sample period the timestamps may be off by
+    int         maxGap;             // lost samples before a packet only counts as a new sequence
+} Wax9PacketLimits;
+
+// Checks decoded packets against the ranges of the sensors and against the last one accepted.
+// A packet that doesn't follow it is dropped and kept as a candidate: when the next one follows
+// the candidate instead, the stream really restarted and the sequence is accepted from there.
+// That costs one packet per device reset or rate change and a corrupt packet can't take over
+class Wax9PacketValidator {
+public:
+
+    Wax9PacketValidator();
+    void        reset();
+    bool        validate(const Wax9Packet &packet, Wax9DecodeStats &stats);
+
+    void        setLimits(const Wax9PacketLimits &limits)   { mLimits = limits; }
+    const Wax9PacketLimits& getLimits() const               { return mLimits; }
+    static Wax9PacketLimits getDefaultLimits();
+
+protected:
+
+    bool        isInRange(const Wax9Packet &packet) const;
+    bool        follows(const Wax9Packet &packet, const Wax9Packet &previous, double period) const;
+
+    Wax9PacketLimits mLimits;
+    bool        bHasLast;
+    bool        bHasCandidate;
+    Wax9Packet  mLast;
+    Wax9Packet  mCandidate;
+    double      mPeriod;            // 16.16 ticks per sample between the last two accepted, 0 if unknown
+};
+
 // Processed Wax9 sample
 typedef struct
 {
     unsigned short sampleNumber;
     uint32_t timestamp;
+    double hostTime;    // host time in seconds when the packet arrived (see Wax9::getHostTime())
     float accLen;
     vec3 acc;
     vec3 gyr;
@@ -90,7 +188,126 @@ typedef struct
     quat rotOGL;    // quaternion transformed to the OpenGL coordinate system
 } Wax9Sample;
 
+// Settings of Wax9Fusion. Wax9::getFusionSettings() has a live device's, for Wax9Reprocessor
+typedef struct
+{
+    Wax9AhrsAlgorithm   algorithm;
+    float               twoKp;          // beta in Madgwick
+    float               twoKi;          // Mahony only
+    bool                useMag;         // fuse new magnetometer readings
+    int                 magRate;        // Hz, to tell new magnetometer readings from repeated ones
+    vec3                gyroDelta;      // rad/s, subtracted from the gyro before fusing
+    Wax9SmoothSettings  smooth[WAX9_SMOOTH_NUM_CHANNELS];
+} Wax9FusionSettings;
+
+// The part of processing that doesn't need the device: AHRS and smoothing of converted samples.
+// Wax9 runs every batch through one and Wax9Reprocessor runs recordings through another, so
+// offline orientations match live ones: the same AHRS specialization, dt from the device
+// timestamps, the magnetometer fused only when it has a new reading, and the same smoothing
+class Wax9Fusion {
+public:
+
+    Wax9Fusion();
+    void        setup(const Wax9FusionSettings &settings, int outputRate);     // resets the orientation and smoothing
+    static Wax9FusionSettings getDefaultSettings();
+
+    void        setAhrs(Wax9AhrsAlgorithm algorithm, float twoKp, float twoKi);  // resets the orientation
+    void        setUseMagnetometer(bool b);
+    void        setGyroDelta(const vec3 &delta)     { mSettings.gyroDelta = delta; }
+    void        setSmooth(Wax9SmoothChannel channel, const Wax9SmoothSettings &settings);
+    void        setOutputRate(int rate)             { mOutputRate = max(rate, 1); }    // nominal dt after gaps
+    void        reset(const quat &q = quat());      // orientation and smoothing
+
+    const Wax9FusionSettings&   getSettings() const { return mSettings; }
+    bool        isSmoothing() const                 { return bSmooth; }
+
+    // rotAHRS from the gyro, accelerometer and magnetometer, continuing from the previous call
+    void        fuse(Wax9Sample *samples, size_t count);
+    // acc, gyr, mag and rotAHRS in place, continuing from the previous call. Fixed lag holds
+    // samples back until the ones after them arrive: returns how many came out, the first ones
+    // in samples are the held ones that are now complete, with their own times
+    size_t      smooth(Wax9Sample *samples, size_t count);
+    // at the end of a stream, the samples still held back with the last one repeated past it.
+    // Up to WAX9_SMOOTH_MAX_LAG of them, starts a new stream
+    size_t      finish(Wax9Sample *samples);
+    int         getDelay() const                    { return mDelay; }     // samples, the longest fixed lag
+
+protected:
+
+    bool        isNewMagReading(const vec3 &mag, uint32_t timestamp);
+    const Wax9Sample&   getHeld(int ago) const      { return mHeld[(mHead + mDelay + 1 - ago) % (mDelay + 1)]; }
+
+    Wax9FusionSettings  mSettings;
+    int                 mOutputRate;
+    Wax9Ahrs            mAhrs;
+    uint32_t            mLastAhrsTimestamp;     // of the previous sample fused, for its dt
+    vec3                mLastMag;               // last magnetometer reading that was fused
+    uint32_t            mLastMagTimestamp;
+    
+    // applied to the stored samples but not to the AHRS input
+    bool                bSmooth;
+    uint32_t            mLastSmoothTimestamp;
+    Wax9VectorSmoother      mSmoothVec[WAX9_SMOOTH_ORIENTATION];   // acc, gyr, mag
+    Wax9OrientationSmoother mSmoothRot;
+    int                 mDelay;
+    int                 mNumHeld;
+    int                 mHead;                  // newest in mHeld
+    Wax9Sample          mHeld[WAX9_SMOOTH_MAX_LAG + 1];     // the last mDelay + 1 inputs
+};
+
+// Newest state of a device, copied as a whole so it's always consistent (see Wax9::getSnapshot())
+typedef struct
+{
+    Wax9Sample          sample;         // newest reading, valid when numSamples > 0
+    uint64_t            numSamples;     // since setup()
+    uint64_t            numLost;        // missing from gaps in the sample numbers
+    uint64_t            numRejected;    // dropped by the decoder, see Wax9::getDecodeStats()
+    int                 outputRate;     // Hz, as last set on the device
+    float               sampleRate;     // Hz, from the device timestamps
+    bool                connected;
+    bool                batteryLow;
+    double              updateTime;     // host time of the update() that published it
+    Wax9TelemetryValue  telemetry[WAX9_TELEMETRY_NUM_CHANNELS];
+} Wax9State;
+
+// Heap and object bytes held by one device. The decode buffers are shared, see Wax9BufferPool
+typedef struct
+{
+    size_t      object;     // sizeof(Wax9)
+    size_t      history;    // sample ring
+    size_t      batch;      // packets and samples of the last update
+    size_t      other;      // pipeline stages and clock map
+    size_t      total;
+} Wax9MemoryUsage;
+
+// Readings in the history between two times or sample numbers, newest first like getReading(i).
+// Points into the ring without copying, in at most two contiguous parts where it wraps around.
+// Valid until the next update()
+struct Wax9SampleRange {
+
+    Wax9SampleRange() : first(NULL), firstSize(0), second(NULL), secondSize(0), offset(0) {}
+
+    size_t              size() const                    { return firstSize + secondSize; }
+    bool                empty() const                   { return firstSize + secondSize == 0; }
+    const Wax9Sample&   operator[](size_t i) const      { return i < firstSize ? first[i] : second[i - firstSize]; }
+
+    const Wax9Sample*   first;
+    size_t              firstSize;
+    const Wax9Sample*   second;
+    size_t              secondSize;
+    size_t              offset;     // index of the newest one in the history, for getSampleNumber() and friends
+};
+
+// Extended sample number and timestamp of a reading in the history
+typedef struct
+{
+    uint64_t    sample;
+    uint64_t    timestamp;      // 16.16 seconds
+} Wax9SampleKey;
+
 typedef  boost::circular_buffer<Wax9Sample> SampleBuffer;
+typedef  Wax9Pipeline<Wax9Sample> Wax9SamplePipeline;
+typedef  std::shared_ptr<class Wax9Recorder> Wax9RecorderRef;
 
 class Wax9 {
 public:
@@ -98,38 +315,108 @@ public:
     Wax9();
     ~Wax9();
     
-    bool        setup(string portName, int historyLength = 300);
+    bool        setup(string portName, int historyLength = 300);    // cinder::Serial, or termios when headless
+    bool        setup(Wax9TransportRef transport, int historyLength = 300);
     bool        start();
     bool        stop();
     int         update();
     
     void        resetOrientation(quat q = quat());
-    void        setDebug(bool b)                    { bDebug = b; }
-    void        setSmooth(bool s, float f = 0.5f)   { bSmooth = s; mSmoothFactor = f; }
+    void        setDebug(bool b)                    { bDebug = b; mTelemetry.setDebug(b); }
+    void        setSmooth(bool s, float f = 0.5f);  // all channels, f from 0 (none) to 1 like an EMA factor at rest
+    void        setSmooth(Wax9SmoothChannel channel, const Wax9SmoothSettings &settings);
+    const Wax9SmoothSettings&   getSmoothSettings(Wax9SmoothChannel channel)   { return mFusion.getSettings().smooth[channel]; }
+    void        setAhrs(Wax9AhrsAlgorithm algorithm, float twoKp = 0.1f, float twoKi = 0.0f);  // resets the orientation
+    void        setUseMagnetometer(bool b);         // fuse new magnetometer readings to correct heading drift
+    bool        getUseMagnetometer()                { return mFusion.getSettings().useMag; }
+    const Wax9FusionSettings&   getFusionSettings() const   { return mFusion.getSettings(); }   // to reprocess recordings the same way
+    
+    // output rate in Hz, sent right away while streaming. The adaptive rate drops to stillRate while
+    // the device is still and returns to the current rate on motion, see Wax9RateController.h
+    void        setOutputRate(int rate);
+    int         getOutputRate()                     { return mOutputRate; }
+    void        setAdaptiveRate(bool enabled, int stillRate = 20);
+    bool        getAdaptiveRate()                   { return bAdaptiveRate; }
+    Wax9RateController& getRateController()         { return mRateController; }    // thresholds and state
     
     bool        isConnected()                       { return bConnected; }
     bool        isEnabled()                         { return bEnabled; }
     
-    bool        hasReadings()                       { return !mSamples->empty(); }
+    bool        hasReadings()                       { return !mSamples.empty(); }
     bool        hasNewReadings()                    { return mNewReadings > 0; }    // not used yet
     int         getNumNewReadings()                 { return min(mNewReadings, getNumReadings()); }        // not used yet
-    int         getNumReadings()                    { return mSamples->size(); }
+    int         getNumReadings()                    { return mSamples.size(); }
     void        markAsRead()                        { mNewReadings = 0; }
     
-    Wax9Sample      getReading()                    { return mSamples->front(); }
-    Wax9Sample      getReading(int i)               { return mSamples->at(i); }
-    SampleBuffer*   getReadings()                   { return mSamples; }
+    Wax9Sample      getReading()                    { return mSamples.front(); }
+    Wax9Sample      getReading(int i)               { return mSamples.at(i); }
+    SampleBuffer*   getReadings()                   { return &mSamples; }
     
     quat        getOrientation(bool AHRS = false)   { return AHRS ? getReading().rotAHRS : getReading().rotOGL; }
     vec3        getAcceleration()                   { return getReading().acc; }
+    
+    // history interpolated at a host time (see getHostTime()), clamped to the oldest and newest samples.
+    // The batch versions take increasing times and resample them in a single pass
+    bool        sampleAt(double hostTime, Wax9Sample &sample);
+    quat        orientationAt(double hostTime, bool AHRS = false);
+    size_t      samplesAt(const double *hostTimes, size_t count, Wax9Sample *samples);
+    size_t      orientationsAt(const double *hostTimes, size_t count, quat *orientations, bool AHRS = false);
+    double      getSampleTime(int i);               // host time reading i was taken at
+    
+    // readings in a range, found by binary search. Bounds are inclusive. Sample numbers and
+    // timestamps are extended to 64 bits so they keep increasing across wrap-arounds and resets
+    Wax9SampleRange getSamplesByTime(double startTime, double endTime);         // host time, see getSampleTime()
+    Wax9SampleRange getSamplesByTimestamp(uint64_t start, uint64_t end);        // device time
+    Wax9SampleRange getSamplesBySampleNumber(uint64_t first, uint64_t last = std::numeric_limits<uint64_t>::max());
+    Wax9SampleRange getRecentSamples(double seconds);                           // up to the newest reading
+    uint64_t    getSampleNumber(int i)              { return mSampleKeys.at(i).sample; }
+    uint64_t    getTimestamp(int i)                 { return mSampleKeys.at(i).timestamp; }
+    
+    // newest orientation rotated forward by the gyro rate to hostTime (see getHostTime()), to hide latency
+    quat        predictOrientation(double hostTime, bool AHRS = false);
+    void        setPrediction(float maxHorizon, bool useTrend = false, float linkDelay = 0.0f);
+    Wax9ClockMap&   getClock()                      { return mClock; }  // device to host time
     float       getAccelerationLength()             { return getReading().accLen; }
     
-    bool            isBatteryLow()                  { return bBatteryLow; }
-    unsigned short  getBattery()                    { return mBattery; }
+    // The getters above and below are for the thread that calls update(). Other threads
+    // should use these, which never block update() or each other
+    bool        getSnapshot(Wax9State &state) const     { return mSnapshot.read(state); }
+    uint64_t    getSnapshotVersion() const              { return mSnapshot.getVersion(); }     // changes with every update()
+    
+    Wax9Telemetry&  getTelemetry()                  { return mTelemetry; }
+    bool            isBatteryLow()                  { return mTelemetry.isBatteryLow(); }
+    unsigned short  getBattery()                    { return mTelemetry.getBattery(); }        // in mV - see page 16 of dev guide
+    float           getTemperature()                { return mTelemetry.getTemperature(); }    // in Celsius
+    uint32_t        getPressure()                   { return mTelemetry.getPressure(); }       // in Pascals
+    
+    void        setGyroDelta(vec3 delta)            { mFusion.setGyroDelta(delta); }
+    vec3        getGyroDelta()                      { return mFusion.getSettings().gyroDelta; }
+    
+    // processing stages with their timings, see Wax9Pipeline.h
+    Wax9SamplePipeline& getPipeline()               { return mPipeline; }
+    Wax9MemoryUsage     getMemoryUsage() const;
+    
+    // raw packets are written to the recorder as they arrive (see Wax9Recording.h)
+    void            setRecorder(Wax9RecorderRef recorder)   { mRecorder = recorder; }
+    Wax9RecorderRef getRecorder()                           { return mRecorder; }
     
-    void        setGyroDelta(vec3 delta)            { mGyroDelta = delta; }
-    vec3        getGyroDelta()                      { return mGyroDelta; }
+    Wax9TransportRef    getTransport()              { return mTransport; }
     
+    // opt-in spans and latency histograms (see Wax9Trace.h), name defaults to the transport's
+    void            setTrace(Wax9TraceRef trace, const std::string &name = "");
+    Wax9TraceRef    getTrace()                      { return mTrace; }
+    
+    // frames and packets the decoder dropped and the limits it checks packets against
+    const Wax9DecodeStats&  getDecodeStats() const  { return mDecodeStats; }
+    uint64_t    getNumRejected() const;
+    void        setPacketLimits(const Wax9PacketLimits &limits) { mValidator.setLimits(limits); }
+    const Wax9PacketLimits& getPacketLimits() const { return mValidator.getLimits(); }
+    
+    static double getHostTime();    // monotonic host clock in seconds
+    static std::ostream& console();     // app::console() in Cinder apps, stdout otherwise
+    static unsigned long long ticksNow();   // milliseconds since the epoch
+    static void convertPacket(const Wax9Packet &packet, Wax9Sample &sample);  // raw packet to g, rad/s and uT
+    static float getSampleFreq(uint32_t timestamp, uint32_t previous, float nominal);  // from device timestamps, nominal after gaps
     static vec3 QuaternionToEuler(const quat &q);
     static quat AHRStoOpenGL(const quat &q);
     
@@ -139,24 +426,34 @@ protected:
     int                 readPackets(char *inBuffer);
     size_t              slipread(void *inBuffer, size_t len);
     size_t              lineread(void *inBuffer, size_t len);
-    Wax9Packet*         parseWax9Packet(const void *inputBuffer, size_t len, unsigned long long now);
-    Wax9Sample          processPacket(Wax9Packet *packet);
-    quat                calculateOrientation(const vec3 &acc, const vec3 &gyr, const vec3 &mag, uint32_t timestamp);
+    Wax9Packet*         parseWax9Packet(const void *inputBuffer, size_t len);
+    static size_t       getPacketLength(const unsigned char *buffer, size_t len);
+    void                acceptPacket(const Wax9Packet &packet, size_t len, unsigned long long now, double hostTime);
+    size_t              processBatch();
+    void                updateStats(size_t count);
+    void                publishState();
+    void                traceUpdate(uint64_t start);
+    void                traceRead(uint64_t start, uint64_t readNs, uint64_t decodeCycles, uint64_t parseCycles, uint64_t loopCycles, size_t count);
+    void                updateRate();
+    
+    // history queries
+    double              getNewestSampleTime();
+    int                 findSample(double hostTime, double newestTime);
+    Wax9SampleRange     getRange(size_t begin, size_t end);
+    template<typename Visit> void visitSamplesAt(const double *hostTimes, size_t count, Visit visit);
+    static void         interpolateSample(const Wax9Sample &older, const Wax9Sample &newer, float f, Wax9Sample &sample);
     
     // utils
-    void                printWax9(Wax9Packet *waxPacket);
-    const char*         timestamp(unsigned long long ticks);
-    unsigned long long  ticksNow();
+    void                printWax9(const Wax9Packet *waxPacket, unsigned long long ticks);
     
     // state
     bool                bConnected;
     bool                bDebug;
     bool                bEnabled;
-    bool                bSmooth;
     int                 mNewReadings;
     int                 mHistoryLength;
     float               mSmoothFactor;
-    float               mLastReadingTime;
+    double              mLastReadingTime;   // host time, see getHostTime()
     float               mTimeout;
     
     // device settings to construct init string
@@ -171,16 +468,42 @@ protected:
     int                 mGyrRange;
     int                 mDataMode;
     
-    vec3                mGyroDelta;
-    
     // data
-    char                mBuffer[BUFFER_SIZE];
-    bool                bBatteryLow;
-    unsigned short      mBattery;       // in mV - see page 16 of dev guide
-    uint32_t            mPressure;      // in Pascals
-    float               mTemperature;   // in Celsius
-    SerialRef           mSerial;
-    SampleBuffer*       mSamples;
-    ahrs_struct_t       mAhrs;      // interface with AHRS algorithm
+    Wax9Telemetry       mTelemetry;     // battery, temperature and pressure
+    Wax9TransportRef    mTransport;
+    Wax9PacketValidator mValidator;
+    Wax9DecodeStats     mDecodeStats;
+    bool                bSlipFrames;    // streaming binary, see readPackets()
+    SampleBuffer        mSamples;
+    boost::circular_buffer<Wax9SampleKey> mSampleKeys;  // same order as mSamples
+    Wax9SequenceExtender mExtender;
+    Wax9SamplePipeline  mPipeline;
+    std::vector<Wax9Packet> mBatchPackets;  // packets read in this update and when they arrived
+    std::vector<double>     mBatchTimes;
+    std::vector<Wax9Sample> mBatch;
+    
+    // stats and snapshots for other threads
+    uint64_t            mNumSamples;
+    uint64_t            mNumLost;
+    float               mSampleRate;
+    Wax9Snapshot<Wax9State> mSnapshot;
+    Wax9Fusion          mFusion;    // AHRS and smoothing
+    
+    // adaptive output rate
+    bool                bAdaptiveRate;
+    Wax9RateController  mRateController;
+    
+    // prediction
+    Wax9ClockMap        mClock;
+    float               mPredictionHorizon; // longest extrapolation in seconds
+    float               mLinkDelay;         // fixed transport delay, not measurable from timestamps
+    bool                bPredictTrend;      // extrapolate the change in gyro rate too
+    Wax9RecorderRef     mRecorder;
+    
+    // tracing, only while a trace is set
+    Wax9TraceRef        mTrace;
+    int                 mTraceTrack;
+    uint64_t            mTraceDeliverStart;
+    std::vector<double> mTraceLatencies;
 };
 
@@ -0,0 +1,404 @@
+/*
+ Wax9AhrsEngine
+ Header-only version of the Madgwick and Mahony filters in ahrs.c, specialized at compile
+ time for the algorithm and the sensor set (accelerometer and gyroscope only, or with the
+ magnetometer too).
+
+ Derived constants like the sample period are computed once when the settings change,
+ instead of on every update, and picking an algorithm doesn't cost a branch per sample:
+ Wax9Ahrs looks up the right specialization when it's set up and calls it through a
+ function pointer from then on. The C interface in ahrs.h is still there for code that
+ needs the old modes or the fixed-point filters.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+enum Wax9AhrsAlgorithm { WAX9_AHRS_MADGWICK = 0, WAX9_AHRS_MAHONY = 1 };     // same values as the ahrs.c modes
+enum Wax9AhrsSensors { WAX9_AHRS_IMU = 0, WAX9_AHRS_MARG = 1 };             // without or with magnetometer
+
+// Filter state plus the constants derived from its settings
+typedef struct
+{
+    float q[4];             // w x y z
+    float integralFB[3];    // [Mahony] integral error terms scaled by Ki
+    float sampleFreq;       // Hz
+    float twoKp;            // 2 * proportional gain ("beta" in Madgwick)
+    float twoKi;            // [Mahony] 2 * integral gain
+    float dt;               // 1 / sampleFreq
+    float halfDt;           // 0.5 / sampleFreq
+    float twoKiDt;          // twoKi / sampleFreq
+} Wax9AhrsState;
+
+// Normalises v in place, leaving zero vectors alone
+inline float wax9AhrsNormalize(float &x, float &y, float &z)
+{
+    float n = x * x + y * y + z * z;
+    if (n == 0.0f) return 0.0f;
+    float r = 1.0f / std::sqrt(n);
+    x *= r; y *= r; z *= r;
+    return n;
+}
+
+inline void wax9AhrsNormalizeQuaternion(float *q)
+{
+    float r = 1.0f / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    q[0] *= r; q[1] *= r; q[2] *= r; q[3] *= r;
+}
+
+template<int Algorithm, int Sensors> struct Wax9AhrsEngine;
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark madgwick
+/* -------------------------------------------------------------------------------------------------- */
+
+template<> struct Wax9AhrsEngine<WAX9_AHRS_MADGWICK, WAX9_AHRS_IMU> {
+
+    static void update(Wax9AhrsState &s, const float *gyro, const float *accel, const float * /*mag*/)
+    {
+        float *q = s.q;
+        float ax = accel[0], ay = accel[1], az = accel[2];
+        float gx = gyro[0], gy = gyro[1], gz = gyro[2];
+
+        // rate of change of quaternion from gyroscope
+        float qDot1 = 0.5f * (-q[1] * gx - q[2] * gy - q[3] * gz);
+        float qDot2 = 0.5f * (q[0] * gx + q[2] * gz - q[3] * gy);
+        float qDot3 = 0.5f * (q[0] * gy - q[1] * gz + q[3] * gx);
+        float qDot4 = 0.5f * (q[0] * gz + q[1] * gy - q[2] * gx);
+
+        // feedback only if the accelerometer reading is valid
+        if (wax9AhrsNormalize(ax, ay, az) != 0.0f) {
+            float _2q0 = 2.0f * q[0];
+            float _2q1 = 2.0f * q[1];
+            float _2q2 = 2.0f * q[2];
+            float _2q3 = 2.0f * q[3];
+            float _4q0 = 4.0f * q[0];
+            float _4q1 = 4.0f * q[1];
+            float _4q2 = 4.0f * q[2];
+            float _8q1 = 8.0f * q[1];
+            float _8q2 = 8.0f * q[2];
+            float q0q0 = q[0] * q[0];
+            float q1q1 = q[1] * q[1];
+            float q2q2 = q[2] * q[2];
+            float q3q3 = q[3] * q[3];
+
+            // gradient descent corrective step
+            float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+            float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q[1] - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+            float s2 = 4.0f * q0q0 * q[2] + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+            float s3 = 4.0f * q1q1 * q[3] - _2q1 * ax + 4.0f * q2q2 * q[3] - _2q2 * ay;
+            applyStep(s, qDot1, qDot2, qDot3, qDot4, s0, s1, s2, s3);
+        }
+        integrate(s, qDot1, qDot2, qDot3, qDot4);
+    }
+
+    // shared with the MARG version
+    static void applyStep(const Wax9AhrsState &s, float &qDot1, float &qDot2, float &qDot3, float &qDot4, float s0, float s1, float s2, float s3)
+    {
+        float n = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+        if (n == 0.0f) return;
+        float r = s.twoKp / std::sqrt(n);
+        qDot1 -= r * s0;
+        qDot2 -= r * s1;
+        qDot3 -= r * s2;
+        qDot4 -= r * s3;
+    }
+
+    static void integrate(Wax9AhrsState &s, float qDot1, float qDot2, float qDot3, float qDot4)
+    {
+        s.q[0] += qDot1 * s.dt;
+        s.q[1] += qDot2 * s.dt;
+        s.q[2] += qDot3 * s.dt;
+        s.q[3] += qDot4 * s.dt;
+        wax9AhrsNormalizeQuaternion(s.q);
+    }
+};
+
+template<> struct Wax9AhrsEngine<WAX9_AHRS_MADGWICK, WAX9_AHRS_MARG> {
+
+    typedef Wax9AhrsEngine<WAX9_AHRS_MADGWICK, WAX9_AHRS_IMU> IMU;
+
+    static void update(Wax9AhrsState &s, const float *gyro, const float *accel, const float *mag)
+    {
+        float *q = s.q;
+        float ax = accel[0], ay = accel[1], az = accel[2];
+        float gx = gyro[0], gy = gyro[1], gz = gyro[2];
+        float mx = mag[0], my = mag[1], mz = mag[2];
+
+        // a missing magnetometer reading would turn the quaternion into NaNs
+        if (wax9AhrsNormalize(mx, my, mz) == 0.0f) {
+            IMU::update(s, gyro, accel, NULL);
+            return;
+        }
+
+        float qDot1 = 0.5f * (-q[1] * gx - q[2] * gy - q[3] * gz);
+        float qDot2 = 0.5f * (q[0] * gx + q[2] * gz - q[3] * gy);
+        float qDot3 = 0.5f * (q[0] * gy - q[1] * gz + q[3] * gx);
+        float qDot4 = 0.5f * (q[0] * gz + q[1] * gy - q[2] * gx);
+
+        if (wax9AhrsNormalize(ax, ay, az) != 0.0f) {
+            float _2q0mx = 2.0f * q[0] * mx;
+            float _2q0my = 2.0f * q[0] * my;
+            float _2q0mz = 2.0f * q[0] * mz;
+            float _2q1mx = 2.0f * q[1] * mx;
+            float _2q0 = 2.0f * q[0];
+            float _2q1 = 2.0f * q[1];
+            float _2q2 = 2.0f * q[2];
+            float _2q3 = 2.0f * q[3];
+            float _2q0q2 = 2.0f * q[0] * q[2];
+            float _2q2q3 = 2.0f * q[2] * q[3];
+            float q0q0 = q[0] * q[0];
+            float q0q1 = q[0] * q[1];
+            float q0q2 = q[0] * q[2];
+            float q0q3 = q[0] * q[3];
+            float q1q1 = q[1] * q[1];
+            float q1q2 = q[1] * q[2];
+            float q1q3 = q[1] * q[3];
+            float q2q2 = q[2] * q[2];
+            float q2q3 = q[2] * q[3];
+            float q3q3 = q[3] * q[3];
+
+            // reference direction of Earth's magnetic field
+            float hx = mx * q0q0 - _2q0my * q[3] + _2q0mz * q[2] + mx * q1q1 + _2q1 * my * q[2] + _2q1 * mz * q[3] - mx * q2q2 - mx * q3q3;
+            float hy = _2q0mx * q[3] + my * q0q0 - _2q0mz * q[1] + _2q1mx * q[2] - my * q1q1 + my * q2q2 + _2q2 * mz * q[3] - my * q3q3;
+            float _2bx = std::sqrt(hx * hx + hy * hy);
+            float _2bz = -_2q0mx * q[2] + _2q0my * q[1] + mz * q0q0 + _2q1mx * q[3] - mz * q1q1 + _2q2 * my * q[3] - mz * q2q2 + mz * q3q3;
+            float _4bx = 2.0f * _2bx;
+            float _4bz = 2.0f * _2bz;
+
+            // residuals of gravity and field, each shared by the four gradient terms
+            float fgx = 2.0f * q1q3 - _2q0q2 - ax;
+            float fgy = 2.0f * q0q1 + _2q2q3 - ay;
+            float fgz = 1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az;
+            float fmx = _2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+            float fmy = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+            float fmz = _2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz;
+
+            float s0 = -_2q2 * fgx + _2q1 * fgy - _2bz * q[2] * fmx + (-_2bx * q[3] + _2bz * q[1]) * fmy + _2bx * q[2] * fmz;
+            float s1 =  _2q3 * fgx + _2q0 * fgy - 4.0f * q[1] * fgz + _2bz * q[3] * fmx + (_2bx * q[2] + _2bz * q[0]) * fmy + (_2bx * q[3] - _4bz * q[1]) * fmz;
+            float s2 = -_2q0 * fgx + _2q3 * fgy - 4.0f * q[2] * fgz + (-_4bx * q[2] - _2bz * q[0]) * fmx + (_2bx * q[1] + _2bz * q[3]) * fmy + (_2bx * q[0] - _4bz * q[2]) * fmz;
+            float s3 =  _2q1 * fgx + _2q2 * fgy + (-_4bx * q[3] + _2bz * q[1]) * fmx + (-_2bx * q[0] + _2bz * q[2]) * fmy + _2bx * q[1] * fmz;
+            IMU::applyStep(s, qDot1, qDot2, qDot3, qDot4, s0, s1, s2, s3);
+        }
+        IMU::integrate(s, qDot1, qDot2, qDot3, qDot4);
+    }
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark mahony
+/* -------------------------------------------------------------------------------------------------- */
+
+template<> struct Wax9AhrsEngine<WAX9_AHRS_MAHONY, WAX9_AHRS_IMU> {
+
+    static void update(Wax9AhrsState &s, const float *gyro, const float *accel, const float * /*mag*/)
+    {
+        float *q = s.q;
+        float ax = accel[0], ay = accel[1], az = accel[2];
+        float gx = gyro[0], gy = gyro[1], gz = gyro[2];
+
+        if (wax9AhrsNormalize(ax, ay, az) != 0.0f) {
+            // estimated direction of gravity
+            float halfvx = q[1] * q[3] - q[0] * q[2];
+            float halfvy = q[0] * q[1] + q[2] * q[3];
+            float halfvz = q[0] * q[0] - 0.5f + q[3] * q[3];
+
+            // error is the cross product between estimated and measured direction of gravity
+            float halfex = ay * halfvz - az * halfvy;
+            float halfey = az * halfvx - ax * halfvz;
+            float halfez = ax * halfvy - ay * halfvx;
+            applyFeedback(s, gx, gy, gz, halfex, halfey, halfez);
+        }
+        integrate(s, gx, gy, gz);
+    }
+
+    // the integral terms stay at zero while Ki is zero, see Wax9Ahrs::setGains()
+    static void applyFeedback(Wax9AhrsState &s, float &gx, float &gy, float &gz, float halfex, float halfey, float halfez)
+    {
+        s.integralFB[0] += s.twoKiDt * halfex;
+        s.integralFB[1] += s.twoKiDt * halfey;
+        s.integralFB[2] += s.twoKiDt * halfez;
+        gx += s.integralFB[0] + s.twoKp * halfex;
+        gy += s.integralFB[1] + s.twoKp * halfey;
+        gz += s.integralFB[2] + s.twoKp * halfez;
+    }
+
+    static void integrate(Wax9AhrsState &s, float gx, float gy, float gz)
+    {
+        float *q = s.q;
+        gx *= s.halfDt;
+        gy *= s.halfDt;
+        gz *= s.halfDt;
+        float qa = q[0];
+        float qb = q[1];
+        float qc = q[2];
+        q[0] += (-qb * gx - qc * gy - q[3] * gz);
+        q[1] += (qa * gx + qc * gz - q[3] * gy);
+        q[2] += (qa * gy - qb * gz + q[3] * gx);
+        q[3] += (qa * gz + qb * gy - qc * gx);
+        wax9AhrsNormalizeQuaternion(q);
+    }
+};
+
+template<> struct Wax9AhrsEngine<WAX9_AHRS_MAHONY, WAX9_AHRS_MARG> {
+
+    typedef Wax9AhrsEngine<WAX9_AHRS_MAHONY, WAX9_AHRS_IMU> IMU;
+
+    static void update(Wax9AhrsState &s, const float *gyro, const float *accel, const float *mag)
+    {
+        float *q = s.q;
+        float ax = accel[0], ay = accel[1], az = accel[2];
+        float gx = gyro[0], gy = gyro[1], gz = gyro[2];
+        float mx = mag[0], my = mag[1], mz = mag[2];
+
+        if (wax9AhrsNormalize(mx, my, mz) == 0.0f) {
+            IMU::update(s, gyro, accel, NULL);
+            return;
+        }
+
+        if (wax9AhrsNormalize(ax, ay, az) != 0.0f) {
+            float q0q0 = q[0] * q[0];
+            float q0q1 = q[0] * q[1];
+            float q0q2 = q[0] * q[2];
+            float q0q3 = q[0] * q[3];
+            float q1q1 = q[1] * q[1];
+            float q1q2 = q[1] * q[2];
+            float q1q3 = q[1] * q[3];
+            float q2q2 = q[2] * q[2];
+            float q2q3 = q[2] * q[3];
+            float q3q3 = q[3] * q[3];
+
+            // reference direction of Earth's magnetic field
+            float hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+            float hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+            float bx = std::sqrt(hx * hx + hy * hy);
+            float bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+            // estimated direction of gravity and magnetic field
+            float halfvx = q1q3 - q0q2;
+            float halfvy = q0q1 + q2q3;
+            float halfvz = q0q0 - 0.5f + q3q3;
+            float halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+            float halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+            float halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+            // error is the sum of the cross products between estimated and measured directions
+            float halfex = (ay * halfvz - az * halfvy) + (my * halfwz - mz * halfwy);
+            float halfey = (az * halfvx - ax * halfvz) + (mz * halfwx - mx * halfwz);
+            float halfez = (ax * halfvy - ay * halfvx) + (mx * halfwy - my * halfwx);
+            IMU::applyFeedback(s, gx, gy, gz, halfex, halfey, halfez);
+        }
+        IMU::integrate(s, gx, gy, gz);
+    }
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark filter
+/* -------------------------------------------------------------------------------------------------- */
+
+// Filter with its specialization chosen at runtime, once
+class Wax9Ahrs {
+public:
+
+    typedef void (*UpdateFn)(Wax9AhrsState &state, const float *gyro, const float *accel, const float *mag);
+
+    Wax9Ahrs()                                      { setup(WAX9_AHRS_MADGWICK, WAX9_AHRS_IMU, 120.0f, 0.1f); }
+
+    // selects the specialization and resets the orientation. Gains as in AhrsInit()
+    void setup(Wax9AhrsAlgorithm algorithm, Wax9AhrsSensors sensors, float sampleFreq, float twoKp, float twoKi = 0.0f)
+    {
+        mAlgorithm = algorithm;
+        mSensors = sensors;
+        mUpdate = getUpdateFn(algorithm, WAX9_AHRS_IMU);
+        mUpdateMag = getUpdateFn(algorithm, sensors);
+        mState.sampleFreq = sampleFreq;
+        mState.twoKp = twoKp;
+        mState.twoKi = twoKi;
+        updateConstants();
+        reset();
+    }
+
+    // switches between IMU and MARG without touching the orientation
+    void setSensors(Wax9AhrsSensors sensors)        { mSensors = sensors; mUpdateMag = getUpdateFn(mAlgorithm, sensors); }
+    void setSampleFreq(float sampleFreq)            { mState.sampleFreq = sampleFreq; updateConstants(); }
+    void setGains(float twoKp, float twoKi = 0.0f)
+    {
+        mState.twoKp = twoKp;
+        mState.twoKi = twoKi;
+        if (twoKi <= 0.0f) mState.integralFB[0] = mState.integralFB[1] = mState.integralFB[2] = 0.0f;   // prevent windup
+        updateConstants();
+    }
+
+    void reset()
+    {
+        const float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+        reset(q);
+    }
+    void reset(const float *q)
+    {
+        for (int i = 0; i < 4; i++) mState.q[i] = q[i];
+        for (int i = 0; i < 3; i++) mState.integralFB[i] = 0.0f;
+    }
+
+    // without mag only the gyroscope and accelerometer are fused, which is also what the MARG
+    // setup should do on samples where the magnetometer has no new reading (see Wax9 multi-rate fusion)
+    void update(const float *gyro, const float *accel)                      { mUpdate(mState, gyro, accel, NULL); }
+    void update(const float *gyro, const float *accel, const float *mag)    { mUpdateMag(mState, gyro, accel, mag); }
+
+    const float*            getQuaternion() const   { return mState.q; }
+    const Wax9AhrsState&    getState() const        { return mState; }
+    Wax9AhrsAlgorithm       getAlgorithm() const    { return mAlgorithm; }
+    Wax9AhrsSensors         getSensors() const      { return mSensors; }
+
+    static UpdateFn getUpdateFn(Wax9AhrsAlgorithm algorithm, Wax9AhrsSensors sensors)
+    {
+        if (algorithm == WAX9_AHRS_MAHONY) {
+            return sensors == WAX9_AHRS_MARG ? &Wax9AhrsEngine<WAX9_AHRS_MAHONY, WAX9_AHRS_MARG>::update : &Wax9AhrsEngine<WAX9_AHRS_MAHONY, WAX9_AHRS_IMU>::update;
+        }
+        return sensors == WAX9_AHRS_MARG ? &Wax9AhrsEngine<WAX9_AHRS_MADGWICK, WAX9_AHRS_MARG>::update : &Wax9AhrsEngine<WAX9_AHRS_MADGWICK, WAX9_AHRS_IMU>::update;
+    }
+
+protected:
+
+    void updateConstants()
+    {
+        mState.dt = 1.0f / mState.sampleFreq;
+        mState.halfDt = 0.5f * mState.dt;
+        mState.twoKiDt = mState.twoKi > 0.0f ? mState.twoKi * mState.dt : 0.0f;
+    }
+
+    Wax9AhrsAlgorithm   mAlgorithm;
+    Wax9AhrsSensors     mSensors;
+    UpdateFn            mUpdate;        // gyroscope and accelerometer
+    UpdateFn            mUpdateMag;     // plus magnetometer when set up for MARG
+    Wax9AhrsState       mState;
+};
@@ -0,0 +1,73 @@
+/*
+ Wax9BufferPool
+ Scratch buffers for reading packets, shared by all devices.
+
+ A device only needs a decode buffer while update() reads from its port, so instead of
+ each one keeping its own, they borrow one from this pool for the duration of the call.
+ The pool only grows to the number of devices updating at the same time, usually one
+ per thread.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// longest line or SLIP packet read from a device, packets are 36 bytes at most
+#define WAX9_DECODE_BUFFER_SIZE 256
+
+class Wax9BufferPool {
+public:
+
+    static char*    acquire();
+    static void     release(char *buffer);
+
+    static size_t   getNumAllocated();      // peak number of buffers in use at once
+    static size_t   getNumFree();
+    static size_t   getMemoryUsage()        { return getNumAllocated() * WAX9_DECODE_BUFFER_SIZE; }
+};
+
+// Borrows a buffer for the lifetime of the object
+class Wax9PooledBuffer {
+public:
+
+    Wax9PooledBuffer() : mData(Wax9BufferPool::acquire())  {}
+    ~Wax9PooledBuffer()                                     { Wax9BufferPool::release(mData); }
+
+    char*       get() const                                 { return mData; }
+    size_t      size() const                                { return WAX9_DECODE_BUFFER_SIZE; }
+
+private:
+
+    Wax9PooledBuffer(const Wax9PooledBuffer &);
+    Wax9PooledBuffer& operator=(const Wax9PooledBuffer &);
+
+    char*       mData;
+};
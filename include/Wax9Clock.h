@@ -0,0 +1,102 @@
+/*
+ Wax9Clock
+ Maps device timestamps to the host clock.
+
+ Packets reach the host after a Bluetooth hop whose delay changes from packet to packet,
+ so their arrival times are a noisy view of when they were sampled. The transport can
+ only add delay, so the smallest offset between host and device time seen over a block
+ of samples is the best estimate of the clock offset. A line fitted through the minima
+ of the last blocks gives the offset at any device time plus the drift between the two
+ clocks. The fixed part of the transport delay can't be observed from one-way timing
+ and is left to the caller.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class Wax9ClockMap {
+public:
+
+    Wax9ClockMap(double blockSeconds = 1.0, size_t numBlocks = 60);
+
+    void        reset();
+
+    // timestamp is the 16.16 device time of a packet, hostTime when it arrived (see Wax9::getHostTime())
+    void        add(uint32_t timestamp, double hostTime);
+
+    bool        isValid() const                     { return !bFirst; }
+
+    // host time of a device timestamp near the last one added, at the lowest delay seen
+    double      toHostTime(uint32_t timestamp) const;
+    double      toHostTime(double deviceTime) const;
+
+    double      getDeviceTime() const               { return mDeviceTime; }     // extended past the 32-bit wrap, seconds
+    double      getOffset() const                   { return getOffset(mDeviceTime); }
+    double      getDrift() const                    { return mDrift; }          // host seconds gained per device second
+    double      getExcessDelay() const              { return mExcessDelay; }    // smoothed delay above the minimum, seconds
+    int         getNumResets() const                { return mNumResets; }      // device clock jumps since the last reset()
+    size_t      getMemoryUsage() const              { return mPoints.capacity() * sizeof(Point); }
+
+protected:
+
+    typedef struct
+    {
+        double  deviceTime;
+        double  offset;
+    } Point;
+
+    double      getOffset(double deviceTime) const;
+    void        restart();
+    void        fit();
+
+    double              mBlockSeconds;
+    size_t              mNumBlocks;
+    bool                bFirst;
+    uint32_t            mLastTimestamp;
+    double              mDeviceTime;
+    int                 mNumResets;
+
+    // current block
+    double              mBlockStart;
+    double              mBlockMin;
+    double              mBlockMinTime;
+
+    // minima of the previous blocks and the line through them
+    std::vector<Point>  mPoints;
+    size_t              mNextPoint;
+    double              mFitTime;
+    double              mFitOffset;
+    double              mDrift;
+    double              mExcessDelay;
+};
@@ -0,0 +1,115 @@
+/*
+ Wax9Exporter
+ Writes sample history to disk from a background thread, for offline analysis.
+
+ Columns: sampleNumber, timestamp (16.16 seconds), hostTime (seconds), acc (g), gyr (rad/s),
+ mag (uT), rotAHRS (w x y z) and the Euler angles of rotAHRS (psi theta phi, radians).
+
+ FORMAT_CSV writes one row per sample with a header line. FORMAT_COLUMNAR writes one
+ contiguous array per column, so a column can be memory-mapped or read in one call.
+ The columns are spilled to temporary files while exporting and joined on close():
+    header          @0  "WAX9COL\0", uint32 version, uint32 number of columns,
+                        uint64 number of samples
+    column          @0  char[16] name, uint32 type (0 uint32, 1 float, 2 double),
+                        uint32 reserved, uint64 offset of the array
+    arrays              each starts on an 8-byte boundary, little-endian
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+#define WAX9_COLUMNAR_VERSION   1
+
+typedef std::shared_ptr<class Wax9Exporter> Wax9ExporterRef;
+
+class Wax9Exporter {
+public:
+
+    enum Format { FORMAT_CSV, FORMAT_COLUMNAR };
+    enum { NUM_COLUMNS = 19 };
+
+    // returns an empty ref if the file can't be created
+    static Wax9ExporterRef create(const std::string &path, Format format = FORMAT_CSV, int decimals = 6);
+    ~Wax9Exporter();
+
+    // queue the readings received in the last Wax9::update() call, or a batch of samples in any order
+    void        write(Wax9 &device);
+    void        write(const Wax9Sample *samples, size_t count);
+    void        write(const Wax9Sample &sample)     { write(&sample, 1); }
+
+    // waits until everything queued so far is on disk
+    void        flush();
+    // flushes, finishes the file and stops the writer thread
+    void        close();
+
+    Format      getFormat() const                   { return mFormat; }
+    uint64_t    getNumSamplesWritten() const        { return mNumSamplesWritten; }
+    uint64_t    getNumBytesWritten() const          { return mNumBytesWritten; }
+
+    static const char*  getColumnName(int column);
+
+protected:
+
+    Wax9Exporter(Format format, int decimals);
+
+    bool        open(const std::string &path);
+    void        threadedWrite();
+    void        writeCsv(const Wax9Sample *samples, size_t count);
+    void        writeColumns(const Wax9Sample *samples, size_t count);
+    void        finishColumns();
+
+    Format                      mFormat;
+    int                         mDecimals;
+    std::string                 mPath;
+    FILE*                       mFile;
+    std::vector<FILE*>          mColumnFiles;   // spill files while exporting columns
+    std::vector<char>           mBuffer;
+    std::vector<vec3>           mEulers;        // of the batch being written
+
+    std::vector<Wax9Sample>     mQueue;         // filled by write(), swapped out by the writer
+    std::mutex                  mMutex;
+    std::condition_variable     mCondition;
+    std::condition_variable     mDrained;
+    std::thread                 mThread;
+    bool                        bRunning;
+    bool                        bWriting;
+
+    std::atomic<uint64_t>       mNumSamplesWritten;
+    std::atomic<uint64_t>       mNumBytesWritten;
+};
@@ -0,0 +1,179 @@
+/*
+ Wax9Log
+ Diagnostics that are cheap enough to leave on while streaming.
+
+ Logging an event only copies its message pointer, the host time and the raw arguments
+ into a slot of a fixed ring shared by all threads, without locks or allocations. A
+ background thread formats and prints them later. When the ring is full new events are
+ dropped and counted, so producers never wait.
+
+ Messages are declared once, usually as function statics, and can limit how often they
+ are printed. Events over the limit are only counted and the next one printed says how
+ many were suppressed:
+
+    static Wax9LogMessage sLost(WAX9_LOG_WARNING, "lost %d packets", 1.0f);   // at most once per second
+    Wax9Log::get().log(sLost, numLost);
+
+ Formats are printf-like. Integers, floats and static strings can be passed in any mix,
+ %d and %x take integers, %f and %g floats, and %T prints host ticks (ms since the epoch)
+ as a date and time.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+
+#define WAX9_LOG_MAX_ARGS   12
+#define WAX9_LOG_CAPACITY   512     // events, must be a power of two
+
+enum Wax9LogLevel { WAX9_LOG_DEBUG = 0, WAX9_LOG_INFO, WAX9_LOG_WARNING };
+
+struct Wax9LogMessage {
+
+    Wax9LogMessage(Wax9LogLevel level, const char *format, float maxRate = 0.0f)
+    : level(level), format(format), maxRate(maxRate), window(0), count(0), suppressed(0) {}
+
+    Wax9LogLevel            level;
+    const char*             format;
+    float                   maxRate;        // events per second, 0 for no limit
+
+    // rate limiting, updated by the threads that log it
+    std::atomic<int64_t>    window;         // current one second window
+    std::atomic<uint32_t>   count;          // events in that window
+    std::atomic<uint32_t>   suppressed;     // not printed since the last one that was
+};
+
+struct Wax9LogArg {
+
+    enum Type { NONE = 0, INT, FLOAT, STRING, TICKS };
+
+    Wax9LogArg()                            : type(NONE) { i = 0; }
+    Wax9LogArg(int v)                       : type(INT) { i = v; }
+    Wax9LogArg(unsigned int v)              : type(INT) { i = v; }
+    Wax9LogArg(long v)                      : type(INT) { i = v; }
+    Wax9LogArg(unsigned long v)             : type(INT) { i = (long long)v; }
+    Wax9LogArg(long long v)                 : type(INT) { i = v; }
+    Wax9LogArg(unsigned long long v)        : type(INT) { i = (long long)v; }
+    Wax9LogArg(float v)                     : type(FLOAT) { d = v; }
+    Wax9LogArg(double v)                    : type(FLOAT) { d = v; }
+    Wax9LogArg(const char *v)               : type(STRING) { s = v; }   // must outlive the log, like a literal
+
+    static Wax9LogArg ticks(unsigned long long v)   { Wax9LogArg a(v); a.type = TICKS; return a; }
+
+    Type    type;
+    union {
+        long long   i;
+        double      d;
+        const char* s;
+    };
+};
+
+// An event as stored in the ring
+typedef struct
+{
+    Wax9LogMessage*     message;
+    double              hostTime;       // seconds since the log started
+    uint32_t            suppressed;     // events of this message dropped by the rate limit before it
+    uint8_t             numArgs;
+    uint8_t             types[WAX9_LOG_MAX_ARGS];
+    union {
+        long long       i;
+        double          d;
+        const char*     s;
+    }                   args[WAX9_LOG_MAX_ARGS];
+} Wax9LogEvent;
+
+class Wax9Log {
+public:
+
+    typedef std::function<void(const Wax9LogEvent &event, const std::string &text)> Sink;
+
+    static Wax9Log&     get();      // the process-wide log, its thread starts with the first event
+    ~Wax9Log();
+
+    // returns false if the event was rate limited or the ring was full
+    bool        log(Wax9LogMessage &message,
+                    Wax9LogArg a0 = Wax9LogArg(), Wax9LogArg a1 = Wax9LogArg(), Wax9LogArg a2 = Wax9LogArg(),
+                    Wax9LogArg a3 = Wax9LogArg(), Wax9LogArg a4 = Wax9LogArg(), Wax9LogArg a5 = Wax9LogArg(),
+                    Wax9LogArg a6 = Wax9LogArg(), Wax9LogArg a7 = Wax9LogArg(), Wax9LogArg a8 = Wax9LogArg(),
+                    Wax9LogArg a9 = Wax9LogArg(), Wax9LogArg a10 = Wax9LogArg(), Wax9LogArg a11 = Wax9LogArg());
+
+    void        setLevel(Wax9LogLevel level)    { mLevel = (int)level; }     // events below it are ignored right away
+    Wax9LogLevel getLevel() const               { return (Wax9LogLevel)mLevel.load(); }
+    void        setSink(const Sink &sink);      // receives formatted events instead of stdout and stderr (warnings)
+    void        flush();                        // waits until everything logged so far is printed
+
+    uint64_t    getNumLogged() const            { return mNumLogged.load(std::memory_order_relaxed); }
+    uint64_t    getNumDropped() const           { return mNumDropped.load(std::memory_order_relaxed); }   // ring was full
+    uint64_t    getNumSuppressed() const        { return mNumSuppressed.load(std::memory_order_relaxed); }  // rate limited
+
+    static std::string  format(const Wax9LogEvent &event);
+
+protected:
+
+    Wax9Log();
+
+    struct Slot {
+        std::atomic<uint64_t>   seq;
+        Wax9LogEvent            event;
+    };
+
+    bool        allow(Wax9LogMessage &message, double hostTime, uint32_t &suppressed);
+    void        start();
+    void        run();
+    size_t      drain();
+    static void print(const Wax9LogEvent &event, const std::string &text);
+
+    std::unique_ptr<Slot[]> mSlots;
+    std::atomic<uint64_t>   mHead;          // next slot to write, shared by producers
+    std::atomic<uint64_t>   mTail;          // next slot to format, only advanced by the thread
+    std::atomic<uint64_t>   mNumLogged;
+    std::atomic<uint64_t>   mNumDropped;
+    std::atomic<uint64_t>   mNumSuppressed;
+    std::atomic<int>        mLevel;
+
+    std::thread             mThread;
+    std::once_flag          mStarted;
+    std::atomic<bool>       bQuit;
+    std::mutex              mMutex;         // only for the sink and for waiting
+    std::condition_variable mCondition;
+    std::condition_variable mDrained;
+    Sink                    mSink;
+};
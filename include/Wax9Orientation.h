@@ -0,0 +1,78 @@
+/*
+ Wax9Orientation
+ Orientation conversions over whole arrays, for exporting and analysing histories.
+
+ Every function takes count quaternions stride bytes apart, so they can be read straight
+ out of an array of samples:
+
+    Wax9Orientation::toEuler(&samples[0].rotAHRS, count, eulers, sizeof(Wax9Sample));
+
+ Four are converted at a time with SSE2 where it's available. The rest, and everything on
+ other platforms, goes through scalar code with the same arithmetic.
+
+ atan2 and asin are polynomial: a degree 15 minimax fit of atan on [0, 1] (error 4e-8 rad)
+ with range reduction for the rest, and asin(x) as atan2(x, sqrt(1 - x^2)). After float
+ rounding both are within 4e-7 rad (2e-5 degrees) of the double precision functions, about
+ as close as the float ones of the standard library, and the Euler angles are within 5e-7
+ rad of Wax9::QuaternionToEuler(). asin clamps its input to [-1, 1].
+
+ The conversion to OpenGL needs no trigonometry: the Euler angle round trip it was defined
+ with (see Wax9::AHRStoOpenGL()) only reorders the components. That is also exact at 90
+ degrees of pitch, where the Euler angles lose precision.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Matrix.h"
+#include "cinder/Quaternion.h"
+
+#include <stddef.h>
+
+class Wax9Orientation {
+public:
+
+    // psi, theta and phi in radians like Wax9::QuaternionToEuler()
+    static void     toEuler(const ci::quat *q, size_t count, ci::vec3 *euler, size_t stride = sizeof(ci::quat));
+
+    // rotation matrices like glm::toMat3()
+    static void     toMatrix(const ci::quat *q, size_t count, ci::mat3 *matrices, size_t stride = sizeof(ci::quat));
+
+    // unit axes, (0, 0, 1) for no rotation, and angles in [0, 2 pi] like glm::axis() and glm::angle()
+    static void     toAxisAngle(const ci::quat *q, size_t count, ci::vec3 *axes, float *angles, size_t stride = sizeof(ci::quat));
+
+    // like Wax9::AHRStoOpenGL(), outStride for writing into samples too
+    static void     toOpenGL(const ci::quat *q, size_t count, ci::quat *out, size_t stride = sizeof(ci::quat), size_t outStride = sizeof(ci::quat));
+
+    // the approximations on their own
+    static float    atan2(float y, float x);
+    static float    asin(float x);
+};
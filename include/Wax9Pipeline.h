@@ -0,0 +1,194 @@
+/*
+ Wax9Pipeline
+ The stages a Wax9 sample goes through, from the serial port to the history, with the
+ time spent in each.
+
+ Built-in stages run in a fixed order and the optional ones (fusion, smoothing and the
+ OpenGL frame transform) can be switched off. User stages run after them and can modify
+ the samples before they're stored; sinks see them once they are. Stages are called once
+ per batch of packets read in an update, so there is no per-sample indirection, and every
+ call is timed with the CPU cycle counter.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define WAX9_HAS_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define WAX9_HAS_TSC
+#else
+    #include <chrono>
+#endif
+
+enum Wax9PipelineStage
+{
+    WAX9_STAGE_DECODE = 0,      // reading the port and SLIP decoding
+    WAX9_STAGE_PARSE,           // binary packets to Wax9Packet, recorder included
+    WAX9_STAGE_CALIBRATE,       // sensor units and device clock
+    WAX9_STAGE_FUSION,          // AHRS, rotAHRS is identity when disabled
+    WAX9_STAGE_SMOOTH,          // only runs while smoothing is on, see Wax9::setSmooth()
+    WAX9_STAGE_FRAME,           // rotOGL, identity when disabled
+    WAX9_STAGE_STORE,           // into the history
+    WAX9_NUM_BUILTIN_STAGES
+};
+
+// TSC cycles on x86, nanoseconds elsewhere
+inline uint64_t wax9Cycles()
+{
+#ifdef WAX9_HAS_TSC
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+template<typename Sample>
+class Wax9Pipeline {
+public:
+
+    typedef std::function<void(Sample *samples, size_t count)>        StageFn;
+    typedef std::function<void(const Sample *samples, size_t count)>  SinkFn;
+
+    typedef struct
+    {
+        std::string     name;
+        bool            enabled;
+        bool            optional;   // built-in stages that can be switched off, and all user stages
+        bool            sink;
+        uint64_t        cycles;
+        uint64_t        samples;
+        uint64_t        batches;
+    } Stage;
+
+    Wax9Pipeline()
+    {
+        static const char *names[WAX9_NUM_BUILTIN_STAGES] = { "decode", "parse", "calibrate", "fusion", "smooth", "frame", "store" };
+        for (int i = 0; i < WAX9_NUM_BUILTIN_STAGES; i++) {
+            bool optional = i == WAX9_STAGE_FUSION || i == WAX9_STAGE_SMOOTH || i == WAX9_STAGE_FRAME;
+            addStage(names[i], optional, false);
+        }
+    }
+
+    // user stages run in the order they were added, after the built-in ones. Both return the stage id
+    int         addStage(const std::string &name, const StageFn &fn)    { int id = addStage(name, true, false); mStageFns[id] = fn; return id; }
+    int         addSink(const std::string &name, const SinkFn &fn)      { int id = addStage(name, true, true); mSinkFns[id] = fn; return id; }
+
+    void        setEnabled(int stage, bool enabled)     { if (mStages[stage].optional) mStages[stage].enabled = enabled; }
+    bool        isEnabled(int stage) const              { return mStages[stage].enabled; }
+
+    size_t      getNumStages() const                    { return mStages.size(); }
+    const Stage&    getStage(int stage) const           { return mStages[stage]; }
+    double      getCyclesPerSample(int stage) const     { return mStages[stage].samples ? (double)mStages[stage].cycles / mStages[stage].samples : 0.0; }
+
+    size_t getMemoryUsage() const
+    {
+        size_t bytes = mStages.capacity() * sizeof(Stage) + mStageFns.capacity() * sizeof(StageFn) + mSinkFns.capacity() * sizeof(SinkFn);
+        for (size_t i = 0; i < mStages.size(); i++) bytes += mStages[i].name.capacity();
+        return bytes;
+    }
+
+    void resetStats()
+    {
+        for (size_t i = 0; i < mStages.size(); i++) mStages[i].cycles = mStages[i].samples = mStages[i].batches = 0;
+    }
+
+    // adds the time a stage took for a batch
+    void record(int stage, uint64_t cycles, size_t count)
+    {
+        Stage &s = mStages[stage];
+        s.cycles += cycles;
+        s.samples += count;
+        s.batches++;
+    }
+
+    void runStages(Sample *samples, size_t count)
+    {
+        for (size_t i = WAX9_NUM_BUILTIN_STAGES; i < mStages.size(); i++) {
+            if (mStages[i].sink || !mStages[i].enabled) continue;
+            uint64_t start = wax9Cycles();
+            mStageFns[i](samples, count);
+            record((int)i, wax9Cycles() - start, count);
+        }
+    }
+
+    void runSinks(const Sample *samples, size_t count)
+    {
+        for (size_t i = WAX9_NUM_BUILTIN_STAGES; i < mStages.size(); i++) {
+            if (!mStages[i].sink || !mStages[i].enabled) continue;
+            uint64_t start = wax9Cycles();
+            mSinkFns[i](samples, count);
+            record((int)i, wax9Cycles() - start, count);
+        }
+    }
+
+    void printReport(std::ostream &os) const
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < mStages.size(); i++) total += mStages[i].cycles;
+
+#ifdef WAX9_HAS_TSC
+        os << "stage           cycles/sample   share     samples" << std::endl;
+#else
+        os << "stage           ns/sample       share     samples" << std::endl;
+#endif
+        for (size_t i = 0; i < mStages.size(); i++) {
+            const Stage &s = mStages[i];
+            os << std::left << std::setw(16) << (s.name + (s.enabled ? "" : " (off)")) << std::right
+               << std::setw(13) << std::fixed << std::setprecision(1) << getCyclesPerSample((int)i)
+               << std::setw(8) << std::setprecision(1) << (total ? 100.0 * s.cycles / total : 0.0) << "%"
+               << std::setw(12) << s.samples << std::endl;
+        }
+    }
+
+protected:
+
+    int addStage(const std::string &name, bool optional, bool sink)
+    {
+        Stage s = { name, true, optional, sink, 0, 0, 0 };
+        mStages.push_back(s);
+        mStageFns.push_back(StageFn());
+        mSinkFns.push_back(SinkFn());
+        return (int)mStages.size() - 1;
+    }
+
+    std::vector<Stage>      mStages;
+    std::vector<StageFn>    mStageFns;      // indexed by stage id, empty for built-ins and sinks
+    std::vector<SinkFn>     mSinkFns;
+};
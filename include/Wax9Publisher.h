@@ -0,0 +1,139 @@
+/*
+ Wax9Publisher
+ Sends fused Wax9 samples over UDP to one or more destinations, as OSC bundles or
+ in a compact binary format.
+
+ Samples are queued from the render thread with publish() and sent from a background
+ thread, packing as many samples per datagram as fit in the configured MTU. Every
+ datagram carries a sequence number so receivers can detect loss.
+
+ Binary datagram layout (little-endian):
+    header  @0  'W' '9'             magic
+            @2  uint8   version     (1)
+            @3  uint8   count       number of samples
+            @4  uint32  sequence    datagram sequence number
+    sample  @0  uint8   deviceId
+            @1  uint8   reserved
+            @2  uint16  sampleNumber
+            @4  uint32  timestamp   (16.16 seconds, device clock)
+            @8  double  hostTime    (seconds, sender clock)
+            @16 int16   acc[3]      (1/4096 g)
+            @22 int16   gyr[3]      (0.07 degrees/s)
+            @28 int16   mag[3]      (0.1 uT)
+            @34 int16   rot[4]      (w x y z of rotOGL, 1/32767)
+            @42
+
+ OSC bundles contain a "/wax9/seq i" message followed by one message per sample:
+    /wax9/sample ,iiidfffffffffffff  deviceId sampleNumber timestamp hostTime acc gyr mag rotOGL(w x y z)
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+typedef std::shared_ptr<class Wax9Publisher> Wax9PublisherRef;
+
+class Wax9Publisher {
+public:
+
+    enum Format { FORMAT_OSC, FORMAT_BINARY };
+
+    static Wax9PublisherRef create(Format format = FORMAT_OSC, size_t mtu = 1472)  { return Wax9PublisherRef(new Wax9Publisher(format, mtu)); }
+    ~Wax9Publisher();
+
+    // false if the socket could not be created, nothing is queued or sent in that case
+    bool        isOpen() const                          { return mSocket >= 0; }
+
+    // destinations can be added at any time, samples are sent to all of them
+    bool        addDestination(const std::string &host, uint16_t port);
+    void        clearDestinations();
+
+    // queue the readings received in the last Wax9::update() call
+    void        publish(Wax9 &device, uint8_t deviceId = 0);
+    void        publish(const Wax9Sample &sample, uint8_t deviceId = 0);
+
+    // samples wait at most this long for a datagram to fill up (0 sends on every publish)
+    void        setMaxLatency(double seconds)           { mMaxLatency = seconds; }
+    double      getMaxLatency() const                   { return mMaxLatency; }
+
+    Format      getFormat() const                       { return mFormat; }
+    size_t      getMtu() const                          { return mMtu; }
+    size_t      getSamplesPerDatagram() const;
+
+    uint32_t    getSequence() const                     { return mSequence; }
+    uint64_t    getNumSamplesSent() const               { return mNumSamplesSent; }
+    uint64_t    getNumDatagramsSent() const             { return mNumDatagramsSent; }
+    uint64_t    getNumSendErrors() const                { return mNumSendErrors; }
+
+    // datagram sizes, exposed for receivers
+    enum { BINARY_HEADER_SIZE = 8, BINARY_SAMPLE_SIZE = 42 };
+
+protected:
+
+    Wax9Publisher(Format format, size_t mtu);
+
+    typedef struct
+    {
+        uint8_t     deviceId;
+        Wax9Sample  sample;
+    } QueuedSample;
+
+    void        threadedSend();
+    size_t      writeBinary(const QueuedSample *samples, size_t count, char *out);
+    size_t      writeOsc(const QueuedSample *samples, size_t count, char *out);
+    void        send(const char *data, size_t len, const std::vector<std::vector<char> > &destinations);
+
+    Format                      mFormat;
+    size_t                      mMtu;
+    std::atomic<double>         mMaxLatency;
+
+    std::vector<QueuedSample>   mQueue;         // filled by publish(), swapped out by the sender
+    double                      mQueueStart;    // host time of the oldest queued sample
+    std::mutex                  mMutex;
+    std::condition_variable     mCondition;
+    std::thread                 mThread;
+    bool                        bRunning;
+
+    intptr_t                    mSocket;
+#ifdef _WIN32
+    bool                        bWinsock;
+#endif
+    std::vector<std::vector<char> > mDestinations;   // sockaddr storage
+
+    std::atomic<uint32_t>       mSequence;
+    std::atomic<uint64_t>       mNumSamplesSent;
+    std::atomic<uint64_t>       mNumDatagramsSent;
+    std::atomic<uint64_t>       mNumSendErrors;
+};
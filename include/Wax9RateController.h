@@ -0,0 +1,84 @@
+/*
+ Wax9RateController
+ Output rate that follows motion, so idle devices leave the radio to the moving ones.
+
+ The device runs at the motion rate while it moves and drops to the still rate once the
+ gyro and the accelerometer have been quiet for a while. Motion brings it back up right
+ away. Two pairs of thresholds and the still time give hysteresis, so a device in light
+ motion doesn't keep switching: between the still and motion thresholds it stays at the
+ rate it has.
+
+ Wax9::setAdaptiveRate() runs one per device and sends the rate changes, see there.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct
+{
+    int         stillRate;      // Hz
+    int         motionRate;     // Hz
+    float       motionGyro;     // deg/s, faster is motion
+    float       stillGyro;      // deg/s, slower can be still
+    float       motionAcc;      // g away from 1 g, more is motion
+    float       stillAcc;       // g away from 1 g, less can be still
+    float       stillTime;      // seconds still before slowing down
+    float       minInterval;    // seconds between slowing down and the previous change
+} Wax9RateSettings;
+
+class Wax9RateController {
+public:
+
+    Wax9RateController();
+
+    void        setSettings(const Wax9RateSettings &settings);
+    const Wax9RateSettings& getSettings() const     { return mSettings; }
+    static Wax9RateSettings getDefaultSettings(int motionRate = 120);
+
+    void        reset();        // moving, at the motion rate
+
+    // strongest motion in the readings of an update, returns the rate the device should run at
+    int         update(float gyro, float acc, double hostTime);
+
+    int         getRate() const                 { return mRate; }
+    bool        isMoving() const                { return bMoving; }
+    uint64_t    getNumChanges() const           { return mNumChanges; }
+
+protected:
+
+    Wax9RateSettings mSettings;
+    bool        bMoving;
+    int         mRate;
+    double      mStillSince;    // host time, negative while not still
+    double      mLastChange;
+    uint64_t    mNumChanges;
+};
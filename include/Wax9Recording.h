@@ -0,0 +1,224 @@
+/*
+ Wax9Recording
+ Compact on-disk recording of raw Wax9 packets.
+
+ Packets are buffered into chunks. Each chunk stores every field as its own channel:
+ values are delta-encoded against the previous sample (or twice, for channels that
+ change at a steady rate like the timestamps), then written either as zigzag varints
+ or bit-packed in blocks of 128, whichever is smaller. Channels that never change
+ within the chunk cost a single value. Every chunk has a header with its first
+ sample number, timestamp and host time, and a checksum of its payload.
+
+ File layout (little-endian):
+    file header     @0  "WAX9REC\0", uint32 version, uint32 output rate,
+                        char[64] device name, uint64 start ticks, uint64 reserved
+    chunk           @0  uint32 magic "W9CK", uint32 count, uint32 payload size,
+                        uint32 checksum (Adler-32 of the payload),
+                        uint64 first sample, uint64 first timestamp,
+                        uint64 first ticks, uint64 last ticks
+                    @48 payload: for each channel a mode byte followed by its data
+
+ Index file (<recording>.idx), appended after every chunk and rebuilt from the chunk
+ headers when it's missing or shorter than the recording:
+    header          @0  "WAX9IDX\0", uint32 version, uint32 entry size
+    entry           @0  uint64 chunk offset, uint32 count, uint32 payload size,
+                        uint64 first sample, uint64 first timestamp,
+                        uint64 first ticks, uint64 last ticks
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+
+#include <vector>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#define WAX9_RECORDING_VERSION      1
+#define WAX9_RECORDING_HEADER_SIZE  96
+#define WAX9_CHUNK_HEADER_SIZE      48
+#define WAX9_INDEX_VERSION          1
+#define WAX9_INDEX_HEADER_SIZE      16
+#define WAX9_INDEX_ENTRY_SIZE       48
+
+// A raw packet as recorded, with the host time it arrived at
+typedef struct
+{
+    Wax9Packet          packet;
+    unsigned long long  ticks;          // host time in ms since epoch
+} Wax9RecordedPacket;
+
+// Chunk header, also used to build the time index
+typedef struct
+{
+    uint32_t            count;
+    uint32_t            payloadSize;
+    uint32_t            checksum;
+    uint64_t            firstSample;    // sample number extended past the 16-bit wrap
+    uint64_t            firstTimestamp; // device timestamp extended past the 32-bit wrap (16.16 seconds)
+    unsigned long long  firstTicks;
+    unsigned long long  lastTicks;
+} Wax9ChunkHeader;
+
+// Where a chunk starts in the file
+typedef struct
+{
+    uint64_t            offset;
+    Wax9ChunkHeader     header;         // checksum isn't stored in the index
+} Wax9IndexEntry;
+
+// Chunk encoding and decoding, shared by the recorder, the reader and offline tools
+class Wax9ChunkCodec {
+public:
+
+    // appends the encoded payload of count packets to out and returns its size
+    static size_t   encode(const Wax9RecordedPacket *packets, size_t count, std::vector<uint8_t> &out);
+
+    // decodes count packets, returns false if the payload is malformed
+    static bool     decode(const uint8_t *payload, size_t size, size_t count, Wax9RecordedPacket *packets);
+
+    static uint32_t checksum(const uint8_t *data, size_t size);
+};
+
+typedef std::shared_ptr<class Wax9Recorder> Wax9RecorderRef;
+
+// Full chunks are handed to a writer thread, which encodes them and writes them to disk,
+// so write() never waits on the encoder or the file system
+class Wax9Recorder {
+public:
+
+    static Wax9RecorderRef create(const std::string &path, const std::string &deviceName = "", int outputRate = 120, size_t chunkSize = 4096);
+    ~Wax9Recorder();
+
+    void        write(const Wax9Packet &packet, unsigned long long ticks);
+    void        flush();                        // writes the current chunk, even if it isn't full, and waits until it's on disk
+    void        close();
+    void        markRestart()                   { mExtender.markRestart(); }   // see Wax9SequenceExtender
+
+    bool        isOpen() const                  { return mFile != NULL; }
+    uint64_t    getNumPackets() const           { return mNumPackets; }
+    uint64_t    getNumBytesWritten() const      { return mNumBytes; }
+    float       getCompressionRatio() const;    // raw packet bytes / bytes on disk
+
+protected:
+
+    Wax9Recorder();
+
+    typedef struct
+    {
+        std::vector<Wax9RecordedPacket> packets;
+        uint64_t                        firstSample;
+        uint64_t                        firstTimestamp;
+    } QueuedChunk;
+
+    void        queueChunk();
+    void        threadedWrite();
+    void        writeChunk(const QueuedChunk &chunk);
+
+    FILE*                               mFile;
+    FILE*                               mIndexFile;
+    size_t                              mChunkSize;
+    std::vector<Wax9RecordedPacket>     mPending;
+    Wax9SequenceExtender                mExtender;
+    uint64_t                            mChunkSample;
+    uint64_t                            mChunkTimestamp;
+    uint64_t                            mNumPackets;
+    std::atomic<uint64_t>               mNumBytes;
+
+    std::vector<QueuedChunk>            mQueue;         // filled by write(), swapped out by the writer
+    std::vector<std::vector<Wax9RecordedPacket> > mFree;   // written chunks, reused by write()
+    bool                                bWriting;       // the writer has chunks out of the queue
+    std::mutex                          mMutex;
+    std::condition_variable             mCondition;
+    std::condition_variable             mWritten;
+    std::thread                         mThread;
+    bool                                bRunning;
+    std::vector<uint8_t>                mEncoded;       // writer thread only
+};
+
+class Wax9RecordingReader {
+public:
+
+    Wax9RecordingReader();
+    ~Wax9RecordingReader();
+
+    bool        open(const std::string &path);
+    void        close();
+    bool        isOpen() const                  { return mFile != NULL; }
+
+    const std::string&  getDeviceName() const   { return mDeviceName; }
+    int                 getOutputRate() const   { return mOutputRate; }
+    unsigned long long  getStartTicks() const   { return mStartTicks; }
+
+    // reads the next packet in the file, returns false at the end. Damaged chunks are skipped
+    bool        next(Wax9RecordedPacket &packet);
+
+    // reads the next whole chunk at once, which is what offline tools should use
+    bool        readChunk(Wax9ChunkHeader &header, std::vector<Wax9RecordedPacket> &packets);
+
+    // position next() at the first packet at or after the given extended sample number,
+    // extended device timestamp (16.16 seconds) or host ticks. Binary search over the index
+    // plus decoding a single chunk, so seeking costs the same anywhere in the file
+    bool        seekToSample(uint64_t sample);
+    bool        seekToTimestamp(uint64_t timestamp);
+    bool        seekToTicks(unsigned long long ticks);
+    bool        seekToChunk(size_t chunk);
+    void        rewind()                        { seekToChunk(0); }
+
+    const std::vector<Wax9IndexEntry>&  getIndex() const    { return mIndex; }
+    uint64_t    getNumPackets() const;
+    bool        wasIndexRebuilt() const         { return bIndexRebuilt; }
+
+    // scans the recording and writes a fresh index next to it
+    static bool rebuildIndex(const std::string &path);
+
+protected:
+
+    void        loadIndex(const std::string &path);
+    void        scanChunks(uint64_t offset);
+    bool        loadChunk(size_t chunk, std::vector<Wax9RecordedPacket> &packets);
+    bool        seekWithin(size_t chunk, int key, uint64_t value);
+
+    FILE*                               mFile;
+    uint64_t                            mFileSize;
+    std::string                         mDeviceName;
+    int                                 mOutputRate;
+    unsigned long long                  mStartTicks;
+    std::vector<Wax9IndexEntry>         mIndex;
+    bool                                bIndexRebuilt;
+    size_t                              mNextChunk;
+    std::vector<uint8_t>                mPayload;
+    std::vector<Wax9RecordedPacket>     mChunk;
+    size_t                              mChunkPos;
+};
@@ -0,0 +1,101 @@
+/*
+ Wax9Reprocessor
+ Re-derives orientation for recorded sessions, e.g. after changing the AHRS gains or the
+ gyro calibration.
+
+ Every recording (one device each, see Wax9Recording.h) is an independent job: it's
+ decoded and run through the same Wax9Fusion as a live device from the first packet, and
+ the result is written with a Wax9Exporter. With the fusion settings of the device that
+ recorded it (Wax9::getFusionSettings()) the output matches what it computed live. Jobs run on a Wax9WorkPool, so a session with many
+ devices, or many sessions, keep every core busy. hostTime in the output is the
+ recorded host time in seconds since the epoch.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+#include "Wax9Exporter.h"
+#include "Wax9WorkPool.h"
+
+#include <vector>
+
+class Wax9Reprocessor {
+public:
+
+    typedef struct
+    {
+        Wax9FusionSettings      fusion;         // AHRS, gyro calibration and smoothing
+        Wax9Exporter::Format    format;
+    } Settings;
+
+    typedef struct
+    {
+        std::string     input;
+        std::string     output;
+        bool            ok;
+        uint64_t        numSamples;
+        double          seconds;
+        int             worker;
+    } Job;
+
+    explicit Wax9Reprocessor(int numThreads = 0);
+
+    static Settings     getDefaultSettings();
+    void                setSettings(const Settings &settings)   { mSettings = settings; }
+    const Settings&     getSettings() const                     { return mSettings; }
+
+    void        addFile(const std::string &input, const std::string &output);
+    void        clear()                                 { mJobs.clear(); }
+
+    // processes every file added so far, returns false if any of them failed
+    bool        run();
+
+    const std::vector<Job>&     getJobs() const         { return mJobs; }
+    uint64_t    getNumSamples() const;
+    double      getSeconds() const                      { return mSeconds; }
+
+    // samples per second of busy time, per worker, and for the whole run
+    double      getWorkerThroughput(int worker) const;
+    double      getThroughput() const                   { return mSeconds > 0.0 ? getNumSamples() / mSeconds : 0.0; }
+    int         getNumThreads() const                   { return mPool.getNumThreads(); }
+    void        printReport() const;
+
+    // the per-job work, usable on its own
+    static bool processFile(const std::string &input, const std::string &output, const Settings &settings, uint64_t *numSamples = NULL);
+
+protected:
+
+    Settings                mSettings;
+    std::vector<Job>        mJobs;
+    std::vector<uint64_t>   mWorkerSamples;
+    double                  mSeconds;
+    Wax9WorkPool            mPool;
+};
@@ -0,0 +1,152 @@
+/*
+ Wax9SharedMemory
+ Shared-memory ring of fused Wax9 samples, so several processes on the same host can
+ read the stream of a device that only one of them has open.
+
+ The ring has a single writer per device (see Wax9SharedPublisher) and any number of
+ readers. Each slot is protected by a sequence lock, so readers never block the writer
+ or each other: they copy a slot and check that it wasn't overwritten while copying.
+ Every reader keeps its own cursor and reports the samples it missed if it falls
+ behind by more than the ring capacity.
+
+ This header and its source file don't depend on Cinder, so they can be used on their
+ own by processes that only consume samples.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+#define WAX9_SHARED_MAGIC       0x39584157      // "WAX9"
+#define WAX9_SHARED_VERSION     1
+#define WAX9_SHARED_RETIRED     0x44524552      // a writer with another capacity replaced the segment
+
+// Sample as stored in shared memory, plain floats so readers don't need Cinder
+typedef struct
+{
+    uint64_t    index;              // position in the stream since the writer started
+    double      hostTime;           // seconds, writer's monotonic clock
+    uint32_t    timestamp;          // 16.16 seconds, device clock
+    uint16_t    sampleNumber;
+    uint16_t    reserved;
+    float       accLen;
+    float       acc[3];             // g
+    float       gyr[3];             // rad/s
+    float       mag[3];             // uT
+    float       rotAHRS[4];         // w x y z
+    float       rotOGL[4];          // w x y z
+} Wax9SharedSample;
+
+// Ring slot. seq is 2 * index + 1 while being written and 2 * index + 2 once complete
+typedef struct
+{
+    std::atomic<uint64_t>   seq;
+    Wax9SharedSample        sample;
+} Wax9SharedSlot;
+
+// Segment header, followed by capacity slots
+typedef struct
+{
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                capacity;       // power of two
+    uint32_t                slotSize;
+    char                    deviceName[64];
+    std::atomic<uint64_t>   writeIndex;     // number of samples published so far
+    std::atomic<uint64_t>   writerId;       // process id of the current writer
+    char                    padding[32];
+} Wax9SharedHeader;
+
+// Maps a named segment into the process. Used by both the writer and the readers
+class Wax9SharedSegment {
+public:
+
+    Wax9SharedSegment();
+    ~Wax9SharedSegment();
+
+    bool                open(const std::string &deviceName, bool create, uint32_t capacity);
+    void                close();
+    bool                isOpen() const                  { return mData != NULL; }
+
+    Wax9SharedHeader*   getHeader() const               { return (Wax9SharedHeader *)mData; }
+    Wax9SharedSlot*     getSlots() const                { return (Wax9SharedSlot *)(mData + sizeof(Wax9SharedHeader)); }
+
+    static std::string  getSegmentName(const std::string &deviceName);
+    static size_t       getSegmentSize(uint32_t capacity)   { return sizeof(Wax9SharedHeader) + (size_t)capacity * sizeof(Wax9SharedSlot); }
+    static bool         remove(const std::string &deviceName);
+
+protected:
+
+#ifndef _WIN32
+    static void         retire(const std::string &name);
+#endif
+
+    char*               mData;
+    size_t              mSize;
+    intptr_t            mHandle;
+};
+
+typedef std::shared_ptr<class Wax9SharedReader> Wax9SharedReaderRef;
+
+class Wax9SharedReader {
+public:
+
+    // returns an empty ref if no writer has published this device yet
+    static Wax9SharedReaderRef attach(const std::string &deviceName);
+
+    // copies up to maxSamples new samples in stream order and advances the cursor
+    size_t      read(Wax9SharedSample *samples, size_t maxSamples);
+
+    // newest complete sample, without moving the cursor
+    bool        readLatest(Wax9SharedSample &sample) const;
+
+    void        seekToLatest();
+    uint64_t    getCursor() const                   { return mCursor; }
+    uint64_t    getNumAvailable() const;
+    uint64_t    getNumDropped() const               { return mNumDropped; }
+    uint32_t    getCapacity() const                 { return mCapacity; }
+    bool        isStale() const;                    // the writer restarted with another capacity, attach again
+    std::string getDeviceName() const;
+
+protected:
+
+    Wax9SharedReader();
+
+    bool        readSlot(uint64_t index, Wax9SharedSample &sample) const;
+
+    Wax9SharedSegment   mSegment;
+    uint32_t            mCapacity;
+    uint64_t            mCursor;
+    uint64_t            mNumDropped;
+};
@@ -0,0 +1,60 @@
+/*
+ Wax9SharedPublisher
+ Writes the samples of one Wax9 device into a named shared-memory ring, so other
+ processes on the same host can read them with Wax9SharedReader.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+#include "Wax9SharedMemory.h"
+
+typedef std::shared_ptr<class Wax9SharedPublisher> Wax9SharedPublisherRef;
+
+class Wax9SharedPublisher {
+public:
+
+    // capacity is rounded up to a power of two. Returns an empty ref if the segment can't be created
+    static Wax9SharedPublisherRef create(const std::string &deviceName, uint32_t capacity = 4096);
+
+    // write the readings received in the last Wax9::update() call
+    void        publish(Wax9 &device);
+    void        publish(const Wax9Sample &sample);
+
+    uint64_t    getNumPublished() const             { return mSegment.getHeader()->writeIndex.load(std::memory_order_relaxed); }
+    uint32_t    getCapacity() const                 { return mSegment.getHeader()->capacity; }
+
+protected:
+
+    Wax9SharedPublisher() {}
+
+    Wax9SharedSegment   mSegment;
+};
@@ -0,0 +1,119 @@
+/*
+ Wax9Smoothing
+ Low-latency smoothing for the channels of a Wax9 sample.
+
+ A plain exponential moving average heavy enough to hide jitter when the sensor is
+ still lags badly when it moves. The one-euro filter (Casiez et al. 2012) adapts its
+ cutoff to the speed of the signal instead: low when still, higher when moving. Vectors
+ use it directly; orientations use the same idea as a normalised quaternion lerp whose
+ weight follows the angular speed. The fixed-lag mode trades a constant delay of a few
+ samples for a centered, triangle-weighted average that doesn't lag behind motion.
+ Wax9Fusion holds whole samples back by that delay, so the averages are stored with the
+ times of the samples they are centered on.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Quaternion.h"
+
+enum Wax9SmoothMode
+{
+    WAX9_SMOOTH_OFF = 0,
+    WAX9_SMOOTH_ONE_EURO,       // speed-adaptive low-pass, no fixed delay
+    WAX9_SMOOTH_FIXED_LAG       // centered average, output delayed by lag samples
+};
+
+// Channels of a sample that can be smoothed separately
+enum Wax9SmoothChannel
+{
+    WAX9_SMOOTH_ACC = 0,
+    WAX9_SMOOTH_GYR,
+    WAX9_SMOOTH_MAG,
+    WAX9_SMOOTH_ORIENTATION,
+    WAX9_SMOOTH_NUM_CHANNELS
+};
+
+typedef struct
+{
+    Wax9SmoothMode  mode;
+    float           minCutoff;  // Hz, cutoff when the signal is still
+    float           beta;       // cutoff added per unit of speed (per g/s, rad/s^2, uT/s or rad/s)
+    float           dCutoff;    // Hz, cutoff of the speed estimate
+    int             lag;        // samples, fixed-lag mode only
+} Wax9SmoothSettings;
+
+#define WAX9_SMOOTH_MAX_LAG 8
+
+class Wax9VectorSmoother {
+public:
+
+    Wax9VectorSmoother();
+
+    void        setup(const Wax9SmoothSettings &settings);
+    void        reset()                             { bPrimed = false; mHead = 0; }
+    const Wax9SmoothSettings&   getSettings() const { return mSettings; }
+
+    // dt is the time since the previous value in seconds
+    ci::vec3    filter(const ci::vec3 &value, float dt);
+
+protected:
+
+    Wax9SmoothSettings  mSettings;
+    bool                bPrimed;
+    int                 mHead;      // fixed lag, where the next value goes
+    ci::vec3            mValue;
+    ci::vec3            mPrevious;
+    ci::vec3            mSpeed;
+    ci::vec3            mHistory[2 * WAX9_SMOOTH_MAX_LAG + 1];
+};
+
+class Wax9OrientationSmoother {
+public:
+
+    Wax9OrientationSmoother();
+
+    void        setup(const Wax9SmoothSettings &settings);
+    void        reset()                             { bPrimed = false; mHead = 0; }
+    const Wax9SmoothSettings&   getSettings() const { return mSettings; }
+
+    ci::quat    filter(const ci::quat &value, float dt);
+
+protected:
+
+    Wax9SmoothSettings  mSettings;
+    bool                bPrimed;
+    int                 mHead;      // fixed lag, where the next value goes
+    ci::quat            mValue;
+    ci::quat            mPrevious;
+    float               mSpeed;     // rad/s
+    ci::quat            mHistory[2 * WAX9_SMOOTH_MAX_LAG + 1];
+};
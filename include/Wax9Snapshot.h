@@ -0,0 +1,117 @@
+/*
+ Wax9Snapshot
+ Latest value of a plain struct, written by one thread and read by any number of others
+ without locks.
+
+ The writer cycles through a few slots, each protected by a sequence number that is odd
+ while the slot is being written. Readers copy the newest slot and check that its sequence
+ number didn't change while copying, which can only happen if the writer went all the way
+ around the slots in the meantime. Readers never block the writer or each other. Same
+ scheme as the slots in Wax9SharedMemory, but within a process.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+template<typename T, int NumSlots = 4>
+class Wax9Snapshot {
+public:
+
+    Wax9Snapshot() : mVersion(0)
+    {
+        // alignas wouldn't survive a heap allocated owner before C++17, so the slots are aligned by hand
+        mSlots = (Slot *)(((uintptr_t)mStorage + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+        for (int i = 0; i < NumSlots; i++) {
+            new (&mSlots[i]) Slot;
+            mSlots[i].seq.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // the slots point into the object itself
+    Wax9Snapshot(const Wax9Snapshot &) = delete;
+    Wax9Snapshot& operator=(const Wax9Snapshot &) = delete;
+
+    // writer thread only
+    void publish(const T &value)
+    {
+        uint64_t version = mVersion.load(std::memory_order_relaxed) + 1;
+        Slot &slot = mSlots[version % NumSlots];
+
+        slot.seq.store(2 * version - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&slot.value, &value, sizeof(T));
+        slot.seq.store(2 * version, std::memory_order_release);
+        mVersion.store(version, std::memory_order_release);
+    }
+
+    // any thread. Returns false if nothing was published yet
+    bool read(T &value, uint64_t *version = NULL) const
+    {
+        for (;;) {
+            uint64_t v = mVersion.load(std::memory_order_acquire);
+            if (v == 0) return false;
+
+            const Slot &slot = mSlots[v % NumSlots];
+            uint64_t before = slot.seq.load(std::memory_order_acquire);
+            if (before != 2 * v) continue;      // already being rewritten, a newer version is out
+
+            memcpy(&value, &slot.value, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == before) {
+                if (version) *version = v;
+                return true;
+            }
+        }
+    }
+
+    // number of values published so far, cheap way for readers to poll for changes
+    uint64_t getVersion() const     { return mVersion.load(std::memory_order_acquire); }
+
+protected:
+
+    enum { CACHE_LINE = 64 };
+
+    // whole cache lines each, so readers of one slot don't slow down writes to the next
+    struct Slot
+    {
+        std::atomic<uint64_t>   seq;
+        T                       value;
+        char                    padding[CACHE_LINE - (sizeof(std::atomic<uint64_t>) + sizeof(T)) % CACHE_LINE];
+    };
+
+    char                    mStorage[NumSlots * sizeof(Slot) + CACHE_LINE - 1];
+    Slot                    *mSlots;        // first cache line boundary in mStorage
+    std::atomic<uint64_t>   mVersion;
+};
@@ -0,0 +1,130 @@
+/*
+ Wax9Synchronizer
+ Frames with the state of several devices at the same host time.
+
+ Every device maps its own clock to the host with its Wax9ClockMap, so their histories
+ share a timeline. Frames are due at fixed ticks of that timeline. A frame is emitted as
+ soon as every device has a reading at or after its tick, which is the earliest moment
+ it can be interpolated instead of guessed: the frames advance to the oldest of the
+ devices' newest readings, a k-way merge on their heads. A device that falls behind only
+ holds the others back for maxLatency. After that the frame goes out with the late device
+ held at its newest reading and marked as such.
+
+ The devices are read from their histories on the thread that calls update(), which has
+ to be the one updating them. Keep the history longer than maxLatency.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+
+#include <vector>
+#include <functional>
+
+enum Wax9SyncStatus {
+    WAX9_SYNC_INTERPOLATED = 0,     // between two readings
+    WAX9_SYNC_LATE,                 // after the newest reading, held at it
+    WAX9_SYNC_MISSING               // no readings or disconnected
+};
+
+// One frame, with a sample per device in the order they were added
+typedef struct
+{
+    uint64_t                index;      // frame number since the first one
+    double                  time;       // host time the samples are interpolated to
+    double                  latency;    // host time it was emitted at minus time, seconds
+    size_t                  numLate;    // devices that weren't interpolated
+    std::vector<Wax9Sample> samples;
+    std::vector<uint8_t>    status;     // Wax9SyncStatus per device
+} Wax9SyncFrame;
+
+typedef struct
+{
+    double      offset;         // host minus device time, seconds
+    double      drift;          // ppm, host seconds gained per million device seconds
+    double      relativeDrift;  // ppm against the first device
+    double      excessDelay;    // link jitter above the minimum delay, seconds
+    double      lag;            // how far the newest reading is behind the newest frame, seconds
+    uint64_t    numLate;        // frames it was late for
+    uint64_t    numMissing;
+} Wax9SyncDeviceStats;
+
+typedef std::shared_ptr<class Wax9Synchronizer> Wax9SynchronizerRef;
+
+class Wax9Synchronizer {
+public:
+
+    typedef std::function<void(const Wax9SyncFrame &frame)> FrameFn;
+
+    static Wax9SynchronizerRef create(float frameRate = 60.0f, double maxLatency = 0.05)  { return Wax9SynchronizerRef(new Wax9Synchronizer(frameRate, maxLatency)); }
+
+    size_t      addDevice(Wax9 &device);        // returns its index in the frames, the device must outlive the synchronizer
+    void        setFrameCallback(const FrameFn &fn)     { mCallback = fn; }
+    void        setMaxLatency(double seconds)   { mMaxLatency = seconds; }
+    void        reset();                        // starts again from the next complete frame
+
+    // emits the frames that are due, call it after updating the devices. Returns how many
+    size_t      update(double hostTime = Wax9::getHostTime());
+
+    const Wax9SyncFrame&        getFrame() const                    { return mFrame; }     // the last one emitted
+    const Wax9SyncDeviceStats&  getDeviceStats(size_t device) const { return mStats.at(device); }
+    size_t      getNumDevices() const           { return mDevices.size(); }
+    uint64_t    getNumFrames() const            { return mNumFrames; }
+    uint64_t    getNumSkipped() const           { return mNumSkipped; }    // ticks older than the histories, never emitted
+    double      getMeanLatency() const          { return mNumFrames > 0 ? mLatencySum / mNumFrames : 0.0; }
+    double      getMaxLatency() const           { return mLatencyMax; }
+
+protected:
+
+    Wax9Synchronizer(float frameRate, double maxLatency);
+
+    void        updateStats(double frameTime);
+
+    double                  mPeriod;
+    double                  mMaxLatency;
+    std::vector<Wax9*>      mDevices;
+    std::vector<Wax9SyncDeviceStats> mStats;
+    FrameFn                 mCallback;
+    Wax9SyncFrame           mFrame;
+
+    bool                    bStarted;
+    uint64_t                mNextTick;      // frames are at mNextTick * mPeriod
+    uint64_t                mNumFrames;
+    uint64_t                mNumSkipped;
+    double                  mLatencySum;
+    double                  mLatencyMax;
+
+    // scratch, reused every update
+    std::vector<double>     mTicks;
+    std::vector<Wax9Sample> mSamples;       // device major
+    std::vector<double>     mNewest;
+    std::vector<double>     mOldest;
+};
@@ -0,0 +1,126 @@
+/*
+ Wax9Telemetry
+ Low-rate device metadata (battery, temperature and pressure) reported by the Wax9.
+
+ The sensor only sends these values every once in a while inside extended packets, so
+ they are kept out of the per-sample path and tracked here with their own timestamps,
+ smoothing and change notifications.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "cinder/Signals.h"
+
+#include <stdint.h>
+#include <limits>
+
+// Telemetry channels
+enum Wax9TelemetryChannel
+{
+    WAX9_TELEMETRY_BATTERY = 0,
+    WAX9_TELEMETRY_TEMPERATURE,
+    WAX9_TELEMETRY_PRESSURE,
+    WAX9_TELEMETRY_NUM_CHANNELS
+};
+
+// State of a single telemetry channel
+typedef struct
+{
+    bool                valid;          // false until the first reading arrives
+    float               value;          // last raw value (mV, celsius or pascals)
+    float               smoothed;       // exponentially smoothed value
+    uint32_t            timestamp;      // device timestamp of the last reading (16.16 seconds)
+    unsigned long long  ticks;          // host time of the last reading (ms since epoch)
+    unsigned long long  changedTicks;   // host time of the last change in value
+    unsigned int        numReadings;
+} Wax9TelemetryValue;
+
+// Passed to listeners whenever a channel changes value
+typedef struct
+{
+    Wax9TelemetryChannel    channel;
+    float                   value;
+    float                   previous;
+    Wax9TelemetryValue      state;
+} Wax9TelemetryEvent;
+
+class Wax9Telemetry {
+public:
+
+    Wax9Telemetry();
+
+    void        reset();
+    void        setDebug(bool b)                    { bDebug = b; }
+
+    // Called from the packet parser for extended packets only. Sentinel values
+    // (0xffff battery, -1 temperature, 0xffffffff pressure) mean "not in this packet"
+    void        update(unsigned short battery, short temperature, uint32_t pressure, uint32_t timestamp, unsigned long long ticks);
+
+    // raw values, or 0xffff, NaN and 0xffffffff until the first reading
+    bool            hasBattery() const              { return mValues[WAX9_TELEMETRY_BATTERY].valid; }
+    bool            hasTemperature() const          { return mValues[WAX9_TELEMETRY_TEMPERATURE].valid; }
+    bool            hasPressure() const             { return mValues[WAX9_TELEMETRY_PRESSURE].valid; }
+    unsigned short  getBattery() const              { return hasBattery() ? (unsigned short)mValues[WAX9_TELEMETRY_BATTERY].value : 0xffff; }
+    float           getTemperature() const          { return hasTemperature() ? mValues[WAX9_TELEMETRY_TEMPERATURE].value : std::numeric_limits<float>::quiet_NaN(); }
+    uint32_t        getPressure() const             { return hasPressure() ? (uint32_t)mValues[WAX9_TELEMETRY_PRESSURE].value : 0xffffffff; }
+
+    // smoothed values and battery estimates
+    float           getBatterySmoothed() const      { return mValues[WAX9_TELEMETRY_BATTERY].smoothed; }
+    float           getTemperatureSmoothed() const  { return mValues[WAX9_TELEMETRY_TEMPERATURE].smoothed; }
+    float           getPressureSmoothed() const     { return mValues[WAX9_TELEMETRY_PRESSURE].smoothed; }
+    float           getBatteryDischargeRate() const { return mDischargeRate; }      // mV per hour, positive when discharging
+    float           getBatteryTimeRemaining() const;                                // seconds until cutoff, infinity if unknown
+    bool            isBatteryLow() const            { return hasBattery() && mValues[WAX9_TELEMETRY_BATTERY].value < mBatteryLowLevel; }
+
+    const Wax9TelemetryValue&   getValue(Wax9TelemetryChannel channel) const  { return mValues[channel]; }
+
+    // smoothing time constants in seconds
+    void        setTimeConstant(Wax9TelemetryChannel channel, float seconds)    { mTimeConstants[channel] = seconds; }
+
+    // listeners get notified only when a value changes, not on every reading
+    ci::signals::Signal<void(const Wax9TelemetryEvent&)>&  getSignalChanged()  { return mSignalChanged; }
+
+protected:
+
+    void        updateChannel(Wax9TelemetryChannel channel, float value, uint32_t timestamp, unsigned long long ticks);
+    void        updateDischargeRate(unsigned long long ticks);
+
+    bool                bDebug;
+    float               mBatteryLowLevel;   // in mV - according to dev guide, battery dies under 3300 mV
+    float               mBatteryCutoff;
+    float               mDischargeRate;
+    float               mDischargeRefValue;
+    unsigned long long  mDischargeRefTicks;
+    float               mTimeConstants[WAX9_TELEMETRY_NUM_CHANNELS];
+    Wax9TelemetryValue  mValues[WAX9_TELEMETRY_NUM_CHANNELS];
+
+    ci::signals::Signal<void(const Wax9TelemetryEvent&)>  mSignalChanged;
+};
@@ -0,0 +1,165 @@
+/*
+ Wax9Trace
+ Opt-in timing of the update path, to see where a sample's latency goes.
+
+ A device with a trace (see Wax9::setTrace()) records a span for each stage of every
+ update: reading, decoding, parsing, fusion, storing and delivery. Spans are per batch, so
+ the cost is a few clock reads per update and not per sample. Reading, decoding and parsing
+ take turns for every frame, so their spans are the batch's totals laid end to end. Every span's duration also goes
+ into a histogram, and so does the latency of every sample:
+
+    process     from reading its frame to getReading() and getSnapshot() returning it
+    end to end  from the device sampling it to the same point. The device time is mapped
+                with the clock map, so this includes the time bytes waited in the port
+                but not the fixed link delay, which is added from setPrediction()
+
+ Histograms are log-linear like HdrHistogram: 32 buckets per power of two keep every
+ value within 3% with a fixed 4.5 KB per histogram. Percentiles are read from them.
+
+ Spans are kept in a ring and can be saved as Chrome trace JSON, which chrome://tracing
+ and ui.perfetto.dev open. One trace can be shared by several devices, each one gets its
+ own track.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define WAX9_HISTOGRAM_SUB_BITS     5       // 32 buckets per power of two
+#define WAX9_HISTOGRAM_MAX_BITS     40      // ns, longer values go in the last bucket (about 18 minutes)
+#define WAX9_HISTOGRAM_SIZE         ((WAX9_HISTOGRAM_MAX_BITS - WAX9_HISTOGRAM_SUB_BITS + 1) << WAX9_HISTOGRAM_SUB_BITS)
+
+enum Wax9TraceSpan {
+    WAX9_SPAN_UPDATE = 0,       // a whole Wax9::update()
+    WAX9_SPAN_READ,             // the transport's reads from the port
+    WAX9_SPAN_DECODE,           // line and SLIP decoding
+    WAX9_SPAN_PARSE,            // parsing, validation and the recorder
+    WAX9_SPAN_FUSE,             // calibration, AHRS, smoothing, framing and user stages
+    WAX9_SPAN_STORE,            // into the history
+    WAX9_SPAN_DELIVER,          // sinks and the snapshot for other threads
+    WAX9_NUM_SPANS
+};
+
+enum Wax9TraceLatency {
+    WAX9_LATENCY_PROCESS = 0,   // per sample, frame read to delivered
+    WAX9_LATENCY_END_TO_END,    // per sample, sampled on the device to delivered
+    WAX9_NUM_LATENCIES
+};
+
+// Counts of nanosecond values in log-linear buckets
+class Wax9LatencyHistogram {
+public:
+
+    Wax9LatencyHistogram()                      { reset(); }
+
+    void        reset();
+    void        record(uint64_t ns);
+    void        merge(const Wax9LatencyHistogram &other);
+
+    uint64_t    getCount() const                { return mCount; }
+    uint64_t    getMin() const                  { return mCount ? mMin : 0; }
+    uint64_t    getMax() const                  { return mMax; }
+    double      getMean() const                 { return mCount ? mSum / mCount : 0.0; }
+    uint64_t    getPercentile(double percent) const;   // ns, the highest value of the bucket it falls in
+
+protected:
+
+    static size_t   indexOf(uint64_t ns);
+    static uint64_t highestValue(size_t index);
+
+    uint32_t    mCounts[WAX9_HISTOGRAM_SIZE];
+    uint64_t    mCount;
+    uint64_t    mMin;
+    uint64_t    mMax;
+    double      mSum;
+};
+
+typedef std::shared_ptr<class Wax9Trace> Wax9TraceRef;
+
+class Wax9Trace {
+public:
+
+    static Wax9TraceRef create(size_t capacity = 65536)    { return Wax9TraceRef(new Wax9Trace(capacity)); }
+
+    static uint64_t now();      // ns, steady clock
+
+    int         addTrack(const std::string &name);     // one per device, returns its id
+
+    // called by the devices, from any thread
+    void        span(int track, Wax9TraceSpan span, uint64_t start, uint64_t end, uint32_t count);
+    void        latency(int track, Wax9TraceLatency latency, const double *seconds, size_t count);
+
+    Wax9LatencyHistogram    getHistogram(int track, Wax9TraceSpan span) const;
+    Wax9LatencyHistogram    getHistogram(int track, Wax9TraceLatency latency) const;
+    size_t      getNumTracks() const;
+    uint64_t    getNumSpans() const;            // recorded, the ring keeps the newest ones
+    void        clear();                        // spans and histograms, tracks are kept
+
+    // percentiles of every histogram, in microseconds
+    void        printReport(std::ostream &os) const;
+
+    // Chrome trace JSON of the spans in the ring, with the newest end to end latency as a counter
+    void        writeChromeTrace(std::ostream &os) const;
+    bool        writeChromeTrace(const std::string &path) const;
+
+protected:
+
+    Wax9Trace(size_t capacity);
+
+    typedef struct
+    {
+        uint64_t    start;      // ns since the trace was created
+        uint64_t    duration;
+        uint32_t    count;      // samples in the batch
+        uint16_t    track;
+        uint8_t     span;
+        uint64_t    latency;    // newest end to end latency when the span ended, ns
+    } Event;
+
+    typedef struct
+    {
+        std::string             name;
+        Wax9LatencyHistogram    spans[WAX9_NUM_SPANS];
+        Wax9LatencyHistogram    latencies[WAX9_NUM_LATENCIES];
+        uint64_t                lastLatency;
+    } Track;
+
+    mutable std::mutex  mMutex;
+    uint64_t            mStart;
+    std::vector<Event>  mEvents;    // ring
+    uint64_t            mNumEvents;
+    std::vector<std::unique_ptr<Track> > mTracks;
+};
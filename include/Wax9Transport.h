@@ -0,0 +1,213 @@
+/*
+ Wax9Transport
+ Byte streams a Wax9 reads its packets from.
+
+ Wax9 only talks to its transport, so the acquisition core doesn't depend on how the
+ device is connected. Backends read in large chunks into a small buffer and the parser
+ takes bytes from there, instead of asking the port for one byte at a time.
+
+    Wax9SerialTransport     cinder::Serial, the default in Cinder apps
+    Wax9PosixTransport      termios on a tty or rfcomm device (/dev/tty.WAX9-*, /dev/rfcomm0),
+                            with low-latency settings. Not available on Windows
+    Wax9MemoryTransport     bytes pushed by the caller, for tests and replaying captures
+
+ Define WAX9_HEADLESS to build Wax9 without cinder::app and cinder::Serial, for daemons
+ and tools that don't run a Cinder app. setup() then opens the port with the termios
+ backend, or takes any transport directly.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#ifndef WAX9_HEADLESS
+    #include "cinder/Serial.h"
+#endif
+
+#define WAX9_TRANSPORT_BUFFER_SIZE  1024    // largest single read from the backend
+#define WAX9_TRANSPORT_TIMEOUT      0.5     // seconds to wait for the rest of a packet
+
+typedef std::shared_ptr<class Wax9Transport> Wax9TransportRef;
+
+class Wax9Transport {
+public:
+
+    Wax9Transport() : mReadPos(0), mReadEnd(0), mReadTime(0) {}
+    virtual ~Wax9Transport() {}
+
+    virtual std::string getName() const = 0;
+    virtual bool        isOpen() const = 0;
+    virtual void        close() = 0;
+    virtual size_t      write(const void *data, size_t size) = 0;
+
+    // bytes that can be read without waiting, including the buffered ones
+    size_t      getNumBytesAvailable()          { return (mReadEnd - mReadPos) + available(); }
+
+    // waits up to timeout seconds for the next byte, returns false if none came
+    bool        readByte(uint8_t &c, double timeout = WAX9_TRANSPORT_TIMEOUT)
+    {
+        if (mReadPos == mReadEnd && !fill(timeout)) return false;
+        c = mReadBuffer[mReadPos++];
+        return true;
+    }
+
+    size_t      read(void *data, size_t size, double timeout = WAX9_TRANSPORT_TIMEOUT);
+    std::string readLine(double timeout);       // up to the next '\n', without it
+    bool        writeString(const std::string &str)     { return write(str.data(), str.size()) == str.size(); }
+    void        discardInput();                 // drops everything received so far
+
+    uint64_t    getReadTime() const             { return mReadTime; }   // ns spent in the backend's reads so far
+
+protected:
+
+    // implemented by the backends
+    virtual size_t  available() = 0;
+    // reads at most size bytes, waiting up to timeout seconds for the first one. Returns 0 on timeout or error
+    virtual size_t  readSome(void *data, size_t size, double timeout) = 0;
+
+    bool        fill(double timeout);
+
+    uint8_t     mReadBuffer[WAX9_TRANSPORT_BUFFER_SIZE];
+    size_t      mReadPos;
+    size_t      mReadEnd;
+    uint64_t    mReadTime;
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark backends
+/* -------------------------------------------------------------------------------------------------- */
+
+#ifndef WAX9_HEADLESS
+
+typedef std::shared_ptr<class Wax9SerialTransport> Wax9SerialTransportRef;
+
+class Wax9SerialTransport : public Wax9Transport {
+public:
+
+    // portName is matched like cinder::Serial::findDeviceByNameContains(). Returns null if it can't connect
+    static Wax9SerialTransportRef create(const std::string &portName, int baudRate = 115200);
+    static Wax9SerialTransportRef create(ci::SerialRef serial);
+
+    std::string     getName() const;
+    bool            isOpen() const                  { return (bool)mSerial; }
+    void            close()                         { mSerial.reset(); }
+    size_t          write(const void *data, size_t size);
+
+    ci::SerialRef   getSerial()                     { return mSerial; }
+
+protected:
+
+    Wax9SerialTransport(ci::SerialRef serial) : mSerial(serial) {}
+
+    size_t          available();
+    size_t          readSome(void *data, size_t size, double timeout);
+
+    ci::SerialRef   mSerial;
+};
+
+#endif
+
+#ifndef _WIN32
+
+typedef std::shared_ptr<class Wax9PosixTransport> Wax9PosixTransportRef;
+
+class Wax9PosixTransport : public Wax9Transport {
+public:
+
+    // path is a device like /dev/rfcomm0, or part of a name in /dev. Returns null if it can't be opened
+    static Wax9PosixTransportRef create(const std::string &path, int baudRate = 115200);
+    ~Wax9PosixTransport();
+
+    std::string     getName() const                 { return mPath; }
+    bool            isOpen() const                  { return mFd >= 0; }
+    void            close();
+    size_t          write(const void *data, size_t size);
+
+    int             getFileDescriptor() const       { return mFd; }
+    bool            isLowLatency() const            { return bLowLatency; }  // the driver accepted the low-latency request
+
+    static std::vector<std::string> getDevices();   // serial and rfcomm ports in /dev
+    static std::string  findDevice(const std::string &nameContains);
+
+protected:
+
+    Wax9PosixTransport();
+
+    bool            open(const std::string &path, int baudRate);
+    size_t          available();
+    size_t          readSome(void *data, size_t size, double timeout);
+
+    int             mFd;
+    std::string     mPath;
+    bool            bLowLatency;
+};
+
+#endif
+
+// In-memory stream: push() what the device would send, written bytes are kept for inspection
+typedef std::shared_ptr<class Wax9MemoryTransport> Wax9MemoryTransportRef;
+
+class Wax9MemoryTransport : public Wax9Transport {
+public:
+
+    static Wax9MemoryTransportRef create(const std::string &name = "memory")   { return Wax9MemoryTransportRef(new Wax9MemoryTransport(name)); }
+
+    std::string     getName() const                 { return mName; }
+    bool            isOpen() const;
+    void            close();
+    size_t          write(const void *data, size_t size);
+
+    void            push(const void *data, size_t size);    // can be called from any thread
+    void            push(const std::string &str)            { push(str.data(), str.size()); }
+    void            pushSlip(const void *packet, size_t size);  // SLIP-encodes a packet like the device does
+    std::string     getWritten();
+    void            clearWritten();
+
+protected:
+
+    Wax9MemoryTransport(const std::string &name) : mName(name), bOpen(true) {}
+
+    size_t          available();
+    size_t          readSome(void *data, size_t size, double timeout);
+
+    std::string                 mName;
+    bool                        bOpen;
+    std::deque<uint8_t>         mInput;
+    std::string                 mWritten;
+    mutable std::mutex          mMutex;
+    std::condition_variable     mCondition;
+};
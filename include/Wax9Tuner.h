@@ -0,0 +1,137 @@
+/*
+ Wax9Tuner
+ Finds AHRS gains for a recorded session by replaying it through many filter
+ configurations and scoring each one.
+
+ Without ground truth, the reference is gravity during still periods: while the sensor
+ rests, the averaged accelerometer is the true down direction, and the filter's estimate
+ of it shows both drift carried over from the motion before (gains too low) and
+ accelerometer noise let through (gains too high). With ground truth orientations, every
+ sample is scored against them instead.
+
+ Errors are also split by motion profile (slow or fast movement, judged from the gyro), so
+ sessions that mix both can pick gains for the kind of motion that matters.
+ Every configuration runs through its own Wax9Fusion, like a live Wax9 with those gains:
+ the same AHRS, dt from the device timestamps and the magnetometer fused only when it has
+ a new reading. Configurations run in groups on a Wax9WorkPool: each group walks the
+ samples once and updates all of its filters per sample, so the input is read once per group.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include "Wax9.h"
+#include "Wax9WorkPool.h"
+
+#include <vector>
+
+class Wax9Tuner {
+public:
+
+    enum Profile { PROFILE_ALL, PROFILE_SLOW, PROFILE_FAST, NUM_PROFILES };
+
+    typedef struct
+    {
+        char        mode;           // 0 Madgwick, 1 Mahony
+        float       twoKp;          // beta in Madgwick
+        float       twoKi;          // Mahony only
+    } Config;
+
+    typedef struct
+    {
+        Config      config;
+        double      error[NUM_PROFILES];        // RMS angle in degrees
+        uint64_t    numScored[NUM_PROFILES];
+    } Result;
+
+    explicit Wax9Tuner(int numThreads = 0);
+
+    // input, either a recording or samples captured some other way (oldest first)
+    bool        loadRecording(const std::string &path, size_t maxSamples = 0);
+    void        setSamples(const std::vector<Wax9Sample> &samples, float sampleFreq);   // sampleFreq is the nominal rate, dt follows the timestamps
+    void        setGroundTruth(const std::vector<quat> &orientations)     { mGroundTruth = orientations; }
+
+    // magnetometer use and rate and gyro calibration, Wax9::getFusionSettings() to tune for a
+    // live device. The algorithm and gains come from each configuration
+    void        setFusionSettings(const Wax9FusionSettings &settings)   { mFusionSettings = settings; }
+    void        setGyroDelta(const vec3 &delta)                         { mFusionSettings.gyroDelta = delta; }
+
+    // still detection and motion profile thresholds
+    void        setStillThresholds(float gyro, float acc, float minSeconds)    { mStillGyro = gyro; mStillAcc = acc; mStillSeconds = minSeconds; }
+    void        setFastThreshold(float gyro)                            { mFastGyro = gyro; }
+
+    // configurations to try. Sweeps are log-spaced
+    void        addConfig(const Config &config)                         { mConfigs.push_back(config); }
+    void        addMadgwickSweep(float betaMin, float betaMax, int steps);
+    void        addMahonySweep(float kpMin, float kpMax, int kpSteps, float kiMin, float kiMax, int kiSteps);
+    void        clearConfigs()                                          { mConfigs.clear(); }
+
+    // runs every configuration, returns false if there is nothing to score against
+    bool        run();
+
+    const std::vector<Result>&  getResults() const                      { return mResults; }
+    const Result*               getBest(Profile profile = PROFILE_ALL) const;
+    size_t      getNumSamples() const                                   { return mNumSamples; }
+    double      getSeconds() const                                      { return mSeconds; }
+    void        printReport() const;
+
+    static const char*  getProfileName(Profile profile);
+
+protected:
+
+    enum { GROUP_SIZE = 8 };
+
+    void        prepareScoring();
+    void        runGroup(size_t first, size_t count);
+
+    // input, flattened xyz
+    std::vector<float>      mGyr;
+    std::vector<float>      mAcc;
+    std::vector<float>      mMag;
+    std::vector<uint32_t>   mTimestamps;    // device clock, for each sample's dt
+    std::vector<quat>       mGroundTruth;
+    size_t                  mNumSamples;
+    float                   mSampleFreq;
+    Wax9FusionSettings      mFusionSettings;
+
+    float                   mStillGyro;
+    float                   mStillAcc;
+    float                   mStillSeconds;
+    float                   mFastGyro;
+
+    // per sample: profiles it counts towards (bit mask, 0 = not scored) and its reference
+    std::vector<uint8_t>    mScoreMask;
+    std::vector<vec3>       mReference;
+
+    std::vector<Config>     mConfigs;
+    std::vector<Result>     mResults;
+    double                  mSeconds;
+    Wax9WorkPool            mPool;
+};
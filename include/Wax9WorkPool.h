@@ -0,0 +1,100 @@
+/*
+ Wax9WorkPool
+ Work-stealing thread pool for offline jobs (reprocessing, parameter tuning).
+
+ Every worker has its own task deque. Workers take from the back of their own deque and,
+ when it runs dry, steal from the front of the others, so a few long tasks don't leave
+ the remaining cores idle. Tasks receive the index of the worker running them, which
+ lets them keep per-worker scratch state and statistics without locking.
+ */
+
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+class Wax9WorkPool {
+public:
+
+    typedef std::function<void(int worker)> Task;
+
+    typedef struct
+    {
+        uint64_t    numTasks;
+        uint64_t    numStolen;      // tasks taken from another worker's deque
+        double      busySeconds;
+    } WorkerStats;
+
+    // numThreads 0 uses one thread per core
+    explicit Wax9WorkPool(int numThreads = 0);
+    ~Wax9WorkPool();
+
+    // tasks submitted together are spread round-robin over the workers
+    void        submit(const Task &task);
+
+    // blocks until every submitted task has finished
+    void        wait();
+
+    int         getNumThreads() const               { return (int)mWorkers.size(); }
+    WorkerStats getStats(int worker) const;
+    void        resetStats();
+
+protected:
+
+    struct Worker
+    {
+        std::mutex          mutex;
+        std::deque<Task>    tasks;
+        std::thread         thread;
+        std::atomic<uint64_t>   numTasks;
+        std::atomic<uint64_t>   numStolen;
+        std::atomic<double>     busySeconds;
+    };
+
+    void        threadedWork(int worker);
+    bool        takeTask(int worker, Task &task);
+
+    std::vector<std::unique_ptr<Worker> >   mWorkers;
+    std::atomic<size_t>         mNextWorker;
+    std::atomic<int>            mNumQueued;     // tasks sitting in a deque
+    std::atomic<int>            mNumPending;    // tasks submitted and not finished yet
+
+    std::mutex                  mMutex;
+    std::condition_variable     mWorkAvailable;
+    std::condition_variable     mAllDone;
+    bool                        bRunning;
+};
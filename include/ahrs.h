@@ -7,6 +7,8 @@
 #ifndef AHRS_H
 #define AHRS_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -16,7 +18,7 @@ extern "C" {
 typedef struct ahrs_struct_t
 {
     // Public (read-only)
-    char mode;              // Mode 0 is Madgwick, mode 1 is Mahony
+    char mode;              // Mode 0 is Madgwick, mode 1 is Mahony, 2 and 3 are their fixed-point versions
     float sampleFreq;       // Sample frequency in Hz
     float q[4];             // Quaternion of sensor frame relative to auxiliary frame
     
@@ -24,6 +26,14 @@ typedef struct ahrs_struct_t
     float twoKp;            // 2 * proportional gain ("beta" in Madgwick, "Kp" in Mahony)
     float twoKi;            // [Mahony] 2 * integral gain (not used in Madgwick, "Ki" in Mahony)
     float integralFB[3];    // [Mahony] Integral error terms scaled by Ki (not used in Madgwick)
+
+    // Private, fixed-point modes (Q2.30)
+    int32_t qFixed[4];
+    int64_t integralFixed[3];   // integralFB * dt/2, Q46
+    int32_t halfDtFixed;
+    int32_t kpFixed;
+    int64_t kiFixed;            // Q46
+    float fixedFreq, fixedKp, fixedKi;  // settings the fixed-point constants were computed for
 } ahrs_t;
 
 
@@ -39,6 +49,9 @@ float *AhrsGetQuaternion(ahrs_t *ahrs);
 // Update the AHRS tracker with accelerometer, gyroscope and (optional) magnetometer data
 void AhrsUpdate(ahrs_t *ahrs, float *gyro, float *accel, float *mag);
 
+// Fixed-point modes only: update with Q16.16 gyroscope (rad/s) and accelerometer data
+void AhrsUpdateFixed(ahrs_t *ahrs, const int32_t *gyro, const int32_t *accel);
+
 
 #ifdef __cplusplus
 }
@@ -27,6 +27,12 @@
  */
 
 #include "Wax9.h"
+#include "Wax9Recording.h"
+#include "Wax9Log.h"
+#include "Wax9Orientation.h"
+
+#include <algorithm>
+#include <cctype>
 
 /* -------------------------------------------------------------------------------------------------- */
 #pragma mark constructors and setup
@@ -38,17 +44,11 @@ Wax9::Wax9()
     bEnabled = true;
     bConnected = false;
     bDebug = false;
-    bSmooth  = false;
     mSmoothFactor = 0.8;
     mNewReadings = 0;
     mHistoryLength = 120;
     mTimeout = 5.0f;
-    mLastReadingTime = std::numeric_limits<float>::infinity();
-    
-    bBatteryLow = false;
-    mBattery = 0xffff;
-    mPressure = 0xfffffffful;
-    mTemperature = 0xffff;
+    mLastReadingTime = std::numeric_limits<double>::infinity();
     
     // device settings
     bAccOn = true;
@@ -62,7 +62,28 @@ Wax9::Wax9()
     mGyrRange = 2000;
     mDataMode = 1;
     
-    mGyroDelta = vec3(0);
+    // ahrs and smoothing settings
+    Wax9FusionSettings fusion = Wax9Fusion::getDefaultSettings();
+    fusion.magRate = mMagRate;
+    mFusion.setup(fusion, mOutputRate);
+    bAdaptiveRate = false;
+    
+    // prediction
+    mPredictionHorizon = 0.1f;
+    mLinkDelay = 0.0f;
+    bPredictTrend = false;
+    
+    // stats
+    mNumSamples = 0;
+    mNumLost = 0;
+    mSampleRate = 0.0f;
+    memset(&mDecodeStats, 0, sizeof(mDecodeStats));
+    bSlipFrames = false;
+    mTraceTrack = -1;
+    mTraceDeliverStart = 0;
+    
+    mSamples.set_capacity(mHistoryLength);
+    mSampleKeys.set_capacity(mHistoryLength);
 }
 
 Wax9::~Wax9()
@@ -72,33 +93,61 @@ Wax9::~Wax9()
 
 bool Wax9::setup(string portName, int historyLength)
 {
-    bConnected = false;
-    mHistoryLength = historyLength;
-    mSamples = new SampleBuffer(mHistoryLength);
+    Wax9TransportRef transport;
     
-    app::console() << "Available serial ports: " << std::endl;
-    for( auto device : Serial::getDevices()) app::console() << device.getName() << ", " << device.getPath() << std::endl;
-
-    try {
-#ifdef CINDER_MSW
-		// finding serial devices is bugged in Windows
-		// see https://github.com/cinder/Cinder/issues/1064
-		Serial::Device device(portName);
+#ifdef WAX9_HEADLESS
+    console() << "Available serial ports: " << std::endl;
+    for (auto device : Wax9PosixTransport::getDevices()) console() << device << std::endl;
+    
+    transport = Wax9PosixTransport::create(portName, 115200);
 #else
-        Serial::Device device = Serial::findDeviceByNameContains(portName);
+    console() << "Available serial ports: " << std::endl;
+    for( auto device : Serial::getDevices()) console() << device.getName() << ", " << device.getPath() << std::endl;
+    
+    transport = Wax9SerialTransport::create(portName, 115200);
 #endif
-		mSerial = Serial::create(device, 115200);
-        app::console() << "Receiver sucessfully connected to " << device.getName() << std::endl;
-    }
-    catch(SerialExc e) {
-        app::console() << "Receiver unable to connect to " << portName << ": " << e.what() << std::endl;
+    
+    if (!transport) {
+        console() << "Receiver unable to connect to " << portName << std::endl;
         bConnected = false;
         return false;
     }
+    console() << "Receiver sucessfully connected to " << transport->getName() << std::endl;
+    return setup(transport, historyLength);
+}
+
+bool Wax9::setup(Wax9TransportRef transport, int historyLength)
+{
+    bConnected = false;
+    mHistoryLength = historyLength;
+    mSamples.clear();
+    mSamples.set_capacity(mHistoryLength);
+    mSampleKeys.clear();
+    mSampleKeys.set_capacity(mHistoryLength);
+    mExtender.reset();
+    mValidator.reset();
+    mTelemetry.reset();
+    mClock.reset();
+    
+    // stats are since setup(), a new transport may well be a different device
+    mNewReadings = 0;
+    mLastReadingTime = std::numeric_limits<double>::infinity();
+    mNumSamples = 0;
+    mNumLost = 0;
+    mSampleRate = 0.0f;
+    memset(&mDecodeStats, 0, sizeof(mDecodeStats));
+    bSlipFrames = false;
     
-    AhrsInit(&mAhrs, 0, mOutputRate, 0.1f);
+    mTransport = transport;
+    if (!mTransport || !mTransport->isOpen()) {
+        publishState();
+        return false;
+    }
+    
+    mFusion.setup(mFusion.getSettings(), mOutputRate);
     
     bConnected = true;
+    publishState();
     return true;
 }
 
@@ -108,21 +157,21 @@ bool Wax9::start()
 
         // construct settings string - we're not using range, just leaving defaults
         std::string settings = "\r\n";
-        settings += "RATE X 1 " + toString(mOutputRate) + "\r\n";                       // output rate in Hz (table 7 in dev guide)
-        settings += "RATE A " + toString(bAccOn) + " " + toString(mAccRate) + "\r\n";   // accel rate in Hz (table 7)
-        settings += "RATE G " + toString(bGyrOn) + " " + toString(mGyrRate) + "\r\n";   // gyro rate in Hz (table 7)
-        settings += "RATE M " + toString(bMagOn) + " " + toString(mMagRate) + "\r\n";   // magnetometer rate Hz (table 7)
-        settings += "DATAMODE " + toString(mDataMode) + "\r\n";                         // binary data mode (table 10)
+        settings += "RATE X 1 " + std::to_string(mOutputRate) + "\r\n";                              // output rate in Hz (table 7 in dev guide)
+        settings += "RATE A " + std::to_string(bAccOn) + " " + std::to_string(mAccRate) + "\r\n";   // accel rate in Hz (table 7)
+        settings += "RATE G " + std::to_string(bGyrOn) + " " + std::to_string(mGyrRate) + "\r\n";   // gyro rate in Hz (table 7)
+        settings += "RATE M " + std::to_string(bMagOn) + " " + std::to_string(mMagRate) + "\r\n";   // magnetometer rate Hz (table 7)
+        settings += "DATAMODE " + std::to_string(mDataMode) + "\r\n";                                // binary data mode (table 10)
         
-        app::console() << settings;
+        console() << settings;
         
         // send settings and wait for reply from device
-        mSerial->writeString(settings);
-        app::console() << mSerial->readStringUntil('\n', -1, 2.0) << std::endl;
+        mTransport->writeString(settings);
+        console() << mTransport->readLine(2.0) << std::endl;
         
         // start streaming
         std::string init = "\r\nSTREAM\r\n";       // start streaming
-        mSerial->writeString(init);
+        mTransport->writeString(init);
         
         return true;
     }
@@ -134,8 +183,8 @@ bool Wax9::stop()
 {
     // send termination string (this disconnects the device)
     if (bConnected) {
-//        mSerial.writeString("\\r\nRESET\r\n");
-//        app::console() << "Resetting and disconnecting WAX9" << std::endl;
+//        mTransport->writeString("\\r\nRESET\r\n");
+//        console() << "Resetting and disconnecting WAX9" << std::endl;
     }
     bConnected = false;
     bEnabled = false;
@@ -150,30 +199,388 @@ bool Wax9::stop()
 int Wax9::update()
 {
     if (bConnected) {
-        mNewReadings = readPackets(mBuffer);
+        uint64_t traceStart = mTrace ? Wax9Trace::now() : 0;
+        Wax9PooledBuffer buffer;    // only needed while reading
+        mNewReadings = readPackets(buffer.get());
 
-        // If first run - not sure if this does anything
-        if (mNewReadings > 0 && getNumReadings() == 0) {
-            calculateOrientation(vec3(0), vec3(0), vec3(0), 0);
-        }
-        
         int numNewReadings = getNumNewReadings();
+        if (bAdaptiveRate && !mBatchPackets.empty()) updateRate();
     
-        // make sure we're not disconnected
-        if (numNewReadings > 0)
-            mLastReadingTime = app::getElapsedSeconds();
-        else if (getNumReadings() > 0 && ((app::getElapsedSeconds() - mLastReadingTime) > mTimeout))
+        // make sure we're not disconnected. Packets count even while fixed lag holds them back
+        if (!mBatchPackets.empty())
+            mLastReadingTime = getHostTime();
+        else if (!mTransport->isOpen() || (getNumReadings() > 0 && ((getHostTime() - mLastReadingTime) > mTimeout)))
             bConnected = false;
         
+        publishState();
+        if (mTrace) traceUpdate(traceStart);
         return numNewReadings;
     }
     return 0;
 }
 
+// Spans of this update and the latency of the samples it delivered, see Wax9Trace.h
+void Wax9::traceUpdate(uint64_t start)
+{
+    uint64_t end = Wax9Trace::now();
+    size_t count = mBatch.size();
+    
+    if (count > 0) {
+        mTrace->span(mTraceTrack, WAX9_SPAN_DELIVER, mTraceDeliverStart, end, (uint32_t)count);
+        
+        // of the samples stored, which fixed-lag smoothing may have held back from earlier updates
+        double delivered = getHostTime();
+        mTraceLatencies.resize(count);
+        for (size_t i = 0; i < count; i++) mTraceLatencies[i] = delivered - mBatch[i].hostTime;
+        mTrace->latency(mTraceTrack, WAX9_LATENCY_PROCESS, &mTraceLatencies[0], count);
+        
+        if (mClock.isValid()) {
+            for (size_t i = 0; i < count; i++) mTraceLatencies[i] = delivered - mClock.toHostTime(mBatch[i].timestamp) + mLinkDelay;
+            mTrace->latency(mTraceTrack, WAX9_LATENCY_END_TO_END, &mTraceLatencies[0], count);
+        }
+    }
+    mTrace->span(mTraceTrack, WAX9_SPAN_UPDATE, start, end, (uint32_t)count);
+}
+
+// Reading, decoding and parsing take turns for every frame, so their spans are the totals laid end to end.
+// The cycles counted for the pipeline are scaled to the wall time of the loop, the transport times its own reads
+void Wax9::traceRead(uint64_t start, uint64_t readNs, uint64_t decodeCycles, uint64_t parseCycles, uint64_t loopCycles, size_t count)
+{
+    uint64_t end = Wax9Trace::now();
+    double nsPerCycle = loopCycles > 0 ? (double)(end - start) / loopCycles : 0.0;
+    uint64_t decodeNs = (uint64_t)(decodeCycles * nsPerCycle);
+    uint64_t parseNs = (uint64_t)(parseCycles * nsPerCycle);
+    readNs = std::min(readNs, decodeNs);
+    
+    uint64_t decodeStart = start + readNs;
+    uint64_t parseStart = start + decodeNs;
+    mTrace->span(mTraceTrack, WAX9_SPAN_READ, start, decodeStart, (uint32_t)count);
+    mTrace->span(mTraceTrack, WAX9_SPAN_DECODE, decodeStart, parseStart, (uint32_t)count);
+    mTrace->span(mTraceTrack, WAX9_SPAN_PARSE, parseStart, std::min(parseStart + parseNs, end), (uint32_t)count);
+}
+
+void Wax9::setTrace(Wax9TraceRef trace, const std::string &name)
+{
+    mTrace = trace;
+    mTraceTrack = -1;
+    if (mTrace) mTraceTrack = mTrace->addTrack(!name.empty() ? name : (mTransport ? mTransport->getName() : "wax9"));
+}
+
+void Wax9::setOutputRate(int rate)
+{
+    rate = max(rate, 1);
+    if (rate == mOutputRate) return;
+    mOutputRate = rate;
+    mFusion.setOutputRate(rate);
+    
+    if (bConnected) {
+        // settings commands can stop the stream, so start it again like setup() does. The device
+        // may restart its sample numbers, and the packets still in flight come at the old rate
+        mTransport->writeString("\r\nRATE X 1 " + std::to_string(mOutputRate) + "\r\nSTREAM\r\n");
+        mValidator.reset();
+        mExtender.markRestart();
+        if (mRecorder) mRecorder->markRestart();
+        mSampleRate = 0.0f;
+    }
+}
+
+void Wax9::setAdaptiveRate(bool enabled, int stillRate)
+{
+    if (enabled && !bAdaptiveRate) {
+        Wax9RateSettings settings = mRateController.getSettings();
+        settings.motionRate = mOutputRate;
+        settings.stillRate = min(stillRate, mOutputRate);
+        mRateController.setSettings(settings);
+        mRateController.reset();
+    }
+    else if (!enabled && bAdaptiveRate) {
+        setOutputRate(mRateController.getSettings().motionRate);
+    }
+    bAdaptiveRate = enabled;
+}
+
+// Strongest motion in the packets of this update, raw so smoothing doesn't hide its onset
+void Wax9::updateRate()
+{
+    vec3 bias = getGyroDelta() * (180.0f / 3.14159265f);
+    float gyro = 0.0f, acc = 0.0f;
+    for (size_t i = 0; i < mBatchPackets.size(); i++) {
+        const Wax9Packet &p = mBatchPackets[i];
+        gyro = max(gyro, length(vec3(p.gyro.x, p.gyro.y, p.gyro.z) * 0.07f - bias));
+        acc = max(acc, fabs(length(vec3(p.accel.x, p.accel.y, p.accel.z)) / 4096.0f - 1.0f));
+    }
+    setOutputRate(mRateController.update(gyro, acc, getHostTime()));
+}
+
 void Wax9::resetOrientation(quat q)
 {
-    float quat[4] = {q.w, q.x, q.y, q.z};
-    AhrsReset(&mAhrs, quat);
+    mFusion.reset(q);
+}
+
+void Wax9::setSmooth(bool s, float f)
+{
+    mSmoothFactor = min(max(f, 0.0f), 0.99f);
+    
+    // one-euro filters that match an EMA with this factor when the sensor is still.
+    // Speed raises the cutoff by beta Hz per g/s, rad/s^2, uT/s and rad/s respectively
+    static const float beta[WAX9_SMOOTH_NUM_CHANNELS] = { 0.5f, 0.05f, 0.0f, 5.0f };
+    float cutoff = (1.0f - mSmoothFactor) * mOutputRate / (2.0f * 3.14159265f * max(mSmoothFactor, 0.01f));
+    for (int i = 0; i < WAX9_SMOOTH_NUM_CHANNELS; i++) {
+        Wax9SmoothSettings settings = { s ? WAX9_SMOOTH_ONE_EURO : WAX9_SMOOTH_OFF, cutoff, beta[i], 1.0f, 2 };
+        setSmooth((Wax9SmoothChannel)i, settings);
+    }
+}
+
+void Wax9::setSmooth(Wax9SmoothChannel channel, const Wax9SmoothSettings &settings)
+{
+    mFusion.setSmooth(channel, settings);
+}
+
+uint64_t Wax9::getNumRejected() const
+{
+    return mDecodeStats.numCorrupt + mDecodeStats.numMalformed + mDecodeStats.numOutOfRange + mDecodeStats.numImplausible;
+}
+
+Wax9MemoryUsage Wax9::getMemoryUsage() const
+{
+    Wax9MemoryUsage usage;
+    usage.object = sizeof(Wax9);
+    usage.history = mSamples.capacity() * (sizeof(Wax9Sample) + sizeof(Wax9SampleKey));
+    usage.batch = mBatchPackets.capacity() * sizeof(Wax9Packet) + mBatchTimes.capacity() * sizeof(double) + mBatch.capacity() * sizeof(Wax9Sample);
+    usage.other = mPipeline.getMemoryUsage() + mClock.getMemoryUsage();
+    usage.total = usage.object + usage.history + usage.batch + usage.other;
+    return usage;
+}
+
+void Wax9::setPrediction(float maxHorizon, bool useTrend, float linkDelay)
+{
+    mPredictionHorizon = max(maxHorizon, 0.0f);
+    bPredictTrend = useTrend;
+    mLinkDelay = linkDelay;
+}
+
+quat Wax9::predictOrientation(double hostTime, bool AHRS)
+{
+    if (mSamples.empty()) return quat();
+    const Wax9Sample &s = mSamples.front();
+    
+    // when the sample was taken on the host clock, rather than when it happened to arrive
+    double sampleTime = mClock.isValid() ? mClock.toHostTime(s.timestamp) - mLinkDelay : s.hostTime;
+    float dt = (float)min(max(hostTime - sampleTime, 0.0), (double)mPredictionHorizon);
+    
+    vec3 rate = s.gyr - getGyroDelta();
+    if (bPredictTrend && mSamples.size() > 1) {
+        // mean rate over the horizon, assuming the angular acceleration between the last two samples holds
+        const Wax9Sample &prev = mSamples.at(1);
+        float sampleDt = (int32_t)(s.timestamp - prev.timestamp) / 65536.0f;
+        if (sampleDt > 0.0f && sampleDt < 0.1f) rate += (s.gyr - prev.gyr) * (0.5f * dt / sampleDt);
+    }
+    
+    // body rates, so the increment goes on the right
+    quat q = s.rotAHRS;
+    float rateLength = length(rate);
+    if (rateLength * dt > 1e-6f) q = normalize(q * angleAxis(rateLength * dt, rate / rateLength));
+    return AHRS ? q : AHRStoOpenGL(q);
+}
+
+void Wax9::setAhrs(Wax9AhrsAlgorithm algorithm, float twoKp, float twoKi)
+{
+    mFusion.setAhrs(algorithm, twoKp, twoKi);
+}
+
+void Wax9::setUseMagnetometer(bool b)
+{
+    mFusion.setUseMagnetometer(b);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark history queries
+/* -------------------------------------------------------------------------------------------------- */
+
+// Sample times come from the device timestamps, which are evenly spaced, rather than from arrival times
+double Wax9::getNewestSampleTime()
+{
+    const Wax9Sample &newest = mSamples.front();
+    return mClock.isValid() ? mClock.toHostTime(newest.timestamp) : newest.hostTime;
+}
+
+// Host time of a reading from its extended timestamp, which keeps counting forward when the device
+// clock restarts, so times stay ordered across the whole history. Every query by time goes through here
+static inline double sampleTime(const Wax9SampleKey &key, const Wax9SampleKey &newest, double newestTime)
+{
+    return newestTime - (double)(newest.timestamp - key.timestamp) / 65536.0;
+}
+
+double Wax9::getSampleTime(int i)
+{
+    return sampleTime(mSampleKeys.at(i), mSampleKeys.front(), getNewestSampleTime());
+}
+
+// Index of the newest sample taken at or before hostTime, or -1 if it's older than the whole history.
+// Readings are stored newest first, so times decrease with the index
+int Wax9::findSample(double hostTime, double newestTime)
+{
+    const boost::circular_buffer<Wax9SampleKey> &keys = mSampleKeys;
+    const Wax9SampleKey &newest = keys.front();
+    int lo = 0, hi = (int)keys.size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (sampleTime(keys[mid], newest, newestTime) <= hostTime) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo < (int)keys.size() ? lo : -1;
+}
+
+void Wax9::interpolateSample(const Wax9Sample &older, const Wax9Sample &newer, float f, Wax9Sample &s)
+{
+    s.sampleNumber = f < 0.5f ? older.sampleNumber : newer.sampleNumber;
+    s.timestamp = older.timestamp + (uint32_t)(f * (float)(newer.timestamp - older.timestamp) + 0.5f);
+    s.acc = mix(older.acc, newer.acc, f);
+    s.gyr = mix(older.gyr, newer.gyr, f);
+    s.mag = mix(older.mag, newer.mag, f);
+    s.accLen = length(s.acc);
+    s.rotAHRS = slerp(older.rotAHRS, newer.rotAHRS, f);
+    s.rotOGL = slerp(older.rotOGL, newer.rotOGL, f);
+}
+
+bool Wax9::sampleAt(double hostTime, Wax9Sample &sample)
+{
+    return samplesAt(&hostTime, 1, &sample) == 1;
+}
+
+quat Wax9::orientationAt(double hostTime, bool AHRS)
+{
+    quat q;
+    orientationsAt(&hostTime, 1, &q, AHRS);
+    return q;
+}
+
+// Finds the samples on either side of each time and calls visit(k, older, newer, f), with f from 0 at older
+// to 1 at newer. Older and newer are the same sample when the time is beyond either end of the history.
+// The binary search is only for the first time, the rest walk towards the newest sample
+template<typename Visit> void Wax9::visitSamplesAt(const double *hostTimes, size_t count, Visit visit)
+{
+    const SampleBuffer &history = mSamples;
+    const boost::circular_buffer<Wax9SampleKey> &keys = mSampleKeys;
+    const Wax9SampleKey &newest = keys.front();
+    double newestTime = getNewestSampleTime();
+    int last = (int)history.size() - 1;
+    
+    int i = findSample(hostTimes[0], newestTime);
+    if (i < 0) i = last;
+    for (size_t k = 0; k < count; k++) {
+        double t = hostTimes[k];
+        while (i > 0 && sampleTime(keys[i - 1], newest, newestTime) <= t) i--;
+        
+        const Wax9Sample &older = history[i];
+        double olderTime = sampleTime(keys[i], newest, newestTime);
+        if (i == 0 || t <= olderTime) {
+            visit(k, older, older, 0.0f);
+        }
+        else {
+            const Wax9Sample &newer = history[i - 1];
+            double span = sampleTime(keys[i - 1], newest, newestTime) - olderTime;
+            visit(k, older, newer, span > 0.0 ? (float)((t - olderTime) / span) : 1.0f);
+        }
+    }
+}
+
+size_t Wax9::samplesAt(const double *hostTimes, size_t count, Wax9Sample *samples)
+{
+    if (mSamples.empty() || count == 0) return 0;
+    
+    visitSamplesAt(hostTimes, count, [&](size_t k, const Wax9Sample &older, const Wax9Sample &newer, float f) {
+        if (&older == &newer) samples[k] = older;
+        else interpolateSample(older, newer, f, samples[k]);
+        samples[k].hostTime = hostTimes[k];
+    });
+    return count;
+}
+
+size_t Wax9::orientationsAt(const double *hostTimes, size_t count, quat *orientations, bool AHRS)
+{
+    if (mSamples.empty() || count == 0) return 0;
+    
+    visitSamplesAt(hostTimes, count, [&](size_t k, const Wax9Sample &older, const Wax9Sample &newer, float f) {
+        const quat &a = AHRS ? older.rotAHRS : older.rotOGL;
+        orientations[k] = (&older == &newer) ? a : slerp(a, AHRS ? newer.rotAHRS : newer.rotOGL, f);
+    });
+    return count;
+}
+
+// First index where pred is true. Keys decrease with the index, so it's false up to some point and true after
+template<typename Pred> static size_t partitionIndex(size_t size, Pred pred)
+{
+    size_t lo = 0, hi = size;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (pred(mid)) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+// Readings begin to end-1, split where the ring wraps
+Wax9SampleRange Wax9::getRange(size_t begin, size_t end)
+{
+    Wax9SampleRange range;
+    if (begin >= end) return range;
+    
+    const SampleBuffer &history = mSamples;
+    SampleBuffer::const_array_range one = history.array_one();
+    SampleBuffer::const_array_range two = history.array_two();
+    range.offset = begin;
+    
+    if (begin < one.second) {
+        range.first = one.first + begin;
+        range.firstSize = min(end, one.second) - begin;
+    }
+    if (end > one.second) {
+        const Wax9Sample *from = two.first + (max(begin, one.second) - one.second);
+        size_t size = end - max(begin, one.second);
+        if (range.firstSize == 0) { range.first = from; range.firstSize = size; }
+        else { range.second = from; range.secondSize = size; }
+    }
+    return range;
+}
+
+Wax9SampleRange Wax9::getSamplesBySampleNumber(uint64_t first, uint64_t last)
+{
+    const boost::circular_buffer<Wax9SampleKey> &keys = mSampleKeys;
+    size_t begin = partitionIndex(keys.size(), [&](size_t i) { return keys[i].sample <= last; });
+    size_t end = partitionIndex(keys.size(), [&](size_t i) { return keys[i].sample < first; });
+    return getRange(begin, end);
+}
+
+Wax9SampleRange Wax9::getSamplesByTimestamp(uint64_t start, uint64_t end)
+{
+    const boost::circular_buffer<Wax9SampleKey> &keys = mSampleKeys;
+    size_t b = partitionIndex(keys.size(), [&](size_t i) { return keys[i].timestamp <= end; });
+    size_t e = partitionIndex(keys.size(), [&](size_t i) { return keys[i].timestamp < start; });
+    return getRange(b, e);
+}
+
+// Same times as getSampleTime()
+Wax9SampleRange Wax9::getSamplesByTime(double startTime, double endTime)
+{
+    if (mSamples.empty()) return Wax9SampleRange();
+    
+    const boost::circular_buffer<Wax9SampleKey> &keys = mSampleKeys;
+    const Wax9SampleKey &newest = keys.front();
+    double newestTime = getNewestSampleTime();
+    size_t b = partitionIndex(keys.size(), [&](size_t i) { return sampleTime(keys[i], newest, newestTime) <= endTime; });
+    size_t e = partitionIndex(keys.size(), [&](size_t i) { return sampleTime(keys[i], newest, newestTime) < startTime; });
+    return getRange(b, e);
+}
+
+Wax9SampleRange Wax9::getRecentSamples(double seconds)
+{
+    if (mSamples.empty()) return Wax9SampleRange();
+    
+    // device time, so it's exact and doesn't depend on the clock map
+    uint64_t newest = mSampleKeys.front().timestamp;
+    uint64_t span = (uint64_t)(max(seconds, 0.0) * 65536.0);
+    return getSamplesByTimestamp(newest > span ? newest - span : 0, newest);
 }
 
 /* -------------------------------------------------------------------------------------------------- */
@@ -182,90 +589,403 @@ void Wax9::resetOrientation(quat q)
 
 int Wax9::readPackets(char* buffer)
 {
-    int packetsRead = 0;
-    while(mSerial->getNumBytesAvailable() > 0)
+    mBatchPackets.clear();
+    mBatchTimes.clear();
+    mBatch.clear();
+    uint64_t decodeCycles = 0, parseCycles = 0;
+    uint64_t traceStart = mTrace ? Wax9Trace::now() : 0;
+    uint64_t traceReadTime = mTrace ? mTransport->getReadTime() : 0;
+    uint64_t loopStart = wax9Cycles();
+    
+    while(mTransport->getNumBytesAvailable() > 0)
     {
         // Read data
-        size_t bytesRead = lineread(buffer, BUFFER_SIZE);
+        uint64_t start = wax9Cycles();
+        // once it streams binary, frames are read directly so a lost SLIP_END doesn't
+        // make the next packet look like a line of text
+        size_t bytesRead = bSlipFrames ? (size_t) - 1 : lineread(buffer, WAX9_DECODE_BUFFER_SIZE);
+        bool slip = bytesRead == (size_t) - 1;
         
-        if (bytesRead == (size_t) - 1)
+        if (slip)
         {
-            bytesRead = slipread(buffer, BUFFER_SIZE);
+            bytesRead = slipread(buffer, WAX9_DECODE_BUFFER_SIZE);
         }
-        if (bytesRead == 0) { return 0; }
+        uint64_t decoded = wax9Cycles();
+        decodeCycles += decoded - start;
+        if (bytesRead == 0) { break; }
         
         
         // Get time now
         unsigned long long now = ticksNow();
+        double hostTime = getHostTime();
         
         // If it appears to be a binary WAX9 packet...
         if (bytesRead > 1 && buffer[0] == '9')
         {
-            Wax9Packet *wax9Packet = parseWax9Packet(buffer, bytesRead, now);
+            bSlipFrames = slip;
             
-            if (wax9Packet != NULL)
+            // one packet per frame, or more when the SLIP_END between them got lost
+            size_t offset = 0;
+            while (offset < bytesRead)
             {
-                if(bDebug) printWax9(wax9Packet);
+                size_t length = getPacketLength((const unsigned char *)buffer + offset, bytesRead - offset);
+                if (length == 0) {
+                    static Wax9LogMessage sMalformed(WAX9_LOG_WARNING, "WARNING: Malformed WAX9 frame of %d bytes -- ignoring.", 1.0f);
+                    Wax9Log::get().log(sMalformed, bytesRead - offset);
+                    mDecodeStats.numMalformed++;
+                    break;
+                }
+                if (length < bytesRead - offset) mDecodeStats.numSplit++;
                 
-                // process packet and save it
-                mSamples->push_front(processPacket(wax9Packet));  //todo: check if we should store packet pointers in the buffer
-                packetsRead++;
+                Wax9Packet *wax9Packet = parseWax9Packet(buffer + offset, length);
+                if (wax9Packet != NULL && mValidator.validate(*wax9Packet, mDecodeStats))
+                {
+                    acceptPacket(*wax9Packet, length, now, hostTime);
+                }
+                offset += length;
             }
         }
+        else if (slip && !isprint((unsigned char)buffer[0]))
+        {
+            // the tail of a frame cut by a timeout, or garbage. Text is a reply to a command
+            mDecodeStats.numMalformed++;
+        }
+        parseCycles += wax9Cycles() - decoded;
     }
-//    if (packetsRead > 0) app::console() << "packets read: " << packetsRead << std::endl;
-    return packetsRead;
+    
+    size_t count = mBatchPackets.size();
+    mPipeline.record(WAX9_STAGE_DECODE, decodeCycles, count);
+    mPipeline.record(WAX9_STAGE_PARSE, parseCycles, count);
+    if (mTrace) traceRead(traceStart, mTransport->getReadTime() - traceReadTime, decodeCycles, parseCycles, wax9Cycles() - loopStart, count);
+    if (count > 0) count = processBatch();
+    
+//    if (packetsRead > 0) console() << "packets read: " << packetsRead << std::endl;
+    return (int)count;
 }
 
-Wax9Sample Wax9::processPacket(Wax9Packet *p)
+// A packet that passed validation, kept for processing with the rest of this update
+void Wax9::acceptPacket(const Wax9Packet &packet, size_t len, unsigned long long now, double hostTime)
 {
-    Wax9Sample s;
-    s.timestamp = p->timestamp;
-    s.sampleNumber = p->sampleNumber;
-    s.acc = vec3(p->accel.x, p->accel.y, p->accel.z) / 4096.0f;         // table 19 - in g
-    s.gyr = vec3(p->gyro.x, p->gyro.y, p->gyro.z) * toRadians(0.07f);   // table 20 + convert deg/s to rad/s
-    s.mag = vec3(p->mag.x, p->mag.y, -p->mag.z) * 0.1f;                 // in μT
-    s.accLen = length(s.acc);
-    s.rotAHRS = calculateOrientation(s.acc, s.gyr - mGyroDelta , s.mag, s.timestamp);
-    s.rotOGL = AHRStoOpenGL(s.rotAHRS);
+    if(bDebug) printWax9(&packet, now);
+    if(mRecorder) mRecorder->write(packet, now);
+    
+    // the sensor metadata only comes in extended packets, it goes to its own telemetry
+    // channel, which keeps the readings, and never through processPacket()
+    if (len >= 28)
+    {
+        mTelemetry.update(packet.battery, packet.temperature, packet.pressure, packet.timestamp, now);
+    }
+    
+    mBatchPackets.push_back(packet);
+    mBatchTimes.push_back(hostTime);
+}
+
+// Runs the packets read in this update through the pipeline stages and stores them, oldest first.
+// Returns how many were stored, fixed-lag smoothing holds the newest ones back for a few samples
+size_t Wax9::processBatch()
+{
+    size_t count = mBatchPackets.size();
+    mBatch.resize(count);
+    Wax9Sample *batch = &mBatch[0];
+    uint64_t traceStart = mTrace ? Wax9Trace::now() : 0;
+    uint64_t start = wax9Cycles(), end;
     
-    // the sensor metadata only comes in every once in a while
-    if (p->temperature != -1) {
-        mTemperature = (float)p->temperature * 0.1f;
-        if (bDebug) app::console() << "WAX9 - temperature: " << mTemperature << " celsius/n";
+    for (size_t i = 0; i < count; i++) {
+        convertPacket(mBatchPackets[i], batch[i]);
+        batch[i].hostTime = mBatchTimes[i];
+        mClock.add(batch[i].timestamp, batch[i].hostTime);
     }
-    if (p->pressure != 0xfffffffful) {
-        mPressure = p->pressure;
-        if (bDebug)app::console() << "WAX9 - pressure: " << mPressure << " pascals/n";
+    end = wax9Cycles();
+    mPipeline.record(WAX9_STAGE_CALIBRATE, end - start, count);
+    
+    if (mPipeline.isEnabled(WAX9_STAGE_FUSION)) {
+        start = end;
+        mFusion.fuse(batch, count);
+        end = wax9Cycles();
+        mPipeline.record(WAX9_STAGE_FUSION, end - start, count);
+    }
+    else {
+        for (size_t i = 0; i < count; i++) batch[i].rotAHRS = quat();
     }
-    if (p->battery != 0xffff){
-        mBattery = p->battery;
-        bBatteryLow = p->battery < 3500;   // according to dev guide, battery dies under 3300 mV
-        if (bDebug)app::console() << "WAX9 - Battery: " << p->battery << " millivolts/n";
+    
+    if (mFusion.isSmoothing() && mPipeline.isEnabled(WAX9_STAGE_SMOOTH)) {
+        start = end;
+        size_t numIn = count;
+        count = mFusion.smooth(batch, count);
+        mBatch.resize(count);
+        end = wax9Cycles();
+        mPipeline.record(WAX9_STAGE_SMOOTH, end - start, numIn);
+        if (count == 0) return 0;
     }
     
-    return s;
+    if (mPipeline.isEnabled(WAX9_STAGE_FRAME)) {
+        start = end;
+        Wax9Orientation::toOpenGL(&batch[0].rotAHRS, count, &batch[0].rotOGL, sizeof(Wax9Sample), sizeof(Wax9Sample));
+        end = wax9Cycles();
+        mPipeline.record(WAX9_STAGE_FRAME, end - start, count);
+    }
+    else {
+        for (size_t i = 0; i < count; i++) batch[i].rotOGL = quat();
+    }
+    
+    mPipeline.runStages(batch, count);
+    
+    if (mTrace) {
+        uint64_t fused = Wax9Trace::now();
+        mTrace->span(mTraceTrack, WAX9_SPAN_FUSE, traceStart, fused, (uint32_t)count);
+        traceStart = fused;
+    }
+    
+    start = wax9Cycles();
+    for (size_t i = 0; i < count; i++) {
+        mExtender.extend(batch[i].sampleNumber, batch[i].timestamp);
+        Wax9SampleKey key = { mExtender.getSample(), mExtender.getTimestamp() };
+        mSampleKeys.push_front(key);
+        mSamples.push_front(batch[i]);
+    }
+    updateStats(count);
+    mPipeline.record(WAX9_STAGE_STORE, wax9Cycles() - start, count);
+    
+    if (mTrace) {
+        mTraceDeliverStart = Wax9Trace::now();
+        mTrace->span(mTraceTrack, WAX9_SPAN_STORE, traceStart, mTraceDeliverStart, (uint32_t)count);
+    }
+    
+    mPipeline.runSinks(batch, count);
+    return count;
+}
+
+// Gaps in the sample numbers and the rate from the device clock, once the batch is stored. Both come
+// from the extended keys, so wrap-arounds and restarts after a rate change aren't counted as losses
+void Wax9::updateStats(size_t count)
+{
+    for (size_t i = min(count, mSampleKeys.size()); i-- > 0;) {
+        if (i + 1 >= mSampleKeys.size()) continue;
+        const Wax9SampleKey &key = mSampleKeys[i];
+        const Wax9SampleKey &previous = mSampleKeys[i + 1];
+        mNumLost += key.sample - previous.sample - 1;
+        
+        float dt = (float)(key.timestamp - previous.timestamp) / 65536.0f;
+        if (dt > 0.0f && dt < 1.0f) {
+            float rate = 1.0f / dt;
+            mSampleRate = mSampleRate == 0.0f ? rate : mSampleRate + 0.02f * (rate - mSampleRate);
+        }
+    }
+    mNumSamples += count;
+}
+
+void Wax9::publishState()
+{
+    Wax9State state;
+    state.sample = mSamples.empty() ? Wax9Sample() : mSamples.front();
+    state.numSamples = mNumSamples;
+    state.numLost = mNumLost;
+    state.numRejected = getNumRejected();
+    state.outputRate = mOutputRate;
+    state.sampleRate = mSampleRate;
+    state.connected = bConnected;
+    state.batteryLow = mTelemetry.isBatteryLow();
+    state.updateTime = getHostTime();
+    for (int i = 0; i < WAX9_TELEMETRY_NUM_CHANNELS; i++) state.telemetry[i] = mTelemetry.getValue((Wax9TelemetryChannel)i);
+    mSnapshot.publish(state);
+}
+
+// Sensor units only, orientation is left to the caller
+void Wax9::convertPacket(const Wax9Packet &p, Wax9Sample &s)
+{
+    s.timestamp = p.timestamp;
+    s.sampleNumber = p.sampleNumber;
+    s.acc = vec3(p.accel.x, p.accel.y, p.accel.z) / 4096.0f;         // table 19 - in g
+    s.gyr = vec3(p.gyro.x, p.gyro.y, p.gyro.z) * toRadians(0.07f);   // table 20 + convert deg/s to rad/s
+    s.mag = vec3(p.mag.x, p.mag.y, -p.mag.z) * 0.1f;                 // in μT
+    s.accLen = length(s.acc);
+}
+
+// Timestamps are in 1/65536 of a second. Recordings use this too, so they replay with the live dt
+float Wax9::getSampleFreq(uint32_t timestamp, uint32_t previous, float nominal)
+{
+    uint32_t elapsed = timestamp - previous;
+    return elapsed > 0 && elapsed < 65536 / 4 ? 65536.0f / elapsed : nominal;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark fusion
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Fusion::Wax9Fusion()
+{
+    setup(getDefaultSettings(), 120);
+}
+
+// same as a new Wax9
+Wax9FusionSettings Wax9Fusion::getDefaultSettings()
+{
+    Wax9FusionSettings settings;
+    settings.algorithm = WAX9_AHRS_MADGWICK;
+    settings.twoKp = 0.1f;
+    settings.twoKi = 0.0f;
+    settings.useMag = false;
+    settings.magRate = 80;
+    settings.gyroDelta = vec3(0);
+    for (int i = 0; i < WAX9_SMOOTH_NUM_CHANNELS; i++) {
+        Wax9SmoothSettings smooth = { WAX9_SMOOTH_OFF, 1.0f, 0.0f, 1.0f, 2 };
+        settings.smooth[i] = smooth;
+    }
+    return settings;
+}
+
+void Wax9Fusion::setup(const Wax9FusionSettings &settings, int outputRate)
+{
+    mSettings = settings;
+    setOutputRate(outputRate);
+    mAhrs.setup(mSettings.algorithm, mSettings.useMag ? WAX9_AHRS_MARG : WAX9_AHRS_IMU, (float)mOutputRate, mSettings.twoKp, mSettings.twoKi);
+    mLastAhrsTimestamp = 0;
+    mLastMag = vec3(0);
+    mLastMagTimestamp = 0;
+    for (int i = 0; i < WAX9_SMOOTH_NUM_CHANNELS; i++) setSmooth((Wax9SmoothChannel)i, settings.smooth[i]);
 }
 
-quat Wax9::calculateOrientation(const vec3 &acc, const vec3 &gyr, const vec3 &mag, uint32_t timestamp)
+void Wax9Fusion::setAhrs(Wax9AhrsAlgorithm algorithm, float twoKp, float twoKi)
 {
-    // set sample frequency for AHRS algorithm
-//    if (!mSamples->empty()) {
-//        // compare timestamp between previous sample and this one
-//        uint32_t prevTimestamp = mSamples->front().timestamp;
-//        uint32_t diff = timestamp - prevTimestamp;
-//        float diffSeconds = (float) diff / 65536.0f; // timestamps are in 1/65536 of a second
-//        mAhrs.sampleFreq = 1.0f / diffSeconds;
-//    }
-//    else mAhrs.sampleFreq = mOutputRate;
+    mSettings.algorithm = algorithm;
+    mSettings.twoKp = twoKp;
+    mSettings.twoKi = twoKi;
+    mAhrs.setup(mSettings.algorithm, mSettings.useMag ? WAX9_AHRS_MARG : WAX9_AHRS_IMU, (float)mOutputRate, mSettings.twoKp, mSettings.twoKi);
+}
+
+void Wax9Fusion::setUseMagnetometer(bool b)
+{
+    mSettings.useMag = b;
+    mLastMag = vec3(0);
+    mAhrs.setSensors(b ? WAX9_AHRS_MARG : WAX9_AHRS_IMU);
+}
+
+void Wax9Fusion::setSmooth(Wax9SmoothChannel channel, const Wax9SmoothSettings &settings)
+{
+    if (channel == WAX9_SMOOTH_ORIENTATION) {
+        mSmoothRot.setup(settings);
+        mSettings.smooth[channel] = mSmoothRot.getSettings();
+    }
+    else if (channel < WAX9_SMOOTH_ORIENTATION) {
+        mSmoothVec[channel].setup(settings);
+        mSettings.smooth[channel] = mSmoothVec[channel].getSettings();
+    }
     
-    // Call AHRS algorithm update
-    // we're not using the accelerometer yet
-    float gyro[3]   = {gyr.x, gyr.y, gyr.z};
-    float accel[3]  = {acc.x, acc.y, acc.z};
-    AhrsUpdate(&mAhrs, gyro, accel, NULL);
+    bSmooth = false;
+    mDelay = 0;
+    for (int i = 0; i < WAX9_SMOOTH_NUM_CHANNELS; i++) {
+        bSmooth |= mSettings.smooth[i].mode != WAX9_SMOOTH_OFF;
+        if (mSettings.smooth[i].mode == WAX9_SMOOTH_FIXED_LAG) mDelay = max(mDelay, mSettings.smooth[i].lag);
+    }
     
-    return quat(mAhrs.q[0], mAhrs.q[1], mAhrs.q[2], mAhrs.q[3]);
+    // samples held back with the old settings are dropped
+    mLastSmoothTimestamp = 0;
+    mNumHeld = 0;
+    mHead = 0;
+}
+
+void Wax9Fusion::reset(const quat &q)
+{
+    float quat[4] = {q.w, q.x, q.y, q.z};
+    mAhrs.reset(quat);
+    mSmoothRot.reset();
+}
+
+void Wax9Fusion::fuse(Wax9Sample *samples, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        Wax9Sample &s = samples[i];
+        
+        // sample frequency for the AHRS from the device clock, the output rate can change
+        // while streaming (see Wax9::setAdaptiveRate()). The nominal rate after gaps
+        float sampleFreq = Wax9::getSampleFreq(s.timestamp, mLastAhrsTimestamp, (float)mOutputRate);
+        if (fabs(sampleFreq - mAhrs.getState().sampleFreq) > 0.01f * sampleFreq) mAhrs.setSampleFreq(sampleFreq);
+        mLastAhrsTimestamp = s.timestamp;
+        
+        // gyro and accel are fused on every sample, the magnetometer only when it has a new reading
+        vec3 gyr = s.gyr - mSettings.gyroDelta;
+        float gyro[3]   = {gyr.x, gyr.y, gyr.z};
+        float accel[3]  = {s.acc.x, s.acc.y, s.acc.z};
+        if (mSettings.useMag && isNewMagReading(s.mag, s.timestamp)) {
+            float magnet[3] = {s.mag.x, s.mag.y, s.mag.z};
+            mAhrs.update(gyro, accel, magnet);
+        }
+        else {
+            mAhrs.update(gyro, accel);
+        }
+        
+        const float *q = mAhrs.getQuaternion();
+        s.rotAHRS = quat(q[0], q[1], q[2], q[3]);
+    }
+}
+
+// The magnetometer runs slower than the output rate (80 vs 120 Hz by default) and packets in between
+// repeat its last reading. A reading counts as new when it changes, or after two magnetometer periods
+// without changes in case the field really is that steady
+bool Wax9Fusion::isNewMagReading(const vec3 &mag, uint32_t timestamp)
+{
+    uint32_t elapsed = timestamp - mLastMagTimestamp;   // 16.16 seconds
+    if (mag == mLastMag && elapsed < (uint32_t)(2 * 65536 / max(mSettings.magRate, 1))) return false;
+    
+    mLastMag = mag;
+    mLastMagTimestamp = timestamp;
+    return true;
+}
+
+static vec3 Wax9Sample::* const sSmoothChannels[WAX9_SMOOTH_ORIENTATION] = { &Wax9Sample::acc, &Wax9Sample::gyr, &Wax9Sample::mag };
+
+// Every output is the input from mDelay samples ago. A fixed-lag channel with that lag is fed the
+// newest input and averages around it, one with a shorter lag is fed the input as much later.
+// The other channels are filtered as the delayed samples come out
+size_t Wax9Fusion::smooth(Wax9Sample *samples, size_t count)
+{
+    size_t numOut = 0;
+    for (size_t i = 0; i < count; i++) {
+        mHead = (mHead + 1) % (mDelay + 1);
+        mHeld[mHead] = samples[i];
+        mNumHeld = min(mNumHeld + 1, mDelay + 1);
+        
+        vec3 lagged[WAX9_SMOOTH_ORIENTATION];
+        quat laggedRot;
+        for (int c = 0; c < WAX9_SMOOTH_ORIENTATION; c++) {
+            const Wax9SmoothSettings &settings = mSettings.smooth[c];
+            int ago = mDelay - settings.lag;
+            if (settings.mode == WAX9_SMOOTH_FIXED_LAG && ago < mNumHeld) lagged[c] = mSmoothVec[c].filter(getHeld(ago).*sSmoothChannels[c], 0.0f);
+        }
+        const Wax9SmoothSettings &rotSettings = mSettings.smooth[WAX9_SMOOTH_ORIENTATION];
+        int rotAgo = mDelay - rotSettings.lag;
+        if (rotSettings.mode == WAX9_SMOOTH_FIXED_LAG && rotAgo < mNumHeld) laggedRot = mSmoothRot.filter(getHeld(rotAgo).rotAHRS, 0.0f);
+        
+        if (mNumHeld <= mDelay) continue;
+        Wax9Sample s = getHeld(mDelay);
+        
+        // time since the previous sample from the device clock, the nominal period after a gap
+        float dt = 1.0f / Wax9::getSampleFreq(s.timestamp, mLastSmoothTimestamp, (float)mOutputRate);
+        mLastSmoothTimestamp = s.timestamp;
+        
+        for (int c = 0; c < WAX9_SMOOTH_ORIENTATION; c++) {
+            vec3 &value = s.*sSmoothChannels[c];
+            value = mSettings.smooth[c].mode == WAX9_SMOOTH_FIXED_LAG ? lagged[c] : mSmoothVec[c].filter(value, dt);
+        }
+        s.accLen = length(s.acc);
+        s.rotAHRS = rotSettings.mode == WAX9_SMOOTH_FIXED_LAG ? laggedRot : mSmoothRot.filter(s.rotAHRS, dt);
+        samples[numOut++] = s;
+    }
+    return numOut;
+}
+
+size_t Wax9Fusion::finish(Wax9Sample *samples)
+{
+    size_t numOut = 0;
+    if (mDelay > 0 && mNumHeld > 0) {
+        Wax9Sample last = getHeld(0);
+        for (int i = 0; i < mDelay; i++) {
+            samples[numOut] = last;
+            numOut += smooth(&samples[numOut], 1);
+        }
+    }
+    for (int c = 0; c < WAX9_SMOOTH_NUM_CHANNELS; c++) setSmooth((Wax9SmoothChannel)c, mSettings.smooth[c]);
+    return numOut;
 }
 
 
@@ -293,10 +1013,7 @@ size_t Wax9::lineread(void *inBuffer, size_t len)
     {
         c = '\0';
         
-        try{
-            c = mSerial->readByte();
-        }
-        catch(...) {
+        if (!mTransport->readByte(c)) {
             return bytesRead;
         }
         
@@ -318,40 +1035,46 @@ size_t Wax9::lineread(void *inBuffer, size_t len)
     return 0;
 }
 
-/* Read a SLIP-encoded packet from the device */
+/* Read a SLIP-encoded packet from the device. Frames with bad escapes or longer than the buffer
+   are dropped and reading starts over at the next SLIP_END, which is also the start of the next frame */
 size_t Wax9::slipread(void *inBuffer, size_t len)
 {
     unsigned char *p = (unsigned char *)inBuffer;
     unsigned char c = '\0';
     size_t bytesRead = 0;
+    bool corrupt = false;
+    bool timedOut = false;
     
     if (inBuffer == NULL) return 0;
     
     //    while(!bCloseThread)
-    while(bEnabled)    //not sure if this is going to give problems without threaded
+    while(bEnabled && !timedOut)    //not sure if this is going to give problems without threaded
     {
         c = '\0';
         
-        try{
-            c = mSerial->readByte();
-        }
-        catch(...) {
-            return bytesRead;
+        if (!mTransport->readByte(c)) {
+            break;
         }
         switch (c)
         {
             case SLIP_END:
-                if (bytesRead) return bytesRead;
+                if (corrupt) {
+                    mDecodeStats.numCorrupt++;
+                    corrupt = false;
+                    bytesRead = 0;
+                }
+                else if (bytesRead) {
+                    mDecodeStats.numFrames++;
+                    return bytesRead;
+                }
                 break;
                 
             case SLIP_ESC:
                 c = '\0';
                 
-                try{
-                    c = mSerial->readByte();
-                }
-                catch(...) {
-                    return bytesRead;
+                if (!mTransport->readByte(c)) {
+                    timedOut = true;
+                    break;
                 }
                 
                 switch (c){
@@ -362,8 +1085,12 @@ size_t Wax9::slipread(void *inBuffer, size_t len)
                         c = SLIP_ESC;
                         break;
                     default:
-                        fprintf(stderr, "<Unexpected escaped value: %02x>", c);
+                    {
+                        static Wax9LogMessage sEscape(WAX9_LOG_WARNING, "<Unexpected escaped value: %02x, dropping frame>", 10.0f);
+                        Wax9Log::get().log(sEscape, c);
+                        corrupt = true;
                         break;
+                    }
                 }
                 
                 /* ... fall through to default case with our replaced character ... */
@@ -371,13 +1098,42 @@ size_t Wax9::slipread(void *inBuffer, size_t len)
                 if (bytesRead < len) {
                     p[bytesRead++] = c;
                 }
+                else {
+                    corrupt = true;
+                }
                 break;
         }
     }
+    
+    // timed out, a partial frame is left to the length checks
+    if (corrupt) {
+        mDecodeStats.numCorrupt++;
+        return 0;
+    }
+    if (bytesRead) mDecodeStats.numFrames++;
+    return bytesRead;
+}
+
+// Length of the packet at the start of a frame, from its version: 26 bytes for standard packets and
+// 34, or 36 with the device id, for extended ones. A frame that is longer holds more packets when a
+// SLIP_END got lost, so a length only fits when the frame ends there or another packet starts.
+// 0 if none fits
+size_t Wax9::getPacketLength(const unsigned char *buffer, size_t len)
+{
+    static const size_t standard[] = { 26, 0 };
+    static const size_t extended[] = { 36, 34, 0 };
+    static const size_t other[] = { 36, 34, 30, 28, 26, 20, 0 };     // anything the parser understands
+    
+    if (len < 2 || buffer[0] != '9') return 0;
+    
+    const size_t *lengths = buffer[1] == 0x01 ? standard : (buffer[1] == 0x02 ? extended : other);
+    for (; *lengths; lengths++) {
+        if (*lengths == len || (*lengths < len && buffer[*lengths] == '9')) return *lengths;
+    }
     return 0;
 }
 
-Wax9Packet* Wax9::parseWax9Packet(const void *inputBuffer, size_t len, unsigned long long now)
+Wax9Packet* Wax9::parseWax9Packet(const void *inputBuffer, size_t len)
 {
     const unsigned char *buffer = (const unsigned char *)inputBuffer;
     static Wax9Packet wax9Packet;
@@ -386,7 +1142,8 @@ Wax9Packet* Wax9::parseWax9Packet(const void *inputBuffer, size_t len, unsigned
     
     if (buffer[0] != '9')
     {
-        fprintf(stderr, "WARNING: Unrecognized packet -- ignoring.\n");
+        static Wax9LogMessage sUnrecognized(WAX9_LOG_WARNING, "WARNING: Unrecognized packet -- ignoring.", 1.0f);
+        Wax9Log::get().log(sUnrecognized);
     }
     else if (len >= 20)
     {
@@ -456,19 +1213,159 @@ Wax9Packet* Wax9::parseWax9Packet(const void *inputBuffer, size_t len, unsigned
     }
     else
     {
-        fprintf(stderr, "WARNING: Unrecognized WAX9 packet -- ignoring.\n");
+        static Wax9LogMessage sShort(WAX9_LOG_WARNING, "WARNING: Unrecognized WAX9 packet -- ignoring.", 1.0f);
+        Wax9Log::get().log(sShort);
     }
     return NULL;
 }
 
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark packet validation
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9PacketValidator::Wax9PacketValidator()
+{
+    mLimits = getDefaultLimits();
+    reset();
+}
+
+Wax9PacketLimits Wax9PacketValidator::getDefaultLimits()
+{
+    Wax9PacketLimits limits;
+    limits.maxGyro = 2100.0f;           // 2000 deg/s range plus its scale tolerance
+    limits.maxMag = 1300.0f;            // the magnetometer saturates at 12 gauss
+    limits.maxGyroStep = 1500.0f;       // 180000 deg/s^2 at 120 Hz, well past anything worn
+    limits.periodTolerance = 0.5f;
+    limits.maxGap = 256;
+    return limits;
+}
+
+void Wax9PacketValidator::reset()
+{
+    bHasLast = false;
+    bHasCandidate = false;
+    mPeriod = 0.0;
+}
+
+bool Wax9PacketValidator::validate(const Wax9Packet &packet, Wax9DecodeStats &stats)
+{
+    if (!isInRange(packet)) {
+        static Wax9LogMessage sRange(WAX9_LOG_WARNING, "WARNING: WAX9 sample %d out of range -- ignoring.", 1.0f);
+        Wax9Log::get().log(sRange, (int)packet.sampleNumber);
+        stats.numOutOfRange++;
+        return false;
+    }
+    
+    if (bHasLast && !follows(packet, mLast, mPeriod)) {
+        if (!bHasCandidate || !follows(packet, mCandidate, 0.0)) {
+            static Wax9LogMessage sImplausible(WAX9_LOG_WARNING, "WARNING: WAX9 sample %d doesn't follow sample %d -- ignoring.", 1.0f);
+            Wax9Log::get().log(sImplausible, (int)packet.sampleNumber, (int)mLast.sampleNumber);
+            mCandidate = packet;
+            bHasCandidate = true;
+            stats.numImplausible++;
+            return false;
+        }
+        
+        // two in a row that agree with each other, the stream restarted
+        stats.numResyncs++;
+        mLast = mCandidate;
+        mPeriod = 0.0;
+    }
+    
+    if (bHasLast) {
+        double period = (double)(int32_t)(packet.timestamp - mLast.timestamp) / (uint16_t)(packet.sampleNumber - mLast.sampleNumber);
+        mPeriod = mPeriod == 0.0 ? period : mPeriod + 0.1 * (period - mPeriod);
+    }
+    mLast = packet;
+    bHasLast = true;
+    bHasCandidate = false;
+    return true;
+}
+
+bool Wax9PacketValidator::isInRange(const Wax9Packet &p) const
+{
+    int gyro = (int)(mLimits.maxGyro / 0.07f);      // raw units, see Wax9::convertPacket()
+    int mag = (int)(mLimits.maxMag / 0.1f);
+    return abs(p.gyro.x) <= gyro && abs(p.gyro.y) <= gyro && abs(p.gyro.z) <= gyro &&
+           abs(p.mag.x) <= mag && abs(p.mag.y) <= mag && abs(p.mag.z) <= mag;
+}
+
+// Whether a packet can come after previous in the same stream. The period is in 16.16 ticks per
+// sample, with 0 anything from 1 Hz to 1 kHz goes
+bool Wax9PacketValidator::follows(const Wax9Packet &p, const Wax9Packet &previous, double period) const
+{
+    uint16_t samples = p.sampleNumber - previous.sampleNumber;
+    int32_t ticks = (int32_t)(p.timestamp - previous.timestamp);
+    if (samples == 0 || samples > mLimits.maxGap || ticks <= 0) return false;
+    
+    double perSample = (double)ticks / samples;
+    if (period > 0.0) {
+        if (fabs(perSample - period) > mLimits.periodTolerance * period) return false;
+    }
+    else if (perSample < 65536.0 / 1000.0 || perSample > 65536.0) {
+        return false;
+    }
+    
+    // the gyro can only change so much from one sample to the next
+    if (samples <= 2) {
+        int step = (int)(mLimits.maxGyroStep / 0.07f) * samples;
+        if (abs(p.gyro.x - previous.gyro.x) > step || abs(p.gyro.y - previous.gyro.y) > step || abs(p.gyro.z - previous.gyro.z) > step) return false;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark sequence extender
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9SequenceExtender::reset(uint64_t sample, uint64_t timestamp)
+{
+    bFirst = false;
+    bRestart = false;
+    mSample = sample;
+    mTimestamp = timestamp;
+    mLastSample = (uint16_t)sample;
+    mLastTimestamp = (uint32_t)timestamp;
+}
+
+void Wax9SequenceExtender::extend(uint16_t sampleNumber, uint32_t timestamp)
+{
+    if (bFirst) {
+        bFirst = false;
+        mSample = sampleNumber;
+        mTimestamp = timestamp;
+    }
+    else {
+        // sample numbers reset on configuration changes and inactivity, keep counting forward
+        uint16_t ds = (uint16_t)(sampleNumber - mLastSample);
+        if (bRestart && (uint32_t)(timestamp - mRestartTimestamp) > 65536) bRestart = false;
+        if (bRestart && ds != 1) {
+            // packets still in flight at the old rate follow on, the restarted ones are a step
+            // ahead whatever their number wrapped to
+            bRestart = false;
+            ds = 1;
+        }
+        else if (ds == 0 || ds >= 0x8000) ds = 1;
+        mSample += ds;
+
+        uint32_t dt = timestamp - mLastTimestamp;
+        if (dt >= 0x80000000u) dt = 0;
+        mTimestamp += dt;
+    }
+    mLastSample = sampleNumber;
+    mLastTimestamp = timestamp;
+}
+
 /* -------------------------------------------------------------------------------------------------- */
 #pragma mark utils
 /* -------------------------------------------------------------------------------------------------- */
 
-void Wax9::printWax9(Wax9Packet *wax9Packet)
+// Formatted later by the log thread, so it can stay on while streaming
+void Wax9::printWax9(const Wax9Packet *wax9Packet, unsigned long long ticks)
 {
-    printf( "\nWAX9\ntimestring:\t%s\ntimestamp:\t%f\npacket num:\t%u\naccel\t[%f %f %f]\ngyro\t[%f %f %f]\nmagnet\t[%f %f %f]\n",
-            timestamp(wax9Packet->timestamp),
+    static Wax9LogMessage sPacket(WAX9_LOG_DEBUG, "\nWAX9\ntimestring:\t%T\ntimestamp:\t%f\npacket num:\t%u\naccel\t[%f %f %f]\ngyro\t[%f %f %f]\nmagnet\t[%f %f %f]\n");
+    Wax9Log::get().log(sPacket,
+            Wax9LogArg::ticks(ticks),
             wax9Packet->timestamp / 65536.0,
             wax9Packet->sampleNumber,
             wax9Packet->accel.x / 4096.0f, wax9Packet->accel.y / 4096.0f, wax9Packet->accel.z / 4096.0f,	// 'G' (9.81 m/s/s)
@@ -485,22 +1382,20 @@ unsigned long long Wax9::ticksNow(void)
     return (unsigned long long)tp.time * 1000 + tp.millitm;
 }
 
-/* Returns a date/time string for the specific number of milliseconds since the epoch */
-const char* Wax9::timestamp(unsigned long long ticks)
+/* Returns seconds on a monotonic clock, for timing samples on the host */
+double Wax9::getHostTime()
 {
-    static char output[] = "YYYY-MM-DD HH:MM:SS.fff";
-    output[0] = '\0';
-    
-    struct tm *today;
-    struct timeb tp = {0};
-    tp.time = (time_t)(ticks / 1000);
-    tp.millitm = (unsigned short)(ticks % 1000);
-    tzset();
-    today = localtime(&(tp.time));
-    if (strlen(output) != 0) { strcat(output, ","); }
-    sprintf(output + strlen(output), "%04d-%02d-%02d %02d:%02d:%02d.%03d", 1900 + today->tm_year, today->tm_mon + 1, today->tm_mday, today->tm_hour, today->tm_min, today->tm_sec, tp.millitm);
-    
-    return output;
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Log output, the app console needs a running Cinder app */
+std::ostream& Wax9::console()
+{
+#ifndef WAX9_HEADLESS
+    if (app::App::get()) return app::console();
+#endif
+    return std::cout;
 }
 
 // Gets the Euler angles in radians defined with the Aerospace sequence (psi, theta, phi).
@@ -518,14 +1413,13 @@ vec3 Wax9::QuaternionToEuler(const quat &q)
 // Conversion between coordinate systems
 // order as in: http://www.varesano.net/blog/fabio/ahrs-sensor-fusion-orientation-filter-3d-graphical-rotating-cube
 
+// rotate(-phi, z) * rotate(-theta, x) * rotate(-psi, y) of the Euler angles, which comes
+// down to reordering the components, see Wax9Orientation::toOpenGL()
+
 quat Wax9::AHRStoOpenGL(const quat &q)
 {
-    vec3 eul = QuaternionToEuler(q);
-    
-    mat4 sensorRotMat = glm::rotate(-eul.z, vec3(0, 0, 1));     // Z: phi (roll)
-    sensorRotMat *= glm::rotate(-eul.y, vec3(1, 0, 0));         // X: theta (pitch)
-    sensorRotMat *= glm::rotate(-eul.x, vec3(0, 1, 0));         // Y: psi (yaw)
-    
-    return quat(sensorRotMat);
+    quat r;
+    Wax9Orientation::toOpenGL(&q, 1, &r);
+    return r;
 }
 
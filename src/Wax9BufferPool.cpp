@@ -0,0 +1,79 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9BufferPool.h"
+
+#include <mutex>
+#include <vector>
+
+// function statics, so devices created during static initialization still find the pool
+static std::mutex& getMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<char *>& getFreeList()
+{
+    static std::vector<char *> buffers;
+    return buffers;
+}
+
+static size_t sNumAllocated = 0;
+
+char* Wax9BufferPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(getMutex());
+    std::vector<char *> &buffers = getFreeList();
+    if (buffers.empty()) {
+        sNumAllocated++;
+        return new char[WAX9_DECODE_BUFFER_SIZE];
+    }
+    char *buffer = buffers.back();
+    buffers.pop_back();
+    return buffer;
+}
+
+void Wax9BufferPool::release(char *buffer)
+{
+    if (buffer == NULL) return;
+    std::lock_guard<std::mutex> lock(getMutex());
+    getFreeList().push_back(buffer);
+}
+
+size_t Wax9BufferPool::getNumAllocated()
+{
+    std::lock_guard<std::mutex> lock(getMutex());
+    return sNumAllocated;
+}
+
+size_t Wax9BufferPool::getNumFree()
+{
+    std::lock_guard<std::mutex> lock(getMutex());
+    return getFreeList().size();
+}
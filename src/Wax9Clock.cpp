@@ -0,0 +1,150 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Clock.h"
+
+#include <limits>
+
+// timestamps further apart than this mean the device was reset or reconfigured
+#define WAX9_CLOCK_MAX_GAP  60.0
+
+// minimum span of the block minima before the drift is trusted
+#define WAX9_CLOCK_MIN_SPAN 10.0
+
+Wax9ClockMap::Wax9ClockMap(double blockSeconds, size_t numBlocks)
+{
+    mBlockSeconds = blockSeconds;
+    mNumBlocks = numBlocks > 1 ? numBlocks : 2;
+    reset();
+}
+
+void Wax9ClockMap::reset()
+{
+    bFirst = true;
+    mLastTimestamp = 0;
+    mDeviceTime = 0.0;
+    mNumResets = 0;
+    restart();
+}
+
+// forgets the clock relationship but keeps counting from the last timestamp
+void Wax9ClockMap::restart()
+{
+    mPoints.clear();
+    mNextPoint = 0;
+    mBlockStart = mDeviceTime;
+    mBlockMin = std::numeric_limits<double>::infinity();
+    mBlockMinTime = mDeviceTime;
+    mFitTime = mDeviceTime;
+    mFitOffset = 0.0;
+    mDrift = 0.0;
+    mExcessDelay = 0.0;
+}
+
+void Wax9ClockMap::add(uint32_t timestamp, double hostTime)
+{
+    if (bFirst) {
+        bFirst = false;
+        mDeviceTime = timestamp / 65536.0;
+        restart();
+    }
+    else {
+        double delta = (int32_t)(timestamp - mLastTimestamp) / 65536.0;
+        mDeviceTime += delta;
+        if (delta < -1.0 || delta > WAX9_CLOCK_MAX_GAP) {
+            mNumResets++;
+            restart();
+        }
+    }
+    mLastTimestamp = timestamp;
+
+    double offset = hostTime - mDeviceTime;
+    if (!mPoints.empty()) {
+        mExcessDelay += 0.05 * ((offset - getOffset(mDeviceTime)) - mExcessDelay);
+    }
+
+    if (offset < mBlockMin) {
+        mBlockMin = offset;
+        mBlockMinTime = mDeviceTime;
+    }
+    if (mDeviceTime - mBlockStart >= mBlockSeconds) {
+        Point point = { mBlockMinTime, mBlockMin };
+        if (mPoints.size() < mNumBlocks) mPoints.push_back(point);
+        else mPoints[mNextPoint] = point;
+        mNextPoint = (mNextPoint + 1) % mNumBlocks;
+        fit();
+
+        mBlockStart = mDeviceTime;
+        mBlockMin = std::numeric_limits<double>::infinity();
+    }
+}
+
+// least squares line through the block minima, centered on the newest one
+void Wax9ClockMap::fit()
+{
+    const Point &newest = mPoints[(mNextPoint + mNumBlocks - 1) % mNumBlocks];
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    double first = newest.deviceTime;
+    double minOffset = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < mPoints.size(); i++) {
+        double x = mPoints[i].deviceTime - newest.deviceTime;
+        double y = mPoints[i].offset;
+        sx += x; sy += y; sxx += x * x; sxy += x * y;
+        if (mPoints[i].deviceTime < first) first = mPoints[i].deviceTime;
+        if (y < minOffset) minOffset = y;
+    }
+
+    double n = (double)mPoints.size();
+    double det = n * sxx - sx * sx;
+    mFitTime = newest.deviceTime;
+    if (mPoints.size() >= 3 && newest.deviceTime - first >= WAX9_CLOCK_MIN_SPAN && det > 0.0) {
+        mDrift = (n * sxy - sx * sy) / det;
+        mFitOffset = (sy - mDrift * sx) / n;
+    }
+    else {
+        mDrift = 0.0;
+        mFitOffset = minOffset;
+    }
+}
+
+double Wax9ClockMap::getOffset(double deviceTime) const
+{
+    // until the first block is done, the lowest offset so far
+    if (mPoints.empty()) return mBlockMin;
+    return mFitOffset + mDrift * (deviceTime - mFitTime);
+}
+
+double Wax9ClockMap::toHostTime(double deviceTime) const
+{
+    return deviceTime + getOffset(deviceTime);
+}
+
+double Wax9ClockMap::toHostTime(uint32_t timestamp) const
+{
+    return toHostTime(mDeviceTime + (int32_t)(timestamp - mLastTimestamp) / 65536.0);
+}
@@ -0,0 +1,409 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Exporter.h"
+#include "Wax9Orientation.h"
+
+#include <cstring>
+#include <cmath>
+
+#define COLUMNAR_HEADER_SIZE    24
+#define COLUMN_DESC_SIZE        32
+#define CSV_MAX_FIELD           32      // longest formatted number, with margin
+#define SPILL_COPY_SIZE         (1 << 20)
+
+enum { TYPE_UINT32 = 0, TYPE_FLOAT, TYPE_DOUBLE };
+
+static const char* sColumnNames[Wax9Exporter::NUM_COLUMNS] = {
+    "sampleNumber", "timestamp", "hostTime",
+    "accX", "accY", "accZ", "gyrX", "gyrY", "gyrZ", "magX", "magY", "magZ",
+    "rotW", "rotX", "rotY", "rotZ", "psi", "theta", "phi"
+};
+
+static inline int getColumnType(int column)
+{
+    return column < 2 ? TYPE_UINT32 : (column == 2 ? TYPE_DOUBLE : TYPE_FLOAT);
+}
+
+static inline size_t getTypeSize(int type)
+{
+    return type == TYPE_DOUBLE ? 8 : 4;
+}
+
+// the float columns of a sample, in column order starting at accX
+static inline void getFloatColumns(const Wax9Sample &s, const vec3 &euler, float *out)
+{
+    out[0] = s.acc.x;       out[1] = s.acc.y;       out[2] = s.acc.z;
+    out[3] = s.gyr.x;       out[4] = s.gyr.y;       out[5] = s.gyr.z;
+    out[6] = s.mag.x;       out[7] = s.mag.y;       out[8] = s.mag.z;
+    out[9] = s.rotAHRS.w;   out[10] = s.rotAHRS.x;  out[11] = s.rotAHRS.y;  out[12] = s.rotAHRS.z;
+    out[13] = euler.x;      out[14] = euler.y;      out[15] = euler.z;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark number formatting
+/* -------------------------------------------------------------------------------------------------- */
+
+// Formats straight into the row buffer. Neither stdio nor iostreams: no locale, no allocations
+
+static const char sDigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static inline char* putUInt(char *p, uint64_t v)
+{
+    char tmp[20];
+    char *t = tmp + sizeof(tmp);
+    while (v >= 100) {
+        unsigned d = (unsigned)(v % 100);
+        v /= 100;
+        *--t = sDigitPairs[2 * d + 1];
+        *--t = sDigitPairs[2 * d];
+    }
+    if (v >= 10) {
+        *--t = sDigitPairs[2 * v + 1];
+        *--t = sDigitPairs[2 * v];
+    }
+    else {
+        *--t = (char)('0' + v);
+    }
+    size_t len = tmp + sizeof(tmp) - t;
+    memcpy(p, t, len);
+    return p + len;
+}
+
+// Fixed-point with D decimals. D is a template argument so every division is by a constant
+template <int D>
+static inline char* putFixed(char *p, double v, uint64_t scale)
+{
+    if (v != v) {
+        memcpy(p, "nan", 3);
+        return p + 3;
+    }
+    bool negative = v < 0;
+    double scaled = fabs(v) * (double)scale + 0.5;
+    if (scaled >= 1.8e19) {
+        // only reached by infinities and values no sensor produces
+        return p + snprintf(p, CSV_MAX_FIELD, "%.*g", D + 1, v);
+    }
+
+    uint64_t n = (uint64_t)scaled;
+    if (negative && n != 0) *p++ = '-';
+    uint64_t whole = n / scale;
+    uint32_t frac = (uint32_t)(n - whole * scale);
+
+    p = putUInt(p, whole);
+    if (D > 0) {
+        *p++ = '.';
+        int k = D;
+        for (; k >= 2; k -= 2) {
+            unsigned d = frac % 100;
+            frac /= 100;
+            p[k - 1] = sDigitPairs[2 * d + 1];
+            p[k - 2] = sDigitPairs[2 * d];
+        }
+        if (k == 1) p[0] = (char)('0' + frac);
+        p += D;
+    }
+    return p;
+}
+
+static inline char* putFixed(char *p, double v, int decimals)
+{
+    switch (decimals) {
+        case 0:  return putFixed<0>(p, v, 1ull);
+        case 1:  return putFixed<1>(p, v, 10ull);
+        case 2:  return putFixed<2>(p, v, 100ull);
+        case 3:  return putFixed<3>(p, v, 1000ull);
+        case 4:  return putFixed<4>(p, v, 10000ull);
+        case 5:  return putFixed<5>(p, v, 100000ull);
+        case 6:  return putFixed<6>(p, v, 1000000ull);
+        case 7:  return putFixed<7>(p, v, 10000000ull);
+        case 8:  return putFixed<8>(p, v, 100000000ull);
+        default: return putFixed<9>(p, v, 1000000000ull);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark constructors and setup
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Exporter::Wax9Exporter(Format format, int decimals)
+{
+    mFormat = format;
+    mDecimals = std::max(0, std::min(decimals, 9));
+    mFile = NULL;
+    bRunning = false;
+    bWriting = false;
+    mNumSamplesWritten = 0;
+    mNumBytesWritten = 0;
+}
+
+Wax9Exporter::~Wax9Exporter()
+{
+    close();
+}
+
+Wax9ExporterRef Wax9Exporter::create(const std::string &path, Format format, int decimals)
+{
+    Wax9ExporterRef exporter(new Wax9Exporter(format, decimals));
+    if (!exporter->open(path)) {
+        fprintf(stderr, "WARNING: Unable to export samples to %s\n", path.c_str());
+        return Wax9ExporterRef();
+    }
+    exporter->bRunning = true;
+    exporter->mThread = std::thread(&Wax9Exporter::threadedWrite, exporter.get());
+    return exporter;
+}
+
+const char* Wax9Exporter::getColumnName(int column)
+{
+    return (column >= 0 && column < NUM_COLUMNS) ? sColumnNames[column] : "";
+}
+
+bool Wax9Exporter::open(const std::string &path)
+{
+    mPath = path;
+    mFile = fopen(path.c_str(), "wb");
+    if (mFile == NULL) return false;
+
+    if (mFormat == FORMAT_CSV) {
+        std::string header;
+        for (int c = 0; c < NUM_COLUMNS; c++) {
+            header += sColumnNames[c];
+            header += (c + 1 < NUM_COLUMNS) ? ',' : '\n';
+        }
+        fwrite(header.data(), 1, header.size(), mFile);
+        mNumBytesWritten += header.size();
+        return true;
+    }
+
+    for (int c = 0; c < NUM_COLUMNS; c++) {
+        FILE *spill = fopen((path + "." + sColumnNames[c] + ".tmp").c_str(), "w+b");
+        if (spill == NULL) return false;
+        mColumnFiles.push_back(spill);
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark public interface
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Exporter::write(Wax9 &device)
+{
+    int numNew = device.getNumNewReadings();
+    if (numNew <= 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!bRunning) return;
+
+        // readings are stored newest first, queue them in arrival order
+        for (int i = numNew - 1; i >= 0; i--) mQueue.push_back(device.getReading(i));
+    }
+    mCondition.notify_one();
+}
+
+void Wax9Exporter::write(const Wax9Sample *samples, size_t count)
+{
+    if (count == 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!bRunning) return;
+        mQueue.insert(mQueue.end(), samples, samples + count);
+    }
+    mCondition.notify_one();
+}
+
+void Wax9Exporter::flush()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (!bRunning) return;
+    mCondition.notify_one();
+    while (!mQueue.empty() || bWriting) mDrained.wait(lock);
+
+    // the writer is idle until the next write()
+    if (mFile) fflush(mFile);
+    for (size_t c = 0; c < mColumnFiles.size(); c++) fflush(mColumnFiles[c]);
+}
+
+void Wax9Exporter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bRunning = false;
+    }
+    mCondition.notify_one();
+    if (mThread.joinable()) mThread.join();
+
+    if (mFormat == FORMAT_COLUMNAR && mFile) finishColumns();
+    for (size_t c = 0; c < mColumnFiles.size(); c++) {
+        fclose(mColumnFiles[c]);
+        remove((mPath + "." + sColumnNames[c] + ".tmp").c_str());
+    }
+    mColumnFiles.clear();
+
+    if (mFile) fclose(mFile);
+    mFile = NULL;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark writer thread
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Exporter::threadedWrite()
+{
+    std::vector<Wax9Sample> pending;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            bWriting = false;
+            mDrained.notify_all();
+
+            while (bRunning && mQueue.empty()) mCondition.wait(lock);
+            if (!bRunning && mQueue.empty()) return;
+
+            pending.swap(mQueue);
+            mQueue.clear();
+            bWriting = true;
+        }
+
+        if (mFormat == FORMAT_CSV) writeCsv(&pending[0], pending.size());
+        else writeColumns(&pending[0], pending.size());
+
+        mNumSamplesWritten += pending.size();
+        pending.clear();
+    }
+}
+
+void Wax9Exporter::writeCsv(const Wax9Sample *samples, size_t count)
+{
+    mBuffer.resize(count * NUM_COLUMNS * CSV_MAX_FIELD);
+    char *p = &mBuffer[0];
+    float values[NUM_COLUMNS - 3];
+
+    mEulers.resize(count);
+    Wax9Orientation::toEuler(&samples[0].rotAHRS, count, &mEulers[0], sizeof(Wax9Sample));
+
+    for (size_t i = 0; i < count; i++) {
+        const Wax9Sample &s = samples[i];
+        p = putUInt(p, s.sampleNumber);
+        *p++ = ',';
+        p = putUInt(p, s.timestamp);
+        *p++ = ',';
+        p = putFixed(p, s.hostTime, 6);
+
+        getFloatColumns(s, mEulers[i], values);
+        for (int c = 0; c < NUM_COLUMNS - 3; c++) {
+            *p++ = ',';
+            p = putFixed(p, values[c], mDecimals);
+        }
+        *p++ = '\n';
+    }
+
+    size_t len = p - &mBuffer[0];
+    fwrite(&mBuffer[0], 1, len, mFile);
+    mNumBytesWritten += len;
+}
+
+void Wax9Exporter::writeColumns(const Wax9Sample *samples, size_t count)
+{
+    // transpose the batch into one array per column, then append each to its spill file
+    mBuffer.resize(count * (8 + 4 * (NUM_COLUMNS - 1)));
+    double *hostTimes = (double *)&mBuffer[0];
+    uint32_t *sampleNumbers = (uint32_t *)(hostTimes + count);
+    uint32_t *timestamps = sampleNumbers + count;
+    float *floats = (float *)(timestamps + count);
+    float values[NUM_COLUMNS - 3];
+
+    mEulers.resize(count);
+    Wax9Orientation::toEuler(&samples[0].rotAHRS, count, &mEulers[0], sizeof(Wax9Sample));
+
+    for (size_t i = 0; i < count; i++) {
+        const Wax9Sample &s = samples[i];
+        sampleNumbers[i] = s.sampleNumber;
+        timestamps[i] = s.timestamp;
+        hostTimes[i] = s.hostTime;
+        getFloatColumns(s, mEulers[i], values);
+        for (int c = 0; c < NUM_COLUMNS - 3; c++) floats[c * count + i] = values[c];
+    }
+
+    fwrite(sampleNumbers, 4, count, mColumnFiles[0]);
+    fwrite(timestamps, 4, count, mColumnFiles[1]);
+    fwrite(hostTimes, 8, count, mColumnFiles[2]);
+    for (int c = 0; c < NUM_COLUMNS - 3; c++) fwrite(floats + c * count, 4, count, mColumnFiles[3 + c]);
+}
+
+static inline void putLE32(uint8_t *p, uint32_t v)  { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24); }
+static inline void putLE64(uint8_t *p, uint64_t v)  { putLE32(p, (uint32_t)v); putLE32(p + 4, (uint32_t)(v >> 32)); }
+
+void Wax9Exporter::finishColumns()
+{
+    uint64_t count = mNumSamplesWritten;
+    std::vector<uint8_t> header(COLUMNAR_HEADER_SIZE + NUM_COLUMNS * COLUMN_DESC_SIZE, 0);
+    memcpy(&header[0], "WAX9COL", 8);
+    putLE32(&header[8], WAX9_COLUMNAR_VERSION);
+    putLE32(&header[12], NUM_COLUMNS);
+    putLE64(&header[16], count);
+
+    uint64_t offset = (header.size() + 7) & ~7ull;
+    for (int c = 0; c < NUM_COLUMNS; c++) {
+        uint8_t *d = &header[COLUMNAR_HEADER_SIZE + c * COLUMN_DESC_SIZE];
+        strncpy((char *)d, sColumnNames[c], 16);
+        putLE32(d + 16, getColumnType(c));
+        putLE64(d + 24, offset);
+        offset += (count * getTypeSize(getColumnType(c)) + 7) & ~7ull;
+    }
+    fwrite(&header[0], 1, header.size(), mFile);
+    mNumBytesWritten += header.size();
+
+    // join the spill files, padding every array to 8 bytes
+    const char zeros[8] = { 0 };
+    size_t pad = (size_t)(((header.size() + 7) & ~7ull) - header.size());
+    mBuffer.resize(SPILL_COPY_SIZE);
+    for (int c = 0; c < NUM_COLUMNS; c++) {
+        fwrite(zeros, 1, pad, mFile);
+        mNumBytesWritten += pad;
+
+        FILE *spill = mColumnFiles[c];
+        fflush(spill);
+        fseek(spill, 0, SEEK_SET);
+        size_t n, size = 0;
+        while ((n = fread(&mBuffer[0], 1, mBuffer.size(), spill)) > 0) {
+            fwrite(&mBuffer[0], 1, n, mFile);
+            size += n;
+        }
+        mNumBytesWritten += size;
+        pad = (8 - size % 8) % 8;
+    }
+    fwrite(zeros, 1, pad, mFile);
+    mNumBytesWritten += pad;
+}
@@ -0,0 +1,322 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Log.h"
+
+#include <chrono>
+#include <ctime>
+#include <cstring>
+
+static double logTime()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark producers
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Log& Wax9Log::get()
+{
+    static Wax9Log log;
+    return log;
+}
+
+Wax9Log::Wax9Log()
+: mSlots(new Slot[WAX9_LOG_CAPACITY]), mHead(0), mTail(0), mNumLogged(0), mNumDropped(0), mNumSuppressed(0), bQuit(false)
+{
+    for (size_t i = 0; i < WAX9_LOG_CAPACITY; i++) {
+        mSlots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    mLevel = WAX9_LOG_DEBUG;
+    logTime();
+}
+
+Wax9Log::~Wax9Log()
+{
+    if (mThread.joinable()) {
+        bQuit = true;
+        mCondition.notify_all();
+        mThread.join();
+    }
+}
+
+bool Wax9Log::allow(Wax9LogMessage &message, double hostTime, uint32_t &suppressed)
+{
+    suppressed = 0;
+    if (message.maxRate <= 0.0f) return true;
+
+    // fixed windows of one second, or longer for less than one event per second
+    double length = message.maxRate >= 1.0f ? 1.0 : 1.0 / message.maxRate;
+    uint32_t limit = message.maxRate >= 1.0f ? (uint32_t)message.maxRate : 1;
+    int64_t window = (int64_t)(hostTime / length) + 1;
+
+    int64_t current = message.window.load(std::memory_order_relaxed);
+    if (current != window && message.window.compare_exchange_strong(current, window)) {
+        message.count.store(0, std::memory_order_relaxed);
+    }
+    if (message.count.fetch_add(1, std::memory_order_relaxed) >= limit) {
+        message.suppressed.fetch_add(1, std::memory_order_relaxed);
+        mNumSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    suppressed = message.suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+bool Wax9Log::log(Wax9LogMessage &message, Wax9LogArg a0, Wax9LogArg a1, Wax9LogArg a2, Wax9LogArg a3, Wax9LogArg a4, Wax9LogArg a5,
+                  Wax9LogArg a6, Wax9LogArg a7, Wax9LogArg a8, Wax9LogArg a9, Wax9LogArg a10, Wax9LogArg a11)
+{
+    if (message.level < mLevel.load(std::memory_order_relaxed)) return false;
+
+    double time = logTime();
+    uint32_t suppressed;
+    if (!allow(message, time, suppressed)) return false;
+
+    std::call_once(mStarted, &Wax9Log::start, this);
+
+    // claim a slot, it's free when its sequence number matches our position
+    uint64_t pos = mHead.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &mSlots[pos & (WAX9_LOG_CAPACITY - 1)];
+        int64_t diff = (int64_t)slot->seq.load(std::memory_order_acquire) - (int64_t)pos;
+        if (diff == 0) {
+            if (mHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if (diff < 0) {
+            // full, the formatter is behind
+            mNumDropped.fetch_add(1, std::memory_order_relaxed);
+            message.suppressed.fetch_add(suppressed, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            pos = mHead.load(std::memory_order_relaxed);
+        }
+    }
+
+    const Wax9LogArg *args[WAX9_LOG_MAX_ARGS] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8, &a9, &a10, &a11 };
+    Wax9LogEvent &e = slot->event;
+    e.message = &message;
+    e.hostTime = time;
+    e.suppressed = suppressed;
+    e.numArgs = 0;
+    while (e.numArgs < WAX9_LOG_MAX_ARGS && args[e.numArgs]->type != Wax9LogArg::NONE) {
+        e.types[e.numArgs] = (uint8_t)args[e.numArgs]->type;
+        e.args[e.numArgs].i = args[e.numArgs]->i;
+        e.numArgs++;
+    }
+
+    slot->seq.store(pos + 1, std::memory_order_release);
+    mNumLogged.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Wax9Log::setSink(const Sink &sink)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSink = sink;
+}
+
+void Wax9Log::flush()
+{
+    if (!mThread.joinable()) return;
+
+    uint64_t target = mHead.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.notify_all();
+    mDrained.wait(lock, [&] { return mTail.load(std::memory_order_acquire) >= target || bQuit; });
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark formatting thread
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Log::start()
+{
+    mThread = std::thread(&Wax9Log::run, this);
+}
+
+void Wax9Log::run()
+{
+    while (!bQuit) {
+        drain();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait_for(lock, std::chrono::milliseconds(20));
+    }
+    drain();
+}
+
+size_t Wax9Log::drain()
+{
+    size_t count = 0;
+    std::string text;
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    while (true) {
+        Slot &slot = mSlots[tail & (WAX9_LOG_CAPACITY - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1) break;
+
+        // copy out and free the slot before the slow part
+        Wax9LogEvent event = slot.event;
+        slot.seq.store(tail + WAX9_LOG_CAPACITY, std::memory_order_release);
+        tail++;
+
+        text = format(event);
+        if (mSink) mSink(event, text);
+        else print(event, text);
+        count++;
+    }
+
+    mTail.store(tail, std::memory_order_release);
+    mDrained.notify_all();
+    return count;
+}
+
+void Wax9Log::print(const Wax9LogEvent &event, const std::string &text)
+{
+    FILE *out = event.message->level == WAX9_LOG_WARNING ? stderr : stdout;
+    fputs(text.c_str(), out);
+    if (text.empty() || text[text.size() - 1] != '\n') fputc('\n', out);
+}
+
+static void appendTicks(std::string &text, unsigned long long ticks)
+{
+    char buffer[64];
+    time_t seconds = (time_t)(ticks / 1000);
+    struct tm today;
+#ifdef _WIN32
+    localtime_s(&today, &seconds);
+#else
+    localtime_r(&seconds, &today);
+#endif
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d.%03d", 1900 + today.tm_year, today.tm_mon + 1, today.tm_mday,
+             today.tm_hour, today.tm_min, today.tm_sec, (int)(ticks % 1000));
+    text += buffer;
+}
+
+std::string Wax9Log::format(const Wax9LogEvent &event)
+{
+    std::string text;
+    const char *f = event.message->format;
+    int arg = 0;
+    char spec[32], buffer[128];
+
+    while (*f) {
+        if (*f != '%') {
+            text += *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            text += '%';
+            f += 2;
+            continue;
+        }
+
+        // flags, width and precision are kept, length modifiers are replaced by our own
+        size_t n = 0;
+        spec[n++] = *f++;
+        while (*f && strchr("-+ #0123456789.*", *f) && n < sizeof(spec) - 8) {
+            if (*f != '*') {
+                spec[n++] = *f++;
+                continue;
+            }
+
+            // a '*' takes its value from the logged arguments, snprintf only sees a literal
+            f++;
+            long long v = 0;
+            if (arg < event.numArgs) {
+                v = (event.types[arg] == Wax9LogArg::FLOAT) ? (long long)event.args[arg].d : event.args[arg].i;
+                arg++;
+            }
+            bool precision = (spec[n - 1] == '.');
+            if (precision && v < 0) {
+                n--;                                // negative precision means none
+                continue;
+            }
+            if (v < -99) v = -99;
+            if (v > 99) v = 99;
+            n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)v);
+        }
+        while (*f && strchr("hlLqjzt", *f)) f++;
+        char conversion = *f ? *f++ : 's';
+
+        if (arg >= event.numArgs) {
+            text += "<?>";
+            continue;
+        }
+        int type = event.types[arg];
+        long long i = event.args[arg].i;
+        double d = event.args[arg].d;
+        const char *s = event.args[arg].s;
+        arg++;
+
+        if (conversion == 'T' || type == Wax9LogArg::TICKS) {
+            appendTicks(text, (unsigned long long)i);
+            continue;
+        }
+
+        if (strchr("diouxXc", conversion)) {
+            if (type == Wax9LogArg::FLOAT) i = (long long)d;
+            if (conversion != 'c') { spec[n++] = 'l'; spec[n++] = 'l'; }
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            if (conversion == 'c') snprintf(buffer, sizeof(buffer), spec, (int)i);
+            else snprintf(buffer, sizeof(buffer), spec, i);
+        }
+        else if (strchr("fFeEgGaA", conversion)) {
+            if (type == Wax9LogArg::INT) d = (double)i;
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            snprintf(buffer, sizeof(buffer), spec, d);
+        }
+        else if (type == Wax9LogArg::STRING) {
+            spec[n++] = 's';
+            spec[n] = '\0';
+            snprintf(buffer, sizeof(buffer), spec, s ? s : "(null)");
+        }
+        else if (type == Wax9LogArg::INT) {
+            snprintf(buffer, sizeof(buffer), "%lld", i);
+        }
+        else {
+            snprintf(buffer, sizeof(buffer), "%g", d);
+        }
+        text += buffer;
+    }
+
+    if (event.suppressed > 0) {
+        bool newline = !text.empty() && text[text.size() - 1] == '\n';
+        if (newline) text.erase(text.size() - 1);
+        snprintf(buffer, sizeof(buffer), " (%u similar suppressed)", event.suppressed);
+        text += buffer;
+        if (newline) text += '\n';
+    }
+    return text;
+}
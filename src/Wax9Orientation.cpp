@@ -0,0 +1,246 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Orientation.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define WAX9_HAS_SSE2
+#endif
+
+using namespace ci;
+
+// minimax fit of atan(x) on [0, 1] in odd powers, error 3.8e-8
+#define WAX9_ATAN_C1    0.9999993359f
+#define WAX9_ATAN_C3   -0.3332986185f
+#define WAX9_ATAN_C5    0.1994657691f
+#define WAX9_ATAN_C7   -0.1390868234f
+#define WAX9_ATAN_C9    0.09642324833f
+#define WAX9_ATAN_C11  -0.05591398009f
+#define WAX9_ATAN_C13   0.02186405148f
+#define WAX9_ATAN_C15  -0.004054856929f
+
+#define WAX9_HALF_PI    1.5707963268f
+#define WAX9_PI         3.1415926536f
+
+static inline const quat& quatAt(const quat *q, size_t i, size_t stride)
+{
+    return *(const quat *)((const char *)q + i * stride);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark scalar
+/* -------------------------------------------------------------------------------------------------- */
+
+static inline float atanUnit(float a)
+{
+    float a2 = a * a;
+    float p = WAX9_ATAN_C15;
+    p = p * a2 + WAX9_ATAN_C13;
+    p = p * a2 + WAX9_ATAN_C11;
+    p = p * a2 + WAX9_ATAN_C9;
+    p = p * a2 + WAX9_ATAN_C7;
+    p = p * a2 + WAX9_ATAN_C5;
+    p = p * a2 + WAX9_ATAN_C3;
+    p = p * a2 + WAX9_ATAN_C1;
+    return p * a;
+}
+
+float Wax9Orientation::atan2(float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float hi = ax > ay ? ax : ay;
+    float lo = ax > ay ? ay : ax;
+    float r = hi > 0.0f ? atanUnit(lo / hi) : 0.0f;
+    if (ay > ax) r = WAX9_HALF_PI - r;
+    if (x < 0.0f) r = WAX9_PI - r;
+    return y < 0.0f ? -r : r;
+}
+
+float Wax9Orientation::asin(float x)
+{
+    x = x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x);
+    return atan2(x, sqrtf((1.0f - x) * (1.0f + x)));
+}
+
+static inline vec3 eulerOf(const quat &q)
+{
+    return vec3( Wax9Orientation::atan2(2 * q.x * q.y - 2 * q.w * q.z, 2 * q.w * q.w + 2 * q.x * q.x - 1),
+                -Wax9Orientation::asin(2 * q.x * q.z + 2 * q.w * q.y),
+                 Wax9Orientation::atan2(2 * q.y * q.z - 2 * q.w * q.x, 2 * q.w * q.w + 2 * q.z * q.z - 1) );
+}
+
+static inline void matrixOf(const quat &q, mat3 &m)
+{
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    m[0][0] = 1 - 2 * (yy + zz);    m[0][1] = 2 * (xy + wz);        m[0][2] = 2 * (xz - wy);
+    m[1][0] = 2 * (xy - wz);        m[1][1] = 1 - 2 * (xx + zz);    m[1][2] = 2 * (yz + wx);
+    m[2][0] = 2 * (xz + wy);        m[2][1] = 2 * (yz - wx);        m[2][2] = 1 - 2 * (xx + yy);
+}
+
+static inline void axisAngleOf(const quat &q, vec3 &axis, float &angle)
+{
+    float s = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z);
+    angle = 2.0f * Wax9Orientation::atan2(s, q.w);
+    axis = s > 1e-12f ? vec3(q.x, q.y, q.z) / s : vec3(0, 0, 1);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark sse2
+/* -------------------------------------------------------------------------------------------------- */
+
+#ifdef WAX9_HAS_SSE2
+
+// one component of four quaternions
+#define WAX9_GATHER(q, i, stride, c) _mm_setr_ps(quatAt(q, i, stride).c, quatAt(q, i + 1, stride).c, quatAt(q, i + 2, stride).c, quatAt(q, i + 3, stride).c)
+
+static inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Estrin's scheme, the four independent pairs keep the pipeline fuller than Horner's
+static inline __m128 atanUnit(__m128 a)
+{
+    __m128 a2 = _mm_mul_ps(a, a);
+    __m128 a4 = _mm_mul_ps(a2, a2);
+    __m128 a8 = _mm_mul_ps(a4, a4);
+    __m128 p01 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(WAX9_ATAN_C3), a2), _mm_set1_ps(WAX9_ATAN_C1));
+    __m128 p23 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(WAX9_ATAN_C7), a2), _mm_set1_ps(WAX9_ATAN_C5));
+    __m128 p45 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(WAX9_ATAN_C11), a2), _mm_set1_ps(WAX9_ATAN_C9));
+    __m128 p67 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(WAX9_ATAN_C15), a2), _mm_set1_ps(WAX9_ATAN_C13));
+    __m128 p03 = _mm_add_ps(_mm_mul_ps(p23, a4), p01);
+    __m128 p47 = _mm_add_ps(_mm_mul_ps(p67, a4), p45);
+    return _mm_mul_ps(_mm_add_ps(_mm_mul_ps(p47, a8), p03), a);
+}
+
+static inline __m128 atan2Sse(__m128 y, __m128 x)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 ax = _mm_andnot_ps(sign, x);
+    __m128 ay = _mm_andnot_ps(sign, y);
+    __m128 hi = _mm_max_ps(ax, ay);
+    __m128 lo = _mm_min_ps(ax, ay);
+    __m128 r = atanUnit(_mm_and_ps(_mm_div_ps(lo, hi), _mm_cmpgt_ps(hi, zero)));   // 0 for 0 / 0
+    r = select(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(WAX9_HALF_PI), r), r);
+    r = select(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(WAX9_PI), r), r);
+    return select(_mm_cmplt_ps(y, zero), _mm_xor_ps(r, sign), r);
+}
+
+static inline __m128 asinSse(__m128 x)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), one);
+    return atan2Sse(x, _mm_sqrt_ps(_mm_mul_ps(_mm_sub_ps(one, x), _mm_add_ps(one, x))));
+}
+
+#endif
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark batches
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Orientation::toEuler(const quat *q, size_t count, vec3 *euler, size_t stride)
+{
+    size_t i = 0;
+#ifdef WAX9_HAS_SSE2
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    float psi[4], theta[4], phi[4];
+    for (; i + 4 <= count; i += 4) {
+        __m128 w = WAX9_GATHER(q, i, stride, w), x = WAX9_GATHER(q, i, stride, x);
+        __m128 y = WAX9_GATHER(q, i, stride, y), z = WAX9_GATHER(q, i, stride, z);
+        __m128 ww = _mm_mul_ps(w, w);
+        
+        __m128 psiY = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(x, y), _mm_mul_ps(w, z)));
+        __m128 psiX = _mm_sub_ps(_mm_mul_ps(two, _mm_add_ps(ww, _mm_mul_ps(x, x))), one);
+        __m128 sinTheta = _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(x, z), _mm_mul_ps(w, y)));
+        __m128 phiY = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(y, z), _mm_mul_ps(w, x)));
+        __m128 phiX = _mm_sub_ps(_mm_mul_ps(two, _mm_add_ps(ww, _mm_mul_ps(z, z))), one);
+        
+        _mm_storeu_ps(psi, atan2Sse(psiY, psiX));
+        _mm_storeu_ps(theta, _mm_xor_ps(asinSse(sinTheta), sign));
+        _mm_storeu_ps(phi, atan2Sse(phiY, phiX));
+        for (int k = 0; k < 4; k++) euler[i + k] = vec3(psi[k], theta[k], phi[k]);
+    }
+#endif
+    for (; i < count; i++) euler[i] = eulerOf(quatAt(q, i, stride));
+}
+
+void Wax9Orientation::toMatrix(const quat *q, size_t count, mat3 *matrices, size_t stride)
+{
+    // no trigonometry, the compiler does as well with the scalar version
+    for (size_t i = 0; i < count; i++) matrixOf(quatAt(q, i, stride), matrices[i]);
+}
+
+void Wax9Orientation::toAxisAngle(const quat *q, size_t count, vec3 *axes, float *angles, size_t stride)
+{
+    size_t i = 0;
+#ifdef WAX9_HAS_SSE2
+    const __m128 epsilon = _mm_set1_ps(1e-12f), two = _mm_set1_ps(2.0f);
+    float ax[4], ay[4], az[4];
+    for (; i + 4 <= count; i += 4) {
+        __m128 w = WAX9_GATHER(q, i, stride, w), x = WAX9_GATHER(q, i, stride, x);
+        __m128 y = WAX9_GATHER(q, i, stride, y), z = WAX9_GATHER(q, i, stride, z);
+        __m128 s = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        _mm_storeu_ps(angles + i, _mm_mul_ps(two, atan2Sse(s, w)));
+        
+        __m128 rotates = _mm_cmpgt_ps(s, epsilon);
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_max_ps(s, epsilon));
+        _mm_storeu_ps(ax, _mm_and_ps(rotates, _mm_mul_ps(x, inv)));
+        _mm_storeu_ps(ay, _mm_and_ps(rotates, _mm_mul_ps(y, inv)));
+        _mm_storeu_ps(az, select(rotates, _mm_mul_ps(z, inv), _mm_set1_ps(1.0f)));
+        for (int k = 0; k < 4; k++) axes[i + k] = vec3(ax[k], ay[k], az[k]);
+    }
+#endif
+    for (; i < count; i++) axisAngleOf(quatAt(q, i, stride), axes[i], angles[i]);
+}
+
+// The Euler round trip composes Rz(-phi) Rx(-theta) Ry(-psi) from psi, theta and phi about
+// z, y and x, which is the same rotation with its axes renamed. The sign follows glm's
+// matrix to quaternion conversion, which makes the largest component positive
+void Wax9Orientation::toOpenGL(const quat *q, size_t count, quat *out, size_t stride, size_t outStride)
+{
+    for (size_t i = 0; i < count; i++) {
+        const quat &in = quatAt(q, i, stride);
+        quat r(in.w, in.y, in.z, in.x);
+        
+        float biggest = r.w;
+        biggest = fabsf(r.x) > fabsf(biggest) ? r.x : biggest;
+        biggest = fabsf(r.y) > fabsf(biggest) ? r.y : biggest;
+        biggest = fabsf(r.z) > fabsf(biggest) ? r.z : biggest;
+        r = r * (biggest < 0.0f ? -1.0f : 1.0f);
+        
+        *(quat *)((char *)out + i * outStride) = r;
+    }
+}
@@ -0,0 +1,344 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "ws2_32.lib")
+    typedef int socklen_t;
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netdb.h>
+    #include <unistd.h>
+#endif
+
+#include "Wax9Publisher.h"
+
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+#define OSC_HEADER_SIZE     40      // "#bundle" + timetag + "/wax9/seq ,i" element
+#define OSC_SAMPLE_SIZE     112     // "/wax9/sample" element including its size prefix
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark byte packing
+/* -------------------------------------------------------------------------------------------------- */
+
+static inline char* putLE16(char *p, uint16_t v)   { p[0] = (char)v; p[1] = (char)(v >> 8); return p + 2; }
+static inline char* putLE32(char *p, uint32_t v)   { p[0] = (char)v; p[1] = (char)(v >> 8); p[2] = (char)(v >> 16); p[3] = (char)(v >> 24); return p + 4; }
+static inline char* putLE64(char *p, uint64_t v)   { putLE32(p, (uint32_t)v); return putLE32(p + 4, (uint32_t)(v >> 32)); }
+static inline char* putBE32(char *p, uint32_t v)   { p[0] = (char)(v >> 24); p[1] = (char)(v >> 16); p[2] = (char)(v >> 8); p[3] = (char)v; return p + 4; }
+static inline char* putBE64(char *p, uint64_t v)   { putBE32(p, (uint32_t)(v >> 32)); return putBE32(p + 4, (uint32_t)v); }
+
+static inline uint32_t floatBits(float f)   { uint32_t u; memcpy(&u, &f, 4); return u; }
+static inline uint64_t doubleBits(double d) { uint64_t u; memcpy(&u, &d, 8); return u; }
+
+static inline short quantize(float v, float scale)
+{
+    float q = floorf(v * scale + 0.5f);
+    return (short)(q > 32767.0f ? 32767 : (q < -32768.0f ? -32768 : q));
+}
+
+// writes a null-terminated string padded to a multiple of 4 bytes, as OSC expects
+static inline char* putOscString(char *p, const char *str, size_t len)
+{
+    size_t padded = (len + 4) & ~(size_t)3;
+    memcpy(p, str, len);
+    memset(p + len, 0, padded - len);
+    return p + padded;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark constructors and setup
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Publisher::Wax9Publisher(Format format, size_t mtu)
+{
+    mFormat = format;
+    mMtu = mtu;
+    mMaxLatency = 0.0;
+    mQueueStart = 0.0;
+    mSequence = 0;
+    mNumSamplesSent = 0;
+    mNumDatagramsSent = 0;
+    mNumSendErrors = 0;
+
+    mSocket = -1;
+    bRunning = false;
+
+#ifdef _WIN32
+    bWinsock = false;
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        fprintf(stderr, "ERROR: Wax9Publisher unable to initialize Winsock\n");
+        return;
+    }
+    bWinsock = true;
+#endif
+
+    // INVALID_SOCKET and -1 both end up negative here
+    mSocket = (intptr_t)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (mSocket < 0) {
+        fprintf(stderr, "ERROR: Wax9Publisher unable to create a UDP socket\n");
+        return;
+    }
+
+    bRunning = true;
+    mThread = std::thread(&Wax9Publisher::threadedSend, this);
+}
+
+Wax9Publisher::~Wax9Publisher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bRunning = false;
+    }
+    mCondition.notify_one();
+    if (mThread.joinable()) mThread.join();
+
+#ifdef _WIN32
+    if (mSocket >= 0) closesocket((SOCKET)mSocket);
+    if (bWinsock) WSACleanup();
+#else
+    if (mSocket >= 0) close((int)mSocket);
+#endif
+}
+
+bool Wax9Publisher::addDestination(const std::string &host, uint16_t port)
+{
+    if (!isOpen()) return false;
+
+    struct addrinfo hints, *result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || result == NULL) {
+        fprintf(stderr, "WARNING: Wax9Publisher unable to resolve %s\n", host.c_str());
+        return false;
+    }
+
+    std::vector<char> addr((char *)result->ai_addr, (char *)result->ai_addr + result->ai_addrlen);
+    freeaddrinfo(result);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDestinations.push_back(addr);
+    return true;
+}
+
+void Wax9Publisher::clearDestinations()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDestinations.clear();
+}
+
+size_t Wax9Publisher::getSamplesPerDatagram() const
+{
+    if (mFormat == FORMAT_BINARY) {
+        return std::max<size_t>(1, std::min<size_t>(255, (mMtu - BINARY_HEADER_SIZE) / BINARY_SAMPLE_SIZE));
+    }
+    return std::max<size_t>(1, (mMtu - OSC_HEADER_SIZE) / OSC_SAMPLE_SIZE);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark public interface
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Publisher::publish(Wax9 &device, uint8_t deviceId)
+{
+    int numNew = device.getNumNewReadings();
+    if (numNew <= 0 || !isOpen()) return;
+
+    size_t queued;
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        first = mQueue.empty();
+        if (first) mQueueStart = Wax9::getHostTime();
+
+        // readings are stored newest first, queue them in arrival order
+        for (int i = numNew - 1; i >= 0; i--) {
+            QueuedSample q;
+            q.deviceId = deviceId;
+            q.sample = device.getReading(i);
+            mQueue.push_back(q);
+        }
+        queued = mQueue.size();
+    }
+    // the first sample starts the sender's latency timer
+    if (first || mMaxLatency <= 0.0 || queued >= getSamplesPerDatagram()) mCondition.notify_one();
+}
+
+void Wax9Publisher::publish(const Wax9Sample &sample, uint8_t deviceId)
+{
+    if (!isOpen()) return;
+
+    size_t queued;
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        first = mQueue.empty();
+        if (first) mQueueStart = Wax9::getHostTime();
+
+        QueuedSample q;
+        q.deviceId = deviceId;
+        q.sample = sample;
+        mQueue.push_back(q);
+        queued = mQueue.size();
+    }
+    // the first sample starts the sender's latency timer
+    if (first || mMaxLatency <= 0.0 || queued >= getSamplesPerDatagram()) mCondition.notify_one();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark sender thread
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Publisher::threadedSend()
+{
+    std::vector<QueuedSample> pending;
+    std::vector<std::vector<char> > destinations;
+    std::vector<char> datagram(std::max<size_t>(mMtu, OSC_HEADER_SIZE + OSC_SAMPLE_SIZE));
+    size_t perDatagram = getSamplesPerDatagram();
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            // wait until a datagram is full or the oldest sample has waited long enough
+            while (bRunning) {
+                if (mQueue.size() >= perDatagram) break;
+                if (!mQueue.empty()) {
+                    double waited = Wax9::getHostTime() - mQueueStart;
+                    if (waited >= mMaxLatency) break;
+                    mCondition.wait_for(lock, std::chrono::duration<double>(mMaxLatency - waited));
+                }
+                else {
+                    mCondition.wait(lock);
+                }
+            }
+            if (!bRunning && mQueue.empty()) return;
+
+            pending.swap(mQueue);
+            mQueue.clear();
+            destinations = mDestinations;
+        }
+
+        // pack and send
+        size_t sent = 0;
+        while (sent < pending.size()) {
+            size_t count = std::min(perDatagram, pending.size() - sent);
+            size_t len = (mFormat == FORMAT_BINARY) ? writeBinary(&pending[sent], count, &datagram[0])
+                                                    : writeOsc(&pending[sent], count, &datagram[0]);
+            send(&datagram[0], len, destinations);
+            sent += count;
+        }
+        mNumSamplesSent += pending.size();
+        pending.clear();
+    }
+}
+
+size_t Wax9Publisher::writeBinary(const QueuedSample *samples, size_t count, char *out)
+{
+    char *p = out;
+    *p++ = 'W';
+    *p++ = '9';
+    *p++ = 1;
+    *p++ = (char)count;
+    p = putLE32(p, mSequence++);
+
+    for (size_t i = 0; i < count; i++) {
+        const Wax9Sample &s = samples[i].sample;
+        *p++ = (char)samples[i].deviceId;
+        *p++ = 0;
+        p = putLE16(p, s.sampleNumber);
+        p = putLE32(p, s.timestamp);
+        p = putLE64(p, doubleBits(s.hostTime));
+
+        // back to the sensor units, which is where the values came from in the first place
+        const float gyrScale = 1.0f / toRadians(0.07f);
+        for (int k = 0; k < 3; k++) p = putLE16(p, (uint16_t)quantize(s.acc[k], 4096.0f));
+        for (int k = 0; k < 3; k++) p = putLE16(p, (uint16_t)quantize(s.gyr[k], gyrScale));
+        for (int k = 0; k < 3; k++) p = putLE16(p, (uint16_t)quantize(s.mag[k], 10.0f));
+        p = putLE16(p, (uint16_t)quantize(s.rotOGL.w, 32767.0f));
+        p = putLE16(p, (uint16_t)quantize(s.rotOGL.x, 32767.0f));
+        p = putLE16(p, (uint16_t)quantize(s.rotOGL.y, 32767.0f));
+        p = putLE16(p, (uint16_t)quantize(s.rotOGL.z, 32767.0f));
+    }
+    return p - out;
+}
+
+size_t Wax9Publisher::writeOsc(const QueuedSample *samples, size_t count, char *out)
+{
+    char *p = out;
+    p = putOscString(p, "#bundle", 7);
+    p = putBE64(p, 1);                              // timetag "immediately"
+
+    // sequence message
+    p = putBE32(p, 20);
+    p = putOscString(p, "/wax9/seq", 9);
+    p = putOscString(p, ",i", 2);
+    p = putBE32(p, mSequence++);
+
+    for (size_t i = 0; i < count; i++) {
+        const Wax9Sample &s = samples[i].sample;
+        p = putBE32(p, OSC_SAMPLE_SIZE - 4);
+        p = putOscString(p, "/wax9/sample", 12);
+        p = putOscString(p, ",iiidfffffffffffff", 18);
+        p = putBE32(p, samples[i].deviceId);
+        p = putBE32(p, s.sampleNumber);
+        p = putBE32(p, s.timestamp);
+        p = putBE64(p, doubleBits(s.hostTime));
+        for (int k = 0; k < 3; k++) p = putBE32(p, floatBits(s.acc[k]));
+        for (int k = 0; k < 3; k++) p = putBE32(p, floatBits(s.gyr[k]));
+        for (int k = 0; k < 3; k++) p = putBE32(p, floatBits(s.mag[k]));
+        p = putBE32(p, floatBits(s.rotOGL.w));
+        p = putBE32(p, floatBits(s.rotOGL.x));
+        p = putBE32(p, floatBits(s.rotOGL.y));
+        p = putBE32(p, floatBits(s.rotOGL.z));
+    }
+    return p - out;
+}
+
+void Wax9Publisher::send(const char *data, size_t len, const std::vector<std::vector<char> > &destinations)
+{
+    for (size_t i = 0; i < destinations.size(); i++) {
+        const std::vector<char> &addr = destinations[i];
+#ifdef _WIN32
+        int result = sendto((SOCKET)mSocket, data, (int)len, 0, (const sockaddr *)&addr[0], (socklen_t)addr.size());
+#else
+        ssize_t result = sendto((int)mSocket, data, len, 0, (const sockaddr *)&addr[0], (socklen_t)addr.size());
+#endif
+        if (result < 0) mNumSendErrors++;
+    }
+    mNumDatagramsSent++;
+}
@@ -0,0 +1,93 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9RateController.h"
+
+Wax9RateController::Wax9RateController()
+{
+    mSettings = getDefaultSettings();
+    reset();
+}
+
+Wax9RateSettings Wax9RateController::getDefaultSettings(int motionRate)
+{
+    Wax9RateSettings settings;
+    settings.stillRate = 20;
+    settings.motionRate = motionRate;
+    settings.motionGyro = 10.0f;    // well above the bias left after calibration
+    settings.stillGyro = 4.0f;
+    settings.motionAcc = 0.08f;
+    settings.stillAcc = 0.03f;
+    settings.stillTime = 2.0f;
+    settings.minInterval = 1.0f;
+    return settings;
+}
+
+void Wax9RateController::setSettings(const Wax9RateSettings &settings)
+{
+    mSettings = settings;
+    mRate = bMoving ? mSettings.motionRate : mSettings.stillRate;
+}
+
+void Wax9RateController::reset()
+{
+    bMoving = true;
+    mRate = mSettings.motionRate;
+    mStillSince = -1.0;
+    mLastChange = -1.0e9;
+    mNumChanges = 0;
+}
+
+int Wax9RateController::update(float gyro, float acc, double hostTime)
+{
+    bool motion = gyro > mSettings.motionGyro || acc > mSettings.motionAcc;
+    bool still = gyro < mSettings.stillGyro && acc < mSettings.stillAcc;
+
+    if (motion) {
+        bMoving = true;
+        mStillSince = -1.0;
+    }
+    else if (!still) {
+        // in between, moving devices keep waiting and still ones stay still
+        mStillSince = -1.0;
+    }
+    else if (mStillSince < 0.0) {
+        mStillSince = hostTime;
+    }
+
+    if (bMoving && mStillSince >= 0.0 && hostTime - mStillSince >= mSettings.stillTime) bMoving = false;
+
+    // speeding up can't wait, slowing down can
+    int rate = bMoving ? mSettings.motionRate : mSettings.stillRate;
+    if (rate != mRate && (rate > mRate || hostTime - mLastChange >= mSettings.minInterval)) {
+        mRate = rate;
+        mLastChange = hostTime;
+        mNumChanges++;
+    }
+    return mRate;
+}
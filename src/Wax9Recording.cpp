@@ -0,0 +1,1148 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Recording.h"
+
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+
+#define CHUNK_MAGIC         0x4B433957      // "W9CK"
+#define NUM_CHANNELS        16
+#define BLOCK_SIZE          128
+
+// channel modes, picked per chunk by whichever is smallest
+enum
+{
+    MODE_CONSTANT = 0,      // first value only
+    MODE_LINEAR,            // first value and a constant delta
+    MODE_DELTA_VARINT,
+    MODE_DELTA2_VARINT,
+    MODE_DELTA_PACKED,
+    MODE_DELTA2_PACKED
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark channels
+/* -------------------------------------------------------------------------------------------------- */
+
+static const int sChannelBits[NUM_CHANNELS] = { 16, 32, 64, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 32, 8 };
+
+// where each channel is stored in a recorded packet, so decoding can write fields directly
+static const size_t sChannelOffsets[NUM_CHANNELS] = {
+    offsetof(Wax9RecordedPacket, packet.sampleNumber),
+    offsetof(Wax9RecordedPacket, packet.timestamp),
+    offsetof(Wax9RecordedPacket, ticks),
+    offsetof(Wax9RecordedPacket, packet.accel.x),
+    offsetof(Wax9RecordedPacket, packet.accel.y),
+    offsetof(Wax9RecordedPacket, packet.accel.z),
+    offsetof(Wax9RecordedPacket, packet.gyro.x),
+    offsetof(Wax9RecordedPacket, packet.gyro.y),
+    offsetof(Wax9RecordedPacket, packet.gyro.z),
+    offsetof(Wax9RecordedPacket, packet.mag.x),
+    offsetof(Wax9RecordedPacket, packet.mag.y),
+    offsetof(Wax9RecordedPacket, packet.mag.z),
+    offsetof(Wax9RecordedPacket, packet.battery),
+    offsetof(Wax9RecordedPacket, packet.temperature),
+    offsetof(Wax9RecordedPacket, packet.pressure),
+    offsetof(Wax9RecordedPacket, packet.packetVersion)
+};
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark integer coding
+/* -------------------------------------------------------------------------------------------------- */
+
+static inline uint64_t zigzag(int64_t v)        { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t  unzigzag(uint64_t v)     { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+// difference between two values of a channel, wrapped to the channel width
+template <typename T>
+static inline int64_t wrapDelta(T a, T b)
+{
+    return (int64_t)(typename std::make_signed<T>::type)(T)(a - b);
+}
+
+// second difference, in unsigned arithmetic so 64-bit channels wrap instead of overflowing
+static inline int64_t wrapDelta2(int64_t delta, int64_t prevDelta)
+{
+    return (int64_t)((uint64_t)delta - (uint64_t)prevDelta);
+}
+
+template <typename T>
+static inline T loadChannel(const char *src, size_t i)
+{
+    T v;
+    memcpy(&v, src + i * sizeof(Wax9RecordedPacket), sizeof(T));
+    return v;
+}
+
+static inline int bitWidth(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return v ? 64 - __builtin_clzll(v) : 0;
+#else
+    int w = 0;
+    while (v) { v >>= 1; w++; }
+    return w;
+#endif
+}
+
+// ceil(width / 7) without a division
+static inline size_t varintSize(uint64_t v)     { return (bitWidth(v | 1) * 9 + 64) / 64; }
+
+static inline uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline size_t packedBlockSize(size_t n, uint64_t all)   { return 1 + (n * bitWidth(all) + 7) / 8; }
+
+// packs one block of at most BLOCK_SIZE values, all is the bitwise or of them
+static uint8_t *putPackedBlock(uint8_t *p, const uint64_t *v, size_t n, uint64_t all)
+{
+    int width = bitWidth(all);
+    *p++ = (uint8_t)width;
+    if (width == 0) return p;
+
+    uint64_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t x = v[i];
+        acc |= x << bits;
+        bits += width;
+        if (bits >= 64) {
+            memcpy(p, &acc, 8);     // assumes a little-endian host, like the decoder
+            p += 8;
+            bits -= 64;
+            acc = bits ? (x >> (width - bits)) : 0;
+        }
+    }
+    for (; bits > 0; bits -= 8, acc >>= 8) *p++ = (uint8_t)acc;
+    return p;
+}
+
+static uint8_t *putPackedBlock(uint8_t *p, const uint64_t *v, size_t n)
+{
+    uint64_t all = 0;
+    for (size_t i = 0; i < n; i++) all |= v[i];
+    return putPackedBlock(p, v, n, all);
+}
+
+static inline bool getVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+{
+    // most deltas fit in a single byte
+    if (p < end && *p < 0x80) {
+        v = *p++;
+        return true;
+    }
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) return true;
+    }
+    return false;
+}
+
+// unpacks one block of at most BLOCK_SIZE values
+static bool getPackedBlock(const uint8_t *&p, const uint8_t *end, uint64_t *v, size_t n)
+{
+    if (p >= end) return false;
+    int width = *p++;
+    if (width > 64) return false;
+    if (width == 0) {
+        memset(v, 0, n * sizeof(uint64_t));
+        return true;
+    }
+
+    size_t bytes = (n * width + 7) / 8;
+    if ((size_t)(end - p) < bytes) return false;
+
+    uint64_t mask = (width == 64) ? ~0ull : ((1ull << width) - 1);
+    size_t bitPos = 0;
+    size_t i = 0;
+
+    // fast path: a plain 8-byte load covers the value whenever width <= 56
+    if (width <= 56) {
+        for (; i < n && (bitPos >> 3) + 8 <= bytes; i++, bitPos += width) {
+            uint64_t word;
+            memcpy(&word, p + (bitPos >> 3), 8);    // assumes a little-endian host
+            v[i] = (word >> (bitPos & 7)) & mask;
+        }
+    }
+    for (; i < n; i++, bitPos += width) {
+        // near the end of the block, or wide values that can span 9 bytes
+        size_t byte = bitPos >> 3;
+        int shift = (int)(bitPos & 7);
+        uint64_t word = 0;
+        memcpy(&word, p + byte, std::min<size_t>(8, bytes - byte));
+        uint64_t x = word >> shift;
+        if (shift + width > 64) x |= (uint64_t)p[byte + 8] << (64 - shift);
+        v[i] = x & mask;
+    }
+    p += bytes;
+    return true;
+}
+
+// Decodes one channel straight into its field. T is the unsigned type of the channel width,
+// so the running sums wrap exactly like the values did on the device
+template <typename T>
+static bool decodeChannel(const uint8_t *&p, const uint8_t *end, int mode, size_t count, char *dst)
+{
+    const size_t stride = sizeof(Wax9RecordedPacket);
+    uint64_t first, u;
+    uint64_t block[BLOCK_SIZE];
+
+    if (!getVarint(p, end, first)) return false;
+    T value = (T)first;
+    memcpy(dst, &value, sizeof(T));
+    dst += stride;
+
+    switch (mode) {
+        case MODE_CONSTANT:
+            for (size_t i = 1; i < count; i++, dst += stride) memcpy(dst, &value, sizeof(T));
+            return true;
+
+        case MODE_LINEAR: {
+            if (!getVarint(p, end, u)) return false;
+            T delta = (T)unzigzag(u);
+            for (size_t i = 1; i < count; i++, dst += stride) {
+                value = (T)(value + delta);
+                memcpy(dst, &value, sizeof(T));
+            }
+            return true;
+        }
+        case MODE_DELTA_VARINT:
+            for (size_t i = 1; i < count; i++, dst += stride) {
+                if (!getVarint(p, end, u)) return false;
+                value = (T)(value + (T)unzigzag(u));
+                memcpy(dst, &value, sizeof(T));
+            }
+            return true;
+
+        case MODE_DELTA2_VARINT: {
+            if (count < 2 || !getVarint(p, end, u)) return false;
+            T delta = (T)unzigzag(u);
+            value = (T)(value + delta);
+            memcpy(dst, &value, sizeof(T));
+            dst += stride;
+            for (size_t i = 2; i < count; i++, dst += stride) {
+                if (!getVarint(p, end, u)) return false;
+                delta = (T)(delta + (T)unzigzag(u));
+                value = (T)(value + delta);
+                memcpy(dst, &value, sizeof(T));
+            }
+            return true;
+        }
+        case MODE_DELTA_PACKED:
+            // unpacking a block at a time keeps the deltas in L1 while they're summed
+            for (size_t b = 1; b < count; b += BLOCK_SIZE) {
+                size_t n = std::min<size_t>(BLOCK_SIZE, count - b);
+                if (!getPackedBlock(p, end, block, n)) return false;
+                for (size_t i = 0; i < n; i++, dst += stride) {
+                    value = (T)(value + (T)unzigzag(block[i]));
+                    memcpy(dst, &value, sizeof(T));
+                }
+            }
+            return true;
+
+        case MODE_DELTA2_PACKED: {
+            if (count < 2 || !getVarint(p, end, u)) return false;
+            T delta = (T)unzigzag(u);
+            value = (T)(value + delta);
+            memcpy(dst, &value, sizeof(T));
+            dst += stride;
+            for (size_t b = 2; b < count; b += BLOCK_SIZE) {
+                size_t n = std::min<size_t>(BLOCK_SIZE, count - b);
+                if (!getPackedBlock(p, end, block, n)) return false;
+                for (size_t i = 0; i < n; i++, dst += stride) {
+                    delta = (T)(delta + (T)unzigzag(block[i]));
+                    value = (T)(value + delta);
+                    memcpy(dst, &value, sizeof(T));
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Encoder state of one channel. The chunk is encoded a block of packets at a time, so each
+// block is read from memory once per pass for all channels instead of once per channel
+struct ChannelState
+{
+    uint64_t    first;
+    uint64_t    prev;               // in the channel width
+    int64_t     prevDelta;
+    uint64_t    firstDelta;         // zigzagged
+
+    // what each mode would cost, in the order of the MODE_DELTA_* modes
+    uint64_t    any1, any2, block2;
+    size_t      sizes[4];
+    size_t      numDelta2;          // values in the open d2 block
+
+    int         mode;
+    uint8_t*    out;
+    size_t      numPacked;
+    uint64_t    packed[BLOCK_SIZE]; // values waiting to be packed
+};
+
+// Extra varint bytes of the first and second differences of packets [b, end), past the first
+// byte of each. Only needed for blocks with values that don't fit in 7 bits
+template <typename T>
+static void addVarintSizes(const char *src, size_t b, size_t end, T prev, int64_t prevDelta, size_t &size1, size_t &size2)
+{
+    for (size_t i = b; i < end; i++) {
+        T value = loadChannel<T>(src, i);
+        int64_t delta = wrapDelta<T>(value, prev);
+        size1 += varintSize(zigzag(delta)) - 1;
+        if (i > 1) size2 += varintSize(zigzag(wrapDelta2(delta, prevDelta))) - 1;
+        prev = value;
+        prevDelta = delta;
+    }
+}
+
+// Gathers the cost of every mode for packets [b, end). d1 blocks start at sample 1 and d2 blocks at
+// sample 2, so every d1 block [b, end) lines up with the d2 block [b + 1, end], whose last value is
+// the first of the next d1 block
+template <typename T>
+static void measureBlock(const char *src, size_t b, size_t end, ChannelState &s)
+{
+    T prev = (T)s.prev;
+    int64_t prevDelta = s.prevDelta;
+    size_t n = end - b;
+
+    T value = loadChannel<T>(src, b);
+    int64_t delta = wrapDelta<T>(value, prev);
+    uint64_t first1 = zigzag(delta);
+    uint64_t first2 = zigzag(wrapDelta2(delta, prevDelta));
+    uint64_t block1 = first1, block2 = 0;
+    prev = value;
+    prevDelta = delta;
+
+    for (size_t i = b + 1; i < end; i++) {
+        value = loadChannel<T>(src, i);
+        delta = wrapDelta<T>(value, prev);
+        block1 |= zigzag(delta);
+        block2 |= zigzag(wrapDelta2(delta, prevDelta));
+        prev = value;
+        prevDelta = delta;
+    }
+
+    // the second difference of sample 1 doesn't exist, and the one of the first sample in
+    // later blocks closes the previous d2 block
+    size_t size1 = n, size2 = n - 1;
+    uint64_t all2 = block2;
+    if (b == 1) s.firstDelta = first1;
+    else {
+        uint64_t closing = s.block2 | first2;
+        s.sizes[3] += packedBlockSize(s.numDelta2 + 1, closing);
+        s.any2 |= closing;
+        all2 |= first2;
+        size2++;
+    }
+    if ((block1 | all2) >= 0x80) addVarintSizes<T>(src, b, end, (T)s.prev, s.prevDelta, size1, size2);
+
+    s.prev = prev;
+    s.prevDelta = prevDelta;
+    s.any1 |= block1;
+    s.block2 = block2;
+    s.numDelta2 = n - 1;
+    s.sizes[0] += size1;
+    s.sizes[1] += size2;
+    s.sizes[2] += packedBlockSize(n, block1);
+}
+
+// Writes the deltas of packets [b, end). Second differences start at sample 2, with the first
+// delta written as a varint ahead of them
+template <typename T, bool SECOND, bool PACKED>
+static void writeBlock(const char *src, size_t b, size_t end, ChannelState &s)
+{
+    // state is kept in locals, stores into the packed values could alias it otherwise
+    T prev = (T)s.prev;
+    int64_t prevDelta = s.prevDelta;
+    uint8_t *p = s.out;
+    uint64_t *packed = s.packed;
+    size_t numPacked = s.numPacked;
+
+    // first differences are packed in the same blocks the chunk is walked in
+    if (PACKED && !SECOND) {
+        uint64_t all = 0;
+        for (size_t i = b; i < end; i++) {
+            T value = loadChannel<T>(src, i);
+            packed[i - b] = zigzag(wrapDelta<T>(value, prev));
+            all |= packed[i - b];
+            prev = value;
+        }
+        s.prev = prev;
+        s.out = putPackedBlock(p, packed, end - b, all);
+        return;
+    }
+
+    for (size_t i = b; i < end; i++) {
+        T value = loadChannel<T>(src, i);
+        int64_t delta = wrapDelta<T>(value, prev);
+        uint64_t z = SECOND ? zigzag(wrapDelta2(delta, prevDelta)) : zigzag(delta);
+        prev = value;
+        prevDelta = delta;
+
+        if (SECOND && i == 1) p = putVarint(p, zigzag(delta));
+        else if (!PACKED) p = putVarint(p, z);
+        else {
+            packed[numPacked++] = z;
+            if (numPacked == BLOCK_SIZE) {
+                p = putPackedBlock(p, packed, BLOCK_SIZE);
+                numPacked = 0;
+            }
+        }
+    }
+    s.prev = prev;
+    s.prevDelta = prevDelta;
+    s.out = p;
+    s.numPacked = numPacked;
+}
+
+template <typename T>
+static void encodeBlock(const char *src, size_t b, size_t end, ChannelState &s, bool measure)
+{
+    if (measure) measureBlock<T>(src, b, end, s);
+    else switch (s.mode) {
+        case MODE_DELTA_VARINT:     writeBlock<T, false, false>(src, b, end, s); break;
+        case MODE_DELTA2_VARINT:    writeBlock<T, true, false>(src, b, end, s); break;
+        case MODE_DELTA_PACKED:     writeBlock<T, false, true>(src, b, end, s); break;
+        case MODE_DELTA2_PACKED:    writeBlock<T, true, true>(src, b, end, s); break;
+        default:                    break;
+    }
+}
+
+// one pass over the chunk, either measuring every channel or writing them
+static void encodePass(const Wax9RecordedPacket *packets, size_t count, ChannelState *states, bool measure)
+{
+    for (size_t b = 1; b < count; b += BLOCK_SIZE) {
+        size_t end = std::min<size_t>(b + BLOCK_SIZE, count);
+        for (int c = 0; c < NUM_CHANNELS; c++) {
+            const char *src = (const char *)packets + sChannelOffsets[c];
+            switch (sChannelBits[c]) {
+                case 8:  encodeBlock<uint8_t>(src, b, end, states[c], measure); break;
+                case 16: encodeBlock<uint16_t>(src, b, end, states[c], measure); break;
+                case 32: encodeBlock<uint32_t>(src, b, end, states[c], measure); break;
+                default: encodeBlock<uint64_t>(src, b, end, states[c], measure); break;
+            }
+        }
+    }
+}
+
+template <typename T>
+static uint64_t loadFirst(const Wax9RecordedPacket *packets, int channel)
+{
+    return loadChannel<T>((const char *)packets + sChannelOffsets[channel], 0);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark chunk codec
+/* -------------------------------------------------------------------------------------------------- */
+
+size_t Wax9ChunkCodec::encode(const Wax9RecordedPacket *packets, size_t count, std::vector<uint8_t> &out)
+{
+    size_t start = out.size();
+    if (count == 0) return 0;
+
+    ChannelState states[NUM_CHANNELS];
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        ChannelState &s = states[c];
+        switch (sChannelBits[c]) {
+            case 8:  s.first = loadFirst<uint8_t>(packets, c); break;
+            case 16: s.first = loadFirst<uint16_t>(packets, c); break;
+            case 32: s.first = loadFirst<uint32_t>(packets, c); break;
+            default: s.first = loadFirst<uint64_t>(packets, c); break;
+        }
+        s.prev = s.first;
+        s.prevDelta = 0;
+        s.firstDelta = 0;
+        s.any1 = s.any2 = s.block2 = 0;
+        s.sizes[0] = s.sizes[1] = s.sizes[2] = s.sizes[3] = 0;
+        s.numDelta2 = 0;
+        s.numPacked = 0;
+    }
+
+    // first pass: the cost of every mode, so the output is sized once and each channel
+    // knows where its data starts
+    encodePass(packets, count, states, true);
+
+    size_t total = 0;
+    size_t sizes[NUM_CHANNELS];
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        ChannelState &s = states[c];
+        if (s.numDelta2) {
+            s.sizes[3] += packedBlockSize(s.numDelta2, s.block2);
+            s.any2 |= s.block2;
+        }
+        size_t firstSize = (count > 1) ? varintSize(s.firstDelta) : 0;
+        s.sizes[1] += firstSize;
+        s.sizes[3] += firstSize;
+
+        size_t size;
+        if (s.any1 == 0) {
+            s.mode = MODE_CONSTANT;
+            size = 0;
+        }
+        else if (s.any2 == 0) {
+            s.mode = MODE_LINEAR;
+            size = firstSize;
+        }
+        else {
+            int best = 0;
+            for (int k = 1; k < 4; k++) if (s.sizes[k] < s.sizes[best]) best = k;
+            s.mode = MODE_DELTA_VARINT + best;
+            size = s.sizes[best];
+        }
+        sizes[c] = 1 + varintSize(s.first) + size;
+        total += sizes[c];
+    }
+
+    out.resize(start + total);
+    uint8_t *p = &out[start];
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        ChannelState &s = states[c];
+        s.out = p;
+        *s.out++ = (uint8_t)s.mode;
+        s.out = putVarint(s.out, s.first);
+        if (s.mode == MODE_LINEAR) s.out = putVarint(s.out, s.firstDelta);
+        s.prev = s.first;
+        s.prevDelta = 0;
+        p += sizes[c];
+    }
+
+    // second pass: every channel writes its deltas into its own part of the payload
+    encodePass(packets, count, states, false);
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        ChannelState &s = states[c];
+        if (s.numPacked) s.out = putPackedBlock(s.out, s.packed, s.numPacked);
+    }
+    return total;
+}
+
+bool Wax9ChunkCodec::decode(const uint8_t *payload, size_t size, size_t count, Wax9RecordedPacket *packets)
+{
+    const uint8_t *p = payload;
+    const uint8_t *end = payload + size;
+    if (count == 0) return size == 0;
+
+    for (int c = 0; c < NUM_CHANNELS; c++) {
+        if (p >= end) return false;
+        int mode = *p++;
+        char *dst = (char *)packets + sChannelOffsets[c];
+        bool ok;
+
+        switch (sChannelBits[c]) {
+            case 8:  ok = decodeChannel<uint8_t>(p, end, mode, count, dst); break;
+            case 16: ok = decodeChannel<uint16_t>(p, end, mode, count, dst); break;
+            case 32: ok = decodeChannel<uint32_t>(p, end, mode, count, dst); break;
+            default: ok = decodeChannel<uint64_t>(p, end, mode, count, dst); break;
+        }
+        if (!ok) return false;
+    }
+    for (size_t i = 0; i < count; i++) packets[i].packet.packetType = '9';
+    return p == end;
+}
+
+// Adler-32, cheap enough to verify every chunk at disk speed
+uint32_t Wax9ChunkCodec::checksum(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        size_t n = std::min<size_t>(size, 5552);
+        size -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark file helpers
+/* -------------------------------------------------------------------------------------------------- */
+
+static inline void putLE32(uint8_t *p, uint32_t v)  { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24); }
+static inline void putLE64(uint8_t *p, uint64_t v)  { putLE32(p, (uint32_t)v); putLE32(p + 4, (uint32_t)(v >> 32)); }
+static inline uint32_t getLE32(const uint8_t *p)    { return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint64_t getLE64(const uint8_t *p)    { return getLE32(p) | ((uint64_t)getLE32(p + 4) << 32); }
+
+// stdio offsets are 32 bits on some platforms, and a day of recording is larger than that
+static bool seekFile(FILE *file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static uint64_t getFileSize(FILE *file)
+{
+#ifdef _WIN32
+    _fseeki64(file, 0, SEEK_END);
+    return (uint64_t)_ftelli64(file);
+#else
+    fseeko(file, 0, SEEK_END);
+    return (uint64_t)ftello(file);
+#endif
+}
+
+static void writeIndexHeader(FILE *file)
+{
+    uint8_t h[WAX9_INDEX_HEADER_SIZE];
+    memcpy(h, "WAX9IDX", 8);
+    putLE32(h + 8, WAX9_INDEX_VERSION);
+    putLE32(h + 12, WAX9_INDEX_ENTRY_SIZE);
+    fwrite(h, 1, sizeof(h), file);
+}
+
+static void writeIndexEntry(FILE *file, const Wax9IndexEntry &entry)
+{
+    uint8_t e[WAX9_INDEX_ENTRY_SIZE];
+    putLE64(e,      entry.offset);
+    putLE32(e + 8,  entry.header.count);
+    putLE32(e + 12, entry.header.payloadSize);
+    putLE64(e + 16, entry.header.firstSample);
+    putLE64(e + 24, entry.header.firstTimestamp);
+    putLE64(e + 32, entry.header.firstTicks);
+    putLE64(e + 40, entry.header.lastTicks);
+    fwrite(e, 1, sizeof(e), file);
+}
+
+static void parseIndexEntry(const uint8_t *e, Wax9IndexEntry &entry)
+{
+    entry.offset                = getLE64(e);
+    entry.header.count          = getLE32(e + 8);
+    entry.header.payloadSize    = getLE32(e + 12);
+    entry.header.checksum       = 0;
+    entry.header.firstSample    = getLE64(e + 16);
+    entry.header.firstTimestamp = getLE64(e + 24);
+    entry.header.firstTicks     = getLE64(e + 32);
+    entry.header.lastTicks      = getLE64(e + 40);
+}
+
+static void writeChunkHeader(uint8_t *h, const Wax9ChunkHeader &header)
+{
+    putLE32(h,      CHUNK_MAGIC);
+    putLE32(h + 4,  header.count);
+    putLE32(h + 8,  header.payloadSize);
+    putLE32(h + 12, header.checksum);
+    putLE64(h + 16, header.firstSample);
+    putLE64(h + 24, header.firstTimestamp);
+    putLE64(h + 32, header.firstTicks);
+    putLE64(h + 40, header.lastTicks);
+}
+
+static bool parseChunkHeader(const uint8_t *h, Wax9ChunkHeader &header)
+{
+    if (getLE32(h) != CHUNK_MAGIC) return false;
+    header.count          = getLE32(h + 4);
+    header.payloadSize    = getLE32(h + 8);
+    header.checksum       = getLE32(h + 12);
+    header.firstSample    = getLE64(h + 16);
+    header.firstTimestamp = getLE64(h + 24);
+    header.firstTicks     = getLE64(h + 32);
+    header.lastTicks      = getLE64(h + 40);
+    return header.count > 0 && header.count <= (1u << 20);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark recorder
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Recorder::Wax9Recorder()
+{
+    mFile = NULL;
+    mIndexFile = NULL;
+    mChunkSize = 4096;
+    mChunkSample = 0;
+    mChunkTimestamp = 0;
+    mNumPackets = 0;
+    mNumBytes = 0;
+    bWriting = false;
+    bRunning = false;
+}
+
+Wax9Recorder::~Wax9Recorder()
+{
+    close();
+}
+
+Wax9RecorderRef Wax9Recorder::create(const std::string &path, const std::string &deviceName, int outputRate, size_t chunkSize)
+{
+    Wax9RecorderRef recorder(new Wax9Recorder());
+    recorder->mFile = fopen(path.c_str(), "wb");
+    if (recorder->mFile == NULL) {
+        fprintf(stderr, "WARNING: Unable to open %s for recording\n", path.c_str());
+        return Wax9RecorderRef();
+    }
+    recorder->mChunkSize = std::max<size_t>(chunkSize, 1);
+    recorder->mPending.reserve(recorder->mChunkSize);
+
+    uint8_t header[WAX9_RECORDING_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, "WAX9REC", 8);
+    putLE32(header + 8, WAX9_RECORDING_VERSION);
+    putLE32(header + 12, (uint32_t)outputRate);
+    strncpy((char *)header + 16, deviceName.c_str(), 63);
+    putLE64(header + 80, Wax9::ticksNow());
+    fwrite(header, 1, sizeof(header), recorder->mFile);
+    recorder->mNumBytes = sizeof(header);
+
+    // the index is only a shortcut, readers rebuild it if it can't be written
+    recorder->mIndexFile = fopen((path + ".idx").c_str(), "wb");
+    if (recorder->mIndexFile) writeIndexHeader(recorder->mIndexFile);
+    else fprintf(stderr, "WARNING: Unable to write the index of %s\n", path.c_str());
+
+    recorder->bRunning = true;
+    recorder->mThread = std::thread(&Wax9Recorder::threadedWrite, recorder.get());
+    return recorder;
+}
+
+void Wax9Recorder::write(const Wax9Packet &packet, unsigned long long ticks)
+{
+    if (!mFile) return;
+
+    mExtender.extend(packet);
+    if (mPending.empty()) {
+        mChunkSample = mExtender.getSample();
+        mChunkTimestamp = mExtender.getTimestamp();
+    }
+
+    Wax9RecordedPacket r;
+    r.packet = packet;
+    r.ticks = ticks;
+    mPending.push_back(r);
+    mNumPackets++;
+
+    if (mPending.size() >= mChunkSize) queueChunk();
+}
+
+void Wax9Recorder::flush()
+{
+    if (!mFile) return;
+    queueChunk();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mQueue.empty() || bWriting) mWritten.wait(lock);
+    fflush(mFile);
+}
+
+void Wax9Recorder::close()
+{
+    if (!mFile) return;
+    queueChunk();
+
+    // the writer drains the queue before it stops
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bRunning = false;
+    }
+    mCondition.notify_one();
+    if (mThread.joinable()) mThread.join();
+
+    fclose(mFile);
+    mFile = NULL;
+    if (mIndexFile) fclose(mIndexFile);
+    mIndexFile = NULL;
+}
+
+float Wax9Recorder::getCompressionRatio() const
+{
+    uint64_t numBytes = mNumBytes;
+    if (numBytes <= WAX9_RECORDING_HEADER_SIZE) return 1.0f;
+    return (float)(mNumPackets * 34) / (float)(numBytes - WAX9_RECORDING_HEADER_SIZE);
+}
+
+// hands the pending packets to the writer and takes an empty buffer back
+void Wax9Recorder::queueChunk()
+{
+    if (mPending.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(QueuedChunk());
+        QueuedChunk &chunk = mQueue.back();
+        chunk.packets.swap(mPending);
+        chunk.firstSample = mChunkSample;
+        chunk.firstTimestamp = mChunkTimestamp;
+        if (!mFree.empty()) {
+            mPending.swap(mFree.back());
+            mFree.pop_back();
+        }
+    }
+    mCondition.notify_one();
+    if (mPending.capacity() < mChunkSize) mPending.reserve(mChunkSize);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark writer thread
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Recorder::threadedWrite()
+{
+    std::vector<QueuedChunk> chunks;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+
+            // written chunks go back to write() before waiting for more
+            for (size_t i = 0; i < chunks.size(); i++) {
+                chunks[i].packets.clear();
+                mFree.push_back(std::vector<Wax9RecordedPacket>());
+                mFree.back().swap(chunks[i].packets);
+            }
+            chunks.clear();
+            bWriting = false;
+            mWritten.notify_all();
+
+            while (bRunning && mQueue.empty()) mCondition.wait(lock);
+            if (!bRunning && mQueue.empty()) return;
+
+            chunks.swap(mQueue);
+            bWriting = true;
+        }
+
+        for (size_t i = 0; i < chunks.size(); i++) writeChunk(chunks[i]);
+    }
+}
+
+void Wax9Recorder::writeChunk(const QueuedChunk &chunk)
+{
+    const std::vector<Wax9RecordedPacket> &packets = chunk.packets;
+
+    mEncoded.resize(WAX9_CHUNK_HEADER_SIZE);
+    size_t payloadSize = Wax9ChunkCodec::encode(&packets[0], packets.size(), mEncoded);
+
+    Wax9ChunkHeader header;
+    header.count = (uint32_t)packets.size();
+    header.payloadSize = (uint32_t)payloadSize;
+    header.checksum = Wax9ChunkCodec::checksum(&mEncoded[WAX9_CHUNK_HEADER_SIZE], payloadSize);
+    header.firstSample = chunk.firstSample;
+    header.firstTimestamp = chunk.firstTimestamp;
+    header.firstTicks = packets.front().ticks;
+    header.lastTicks = packets.back().ticks;
+    writeChunkHeader(&mEncoded[0], header);
+
+    Wax9IndexEntry entry;
+    entry.offset = mNumBytes;
+    entry.header = header;
+
+    fwrite(&mEncoded[0], 1, mEncoded.size(), mFile);
+    mNumBytes += mEncoded.size();
+
+    // the chunk goes to disk before its index entry, so the index never points past the data
+    if (mIndexFile) {
+        fflush(mFile);
+        writeIndexEntry(mIndexFile, entry);
+        fflush(mIndexFile);
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark reader
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9RecordingReader::Wax9RecordingReader()
+{
+    mFile = NULL;
+    mFileSize = 0;
+    mOutputRate = 0;
+    mStartTicks = 0;
+    bIndexRebuilt = false;
+    mNextChunk = 0;
+    mChunkPos = 0;
+}
+
+Wax9RecordingReader::~Wax9RecordingReader()
+{
+    close();
+}
+
+bool Wax9RecordingReader::open(const std::string &path)
+{
+    close();
+    mFile = fopen(path.c_str(), "rb");
+    if (mFile == NULL) return false;
+
+    uint8_t header[WAX9_RECORDING_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), mFile) != sizeof(header) || memcmp(header, "WAX9REC", 8) != 0 ||
+        getLE32(header + 8) != WAX9_RECORDING_VERSION) {
+        fprintf(stderr, "WARNING: %s is not a Wax9 recording\n", path.c_str());
+        close();
+        return false;
+    }
+    mOutputRate = (int)getLE32(header + 12);
+    mDeviceName = std::string((const char *)header + 16, strnlen((const char *)header + 16, 64));
+    mStartTicks = getLE64(header + 80);
+    mFileSize = getFileSize(mFile);
+
+    loadIndex(path + ".idx");
+    rewind();
+    return true;
+}
+
+void Wax9RecordingReader::close()
+{
+    if (mFile) fclose(mFile);
+    mFile = NULL;
+    mFileSize = 0;
+    mIndex.clear();
+    bIndexRebuilt = false;
+    mNextChunk = 0;
+    mChunk.clear();
+    mChunkPos = 0;
+}
+
+uint64_t Wax9RecordingReader::getNumPackets() const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < mIndex.size(); i++) count += mIndex[i].header.count;
+    return count;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark index
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9RecordingReader::loadIndex(const std::string &path)
+{
+    mIndex.clear();
+    uint64_t offset = WAX9_RECORDING_HEADER_SIZE;
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file) {
+        uint8_t h[WAX9_INDEX_HEADER_SIZE];
+        if (fread(h, 1, sizeof(h), file) == sizeof(h) && memcmp(h, "WAX9IDX", 8) == 0 &&
+            getLE32(h + 8) == WAX9_INDEX_VERSION && getLE32(h + 12) == WAX9_INDEX_ENTRY_SIZE) {
+
+            // keep entries while they tile the file, a crash can leave the index ahead of the data
+            uint8_t e[WAX9_INDEX_ENTRY_SIZE];
+            Wax9IndexEntry entry;
+            while (fread(e, 1, sizeof(e), file) == sizeof(e)) {
+                parseIndexEntry(e, entry);
+                uint64_t end = entry.offset + WAX9_CHUNK_HEADER_SIZE + entry.header.payloadSize;
+                if (entry.offset != offset || entry.header.count == 0 || end > mFileSize) break;
+                mIndex.push_back(entry);
+                offset = end;
+            }
+        }
+        fclose(file);
+    }
+
+    // an index from another recording with the same name won't match the chunk headers
+    if (!mIndex.empty()) {
+        Wax9ChunkHeader header;
+        uint8_t h[WAX9_CHUNK_HEADER_SIZE];
+        const Wax9IndexEntry &last = mIndex.back();
+        if (!seekFile(mFile, last.offset) || fread(h, 1, sizeof(h), mFile) != sizeof(h) || !parseChunkHeader(h, header) ||
+            header.firstSample != last.header.firstSample || header.firstTicks != last.header.firstTicks) {
+            mIndex.clear();
+            offset = WAX9_RECORDING_HEADER_SIZE;
+        }
+    }
+
+    // index whatever the index file doesn't cover yet
+    size_t numIndexed = mIndex.size();
+    scanChunks(offset);
+    bIndexRebuilt = mIndex.size() != numIndexed;
+}
+
+// Walks the chunk headers without reading the payloads, and stops at the first chunk
+// that is incomplete, which is where a truncated recording ends
+void Wax9RecordingReader::scanChunks(uint64_t offset)
+{
+    uint8_t h[WAX9_CHUNK_HEADER_SIZE];
+    Wax9IndexEntry entry;
+
+    while (offset + WAX9_CHUNK_HEADER_SIZE <= mFileSize) {
+        if (!seekFile(mFile, offset) || fread(h, 1, sizeof(h), mFile) != sizeof(h)) break;
+        if (!parseChunkHeader(h, entry.header)) break;
+
+        uint64_t end = offset + WAX9_CHUNK_HEADER_SIZE + entry.header.payloadSize;
+        if (end > mFileSize) break;
+
+        entry.offset = offset;
+        mIndex.push_back(entry);
+        offset = end;
+    }
+}
+
+bool Wax9RecordingReader::rebuildIndex(const std::string &path)
+{
+    Wax9RecordingReader reader;
+    if (!reader.open(path)) return false;
+
+    FILE *file = fopen((path + ".idx").c_str(), "wb");
+    if (file == NULL) return false;
+
+    writeIndexHeader(file);
+    for (size_t i = 0; i < reader.mIndex.size(); i++) writeIndexEntry(file, reader.mIndex[i]);
+    return fclose(file) == 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark reading
+/* -------------------------------------------------------------------------------------------------- */
+
+bool Wax9RecordingReader::loadChunk(size_t chunk, std::vector<Wax9RecordedPacket> &packets)
+{
+    const Wax9IndexEntry &entry = mIndex[chunk];
+    Wax9ChunkHeader header;
+    uint8_t h[WAX9_CHUNK_HEADER_SIZE];
+
+    if (!seekFile(mFile, entry.offset) || fread(h, 1, sizeof(h), mFile) != sizeof(h) || !parseChunkHeader(h, header) ||
+        header.count != entry.header.count || header.payloadSize != entry.header.payloadSize) {
+        return false;
+    }
+
+    mPayload.resize(header.payloadSize);
+    if (header.payloadSize > 0 && fread(&mPayload[0], 1, header.payloadSize, mFile) != header.payloadSize) return false;
+    if (Wax9ChunkCodec::checksum(mPayload.empty() ? NULL : &mPayload[0], mPayload.size()) != header.checksum) return false;
+
+    packets.resize(header.count);
+    return Wax9ChunkCodec::decode(mPayload.empty() ? NULL : &mPayload[0], mPayload.size(), header.count, &packets[0]);
+}
+
+bool Wax9RecordingReader::readChunk(Wax9ChunkHeader &header, std::vector<Wax9RecordedPacket> &packets)
+{
+    if (!mFile) return false;
+
+    while (mNextChunk < mIndex.size()) {
+        size_t chunk = mNextChunk++;
+        if (loadChunk(chunk, packets)) {
+            header = mIndex[chunk].header;
+            return true;
+        }
+        fprintf(stderr, "WARNING: Skipping damaged chunk %d in Wax9 recording\n", (int)chunk);
+    }
+    return false;
+}
+
+bool Wax9RecordingReader::next(Wax9RecordedPacket &packet)
+{
+    if (mChunkPos >= mChunk.size()) {
+        Wax9ChunkHeader header;
+        mChunkPos = 0;
+        if (!readChunk(header, mChunk)) {
+            mChunk.clear();
+            return false;
+        }
+    }
+    packet = mChunk[mChunkPos++];
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark seeking
+/* -------------------------------------------------------------------------------------------------- */
+
+enum { INDEX_KEY_SAMPLE, INDEX_KEY_TIMESTAMP, INDEX_KEY_TICKS };
+
+static inline uint64_t getSeekKey(const Wax9ChunkHeader &header, int key)
+{
+    switch (key) {
+        case INDEX_KEY_SAMPLE:       return header.firstSample;
+        case INDEX_KEY_TIMESTAMP:    return header.firstTimestamp;
+        default:                    return header.firstTicks;
+    }
+}
+
+bool Wax9RecordingReader::seekToChunk(size_t chunk)
+{
+    mNextChunk = std::min(chunk, mIndex.size());
+    mChunk.clear();
+    mChunkPos = 0;
+    return mNextChunk < mIndex.size();
+}
+
+// Decodes the chunk and leaves next() at the first packet whose key reaches value
+bool Wax9RecordingReader::seekWithin(size_t chunk, int key, uint64_t value)
+{
+    seekToChunk(chunk);
+    Wax9ChunkHeader header;
+    if (!readChunk(header, mChunk)) return false;
+
+    Wax9SequenceExtender extender;
+    extender.reset(header.firstSample, header.firstTimestamp);
+
+    for (mChunkPos = 0; mChunkPos < mChunk.size(); mChunkPos++) {
+        const Wax9RecordedPacket &r = mChunk[mChunkPos];
+        if (mChunkPos > 0) extender.extend(r.packet);
+
+        uint64_t v = (key == INDEX_KEY_SAMPLE) ? extender.getSample() :
+                     (key == INDEX_KEY_TIMESTAMP) ? extender.getTimestamp() : r.ticks;
+        if (v >= value) break;
+    }
+    // past the end of this chunk, next() continues with the following one
+    return mChunkPos < mChunk.size() || mNextChunk < mIndex.size();
+}
+
+static size_t findChunk(const std::vector<Wax9IndexEntry> &index, int key, uint64_t value)
+{
+    // last chunk that starts at or before value
+    size_t lo = 0, hi = index.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (getSeekKey(index[mid].header, key) <= value) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+bool Wax9RecordingReader::seekToSample(uint64_t sample)
+{
+    if (mIndex.empty()) return false;
+    return seekWithin(findChunk(mIndex, INDEX_KEY_SAMPLE, sample), INDEX_KEY_SAMPLE, sample);
+}
+
+bool Wax9RecordingReader::seekToTimestamp(uint64_t timestamp)
+{
+    if (mIndex.empty()) return false;
+    return seekWithin(findChunk(mIndex, INDEX_KEY_TIMESTAMP, timestamp), INDEX_KEY_TIMESTAMP, timestamp);
+}
+
+bool Wax9RecordingReader::seekToTicks(unsigned long long ticks)
+{
+    if (mIndex.empty()) return false;
+    return seekWithin(findChunk(mIndex, INDEX_KEY_TICKS, ticks), INDEX_KEY_TICKS, ticks);
+}
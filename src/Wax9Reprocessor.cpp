@@ -0,0 +1,188 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Reprocessor.h"
+#include "Wax9Recording.h"
+#include "Wax9Orientation.h"
+
+#define FLUSH_INTERVAL  16      // chunks queued on the exporter before waiting for it
+
+static double secondsNow()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark constructors and setup
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Reprocessor::Wax9Reprocessor(int numThreads) : mPool(numThreads)
+{
+    mSettings = getDefaultSettings();
+    mSeconds = 0.0;
+}
+
+// same as a new Wax9, use the device's getFusionSettings() to match one that was changed
+Wax9Reprocessor::Settings Wax9Reprocessor::getDefaultSettings()
+{
+    Settings settings;
+    settings.fusion = Wax9Fusion::getDefaultSettings();
+    settings.format = Wax9Exporter::FORMAT_COLUMNAR;
+    return settings;
+}
+
+void Wax9Reprocessor::addFile(const std::string &input, const std::string &output)
+{
+    Job job;
+    job.input = input;
+    job.output = output;
+    job.ok = false;
+    job.numSamples = 0;
+    job.seconds = 0.0;
+    job.worker = -1;
+    mJobs.push_back(job);
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark processing
+/* -------------------------------------------------------------------------------------------------- */
+
+bool Wax9Reprocessor::run()
+{
+    mPool.resetStats();
+    mWorkerSamples.assign(mPool.getNumThreads(), 0);
+    double start = secondsNow();
+
+    // jobs only touch their own entry and their worker's counter
+    Settings settings = mSettings;
+    for (size_t i = 0; i < mJobs.size(); i++) {
+        Job *job = &mJobs[i];
+        uint64_t *workerSamples = &mWorkerSamples[0];
+        mPool.submit([job, workerSamples, settings](int worker) {
+            double jobStart = secondsNow();
+            job->worker = worker;
+            job->ok = processFile(job->input, job->output, settings, &job->numSamples);
+            job->seconds = secondsNow() - jobStart;
+            workerSamples[worker] += job->numSamples;
+        });
+    }
+    mPool.wait();
+    mSeconds = secondsNow() - start;
+
+    bool ok = true;
+    for (size_t i = 0; i < mJobs.size(); i++) {
+        if (!mJobs[i].ok) {
+            fprintf(stderr, "WARNING: Unable to reprocess %s\n", mJobs[i].input.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static size_t write(Wax9ExporterRef exporter, std::vector<Wax9Sample> &samples)
+{
+    if (samples.empty()) return 0;
+    Wax9Orientation::toOpenGL(&samples[0].rotAHRS, samples.size(), &samples[0].rotOGL, sizeof(Wax9Sample), sizeof(Wax9Sample));
+    exporter->write(&samples[0], samples.size());
+    return samples.size();
+}
+
+bool Wax9Reprocessor::processFile(const std::string &input, const std::string &output, const Settings &settings, uint64_t *numSamples)
+{
+    if (numSamples) *numSamples = 0;
+
+    Wax9RecordingReader reader;
+    if (!reader.open(input)) return false;
+
+    Wax9ExporterRef exporter = Wax9Exporter::create(output, settings.format);
+    if (!exporter) return false;
+
+    // the same processing as Wax9::processBatch(), dt follows the recorded timestamps
+    Wax9Fusion fusion;
+    fusion.setup(settings.fusion, reader.getOutputRate());
+
+    std::vector<Wax9RecordedPacket> packets;
+    std::vector<Wax9Sample> samples;
+    Wax9ChunkHeader header;
+    uint64_t count = 0;
+    int chunks = 0;
+
+    while (reader.readChunk(header, packets)) {
+        if (packets.empty()) continue;
+        samples.resize(packets.size());
+        for (size_t i = 0; i < packets.size(); i++) {
+            Wax9::convertPacket(packets[i].packet, samples[i]);
+            samples[i].hostTime = packets[i].ticks / 1000.0;
+        }
+        fusion.fuse(&samples[0], samples.size());
+        if (fusion.isSmoothing()) samples.resize(fusion.smooth(&samples[0], samples.size()));
+        count += write(exporter, samples);
+
+        // keep the exporter queue bounded on files larger than memory
+        if (++chunks % FLUSH_INTERVAL == 0) exporter->flush();
+    }
+
+    // what fixed-lag smoothing still holds back
+    samples.resize(WAX9_SMOOTH_MAX_LAG);
+    samples.resize(fusion.finish(&samples[0]));
+    count += write(exporter, samples);
+    exporter->close();
+
+    if (numSamples) *numSamples = count;
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark stats
+/* -------------------------------------------------------------------------------------------------- */
+
+uint64_t Wax9Reprocessor::getNumSamples() const
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < mJobs.size(); i++) count += mJobs[i].numSamples;
+    return count;
+}
+
+double Wax9Reprocessor::getWorkerThroughput(int worker) const
+{
+    if (worker < 0 || worker >= (int)mWorkerSamples.size()) return 0.0;
+    double busy = mPool.getStats(worker).busySeconds;
+    return busy > 0.0 ? mWorkerSamples[worker] / busy : 0.0;
+}
+
+void Wax9Reprocessor::printReport() const
+{
+    Wax9::console() << "Reprocessed " << getNumSamples() << " samples from " << mJobs.size() << " files in " << mSeconds << " s ("
+                   << (uint64_t)getThroughput() << " samples/s)" << std::endl;
+
+    for (int i = 0; i < mPool.getNumThreads(); i++) {
+        Wax9WorkPool::WorkerStats stats = mPool.getStats(i);
+        Wax9::console() << "  worker " << i << ": " << stats.numTasks << " files (" << stats.numStolen << " stolen), "
+                       << mWorkerSamples[i] << " samples, " << (uint64_t)getWorkerThroughput(i) << " samples/s" << std::endl;
+    }
+}
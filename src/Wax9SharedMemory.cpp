@@ -0,0 +1,308 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include "Wax9SharedMemory.h"
+
+#include <cstring>
+#include <cstdio>
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark segment
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9SharedSegment::Wax9SharedSegment()
+{
+    mData = NULL;
+    mSize = 0;
+    mHandle = -1;
+}
+
+Wax9SharedSegment::~Wax9SharedSegment()
+{
+    close();
+}
+
+// Port names like /dev/tty.WAX9-0A1B-SPPDev aren't valid segment names, keep only the safe characters
+std::string Wax9SharedSegment::getSegmentName(const std::string &deviceName)
+{
+    std::string name = "wax9-";
+    for (size_t i = 0; i < deviceName.size(); i++) {
+        char c = deviceName[i];
+        bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+        name += safe ? c : '_';
+    }
+#ifdef _WIN32
+    return "Local\\" + name;
+#else
+    // macOS limits POSIX shared memory names to 31 characters
+    if (name.size() > 30) name = name.substr(0, 30);
+    return "/" + name;
+#endif
+}
+
+bool Wax9SharedSegment::open(const std::string &deviceName, bool create, uint32_t capacity)
+{
+    close();
+
+    std::string name = getSegmentName(deviceName);
+
+#ifdef _WIN32
+    HANDLE handle;
+    if (create) {
+        size_t size = getSegmentSize(capacity);
+        handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, name.c_str());
+    }
+    else {
+        handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    }
+    if (handle == NULL) return false;
+    bool existed = create && GetLastError() == ERROR_ALREADY_EXISTS;
+
+    char *data = (char *)MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(handle);
+        return false;
+    }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(data, &info, sizeof(info));
+    mSize = info.RegionSize;
+    mHandle = (intptr_t)handle;
+    mData = data;
+
+    // mappings can't be resized or replaced while someone has them open, so a writer
+    // with another capacity has to wait until the readers of the old one are gone
+    if (existed) {
+        Wax9SharedHeader *header = getHeader();
+        bool initialized = mSize >= sizeof(Wax9SharedHeader) && header->magic == WAX9_SHARED_MAGIC;
+        if (mSize < getSegmentSize(capacity) || (initialized && header->capacity != capacity)) {
+            close();
+            return false;
+        }
+    }
+#else
+    int fd = shm_open(name.c_str(), create ? (O_CREAT | O_RDWR) : O_RDWR, 0666);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (create && size != getSegmentSize(capacity)) {
+        // Resizing in place would pull the pages from under attached readers (SIGBUS when
+        // it shrinks) or change the capacity they index with. Retire the old segment and
+        // start a new one instead, readers keep their mapping and see isStale()
+        if (size > 0) {
+            ::close(fd);
+            retire(name);
+            fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+            if (fd < 0) return false;
+        }
+        size = getSegmentSize(capacity);
+        if (ftruncate(fd, (off_t)size) != 0) {
+            ::close(fd);
+            return false;
+        }
+    }
+    if (size < sizeof(Wax9SharedHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return false;
+
+    mSize = size;
+    mData = (char *)data;
+#endif
+
+    // a reader only trusts segments that were fully initialized by a writer
+    if (!create) {
+        Wax9SharedHeader *header = getHeader();
+        uint32_t capacity = header->capacity;
+        if (header->magic != WAX9_SHARED_MAGIC || header->version != WAX9_SHARED_VERSION ||
+            header->slotSize != sizeof(Wax9SharedSlot) || capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+            getSegmentSize(capacity) > mSize) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Wax9SharedSegment::close()
+{
+    if (mData == NULL) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(mData);
+    CloseHandle((HANDLE)mHandle);
+#else
+    munmap(mData, mSize);
+#endif
+    mData = NULL;
+    mSize = 0;
+    mHandle = -1;
+}
+
+#ifndef _WIN32
+// marks a segment as abandoned and unlinks it. Attached readers keep a valid mapping
+void Wax9SharedSegment::retire(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0666);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Wax9SharedHeader)) {
+            void *data = mmap(NULL, sizeof(Wax9SharedHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED) {
+                ((Wax9SharedHeader *)data)->magic = WAX9_SHARED_RETIRED;
+                munmap(data, sizeof(Wax9SharedHeader));
+            }
+        }
+        ::close(fd);
+    }
+    shm_unlink(name.c_str());
+}
+#endif
+
+bool Wax9SharedSegment::remove(const std::string &deviceName)
+{
+#ifdef _WIN32
+    // mappings go away with the last handle
+    return true;
+#else
+    return shm_unlink(getSegmentName(deviceName).c_str()) == 0;
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark reader
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9SharedReader::Wax9SharedReader()
+{
+    mCapacity = 0;
+    mCursor = 0;
+    mNumDropped = 0;
+}
+
+Wax9SharedReaderRef Wax9SharedReader::attach(const std::string &deviceName)
+{
+    Wax9SharedReaderRef reader(new Wax9SharedReader());
+    if (!reader->mSegment.open(deviceName, false, 0)) {
+        return Wax9SharedReaderRef();
+    }
+    reader->mCapacity = reader->mSegment.getHeader()->capacity;
+    reader->seekToLatest();
+    return reader;
+}
+
+std::string Wax9SharedReader::getDeviceName() const
+{
+    const char *name = mSegment.getHeader()->deviceName;
+    return std::string(name, strnlen(name, sizeof(mSegment.getHeader()->deviceName)));
+}
+
+void Wax9SharedReader::seekToLatest()
+{
+    mCursor = mSegment.getHeader()->writeIndex.load(std::memory_order_acquire);
+}
+
+bool Wax9SharedReader::isStale() const
+{
+    return mSegment.getHeader()->magic == WAX9_SHARED_RETIRED;
+}
+
+uint64_t Wax9SharedReader::getNumAvailable() const
+{
+    uint64_t written = mSegment.getHeader()->writeIndex.load(std::memory_order_acquire);
+    return written > mCursor ? written - mCursor : 0;
+}
+
+bool Wax9SharedReader::readSlot(uint64_t index, Wax9SharedSample &sample) const
+{
+    const Wax9SharedSlot &slot = mSegment.getSlots()[index & (mCapacity - 1)];
+    uint64_t expected = 2 * index + 2;
+
+    uint64_t before = slot.seq.load(std::memory_order_acquire);
+    if (before != expected) return false;
+
+    memcpy(&sample, &slot.sample, sizeof(Wax9SharedSample));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = slot.seq.load(std::memory_order_relaxed);
+    return after == expected;
+}
+
+size_t Wax9SharedReader::read(Wax9SharedSample *samples, size_t maxSamples)
+{
+    uint64_t written = mSegment.getHeader()->writeIndex.load(std::memory_order_acquire);
+
+    // skip what has already been overwritten
+    if (written > mCursor + mCapacity) {
+        mNumDropped += written - mCapacity - mCursor;
+        mCursor = written - mCapacity;
+    }
+
+    size_t count = 0;
+    while (count < maxSamples && mCursor < written) {
+        if (readSlot(mCursor, samples[count])) {
+            count++;
+        }
+        else {
+            // the writer lapped us while copying
+            mNumDropped++;
+        }
+        mCursor++;
+    }
+    return count;
+}
+
+bool Wax9SharedReader::readLatest(Wax9SharedSample &sample) const
+{
+    // retry in the unlikely case the newest slot is overwritten while we copy it
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint64_t written = mSegment.getHeader()->writeIndex.load(std::memory_order_acquire);
+        if (written == 0) return false;
+        if (readSlot(written - 1, sample)) return true;
+    }
+    return false;
+}
@@ -0,0 +1,117 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "Wax9SharedPublisher.h"
+
+#include <cstring>
+#include <cstdio>
+
+Wax9SharedPublisherRef Wax9SharedPublisher::create(const std::string &deviceName, uint32_t capacity)
+{
+    uint32_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    Wax9SharedPublisherRef publisher(new Wax9SharedPublisher());
+    if (!publisher->mSegment.open(deviceName, true, size)) {
+        fprintf(stderr, "WARNING: Unable to create shared memory for %s\n", deviceName.c_str());
+        return Wax9SharedPublisherRef();
+    }
+
+    // keep counting from where a previous writer left off if the layout matches,
+    // so readers that are still attached carry on seamlessly
+    Wax9SharedHeader *header = publisher->mSegment.getHeader();
+    bool reuse = header->magic == WAX9_SHARED_MAGIC && header->version == WAX9_SHARED_VERSION &&
+                 header->capacity == size && header->slotSize == sizeof(Wax9SharedSlot);
+
+    if (!reuse) {
+        header->magic = 0;  // readers ignore the segment until it's initialized
+        header->version = WAX9_SHARED_VERSION;
+        header->capacity = size;
+        header->slotSize = sizeof(Wax9SharedSlot);
+        memset(header->deviceName, 0, sizeof(header->deviceName));
+        strncpy(header->deviceName, deviceName.c_str(), sizeof(header->deviceName) - 1);
+        header->writeIndex.store(0, std::memory_order_relaxed);
+
+        Wax9SharedSlot *slots = publisher->mSegment.getSlots();
+        for (uint32_t i = 0; i < size; i++) slots[i].seq.store(0, std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = WAX9_SHARED_MAGIC;
+    }
+
+#ifdef _WIN32
+    header->writerId.store(GetCurrentProcessId());
+#else
+    header->writerId.store(getpid());
+#endif
+    return publisher;
+}
+
+void Wax9SharedPublisher::publish(Wax9 &device)
+{
+    // readings are stored newest first, publish them in arrival order
+    for (int i = device.getNumNewReadings() - 1; i >= 0; i--) {
+        publish(device.getReading(i));
+    }
+}
+
+void Wax9SharedPublisher::publish(const Wax9Sample &s)
+{
+    Wax9SharedHeader *header = mSegment.getHeader();
+    uint64_t index = header->writeIndex.load(std::memory_order_relaxed);
+    Wax9SharedSlot &slot = mSegment.getSlots()[index & (header->capacity - 1)];
+
+    // mark the slot as being written before touching the data
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Wax9SharedSample &out = slot.sample;
+    out.index = index;
+    out.hostTime = s.hostTime;
+    out.timestamp = s.timestamp;
+    out.sampleNumber = s.sampleNumber;
+    out.reserved = 0;
+    out.accLen = s.accLen;
+    for (int k = 0; k < 3; k++) {
+        out.acc[k] = s.acc[k];
+        out.gyr[k] = s.gyr[k];
+        out.mag[k] = s.mag[k];
+    }
+    out.rotAHRS[0] = s.rotAHRS.w; out.rotAHRS[1] = s.rotAHRS.x; out.rotAHRS[2] = s.rotAHRS.y; out.rotAHRS[3] = s.rotAHRS.z;
+    out.rotOGL[0]  = s.rotOGL.w;  out.rotOGL[1]  = s.rotOGL.x;  out.rotOGL[2]  = s.rotOGL.y;  out.rotOGL[3]  = s.rotOGL.z;
+
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+    header->writeIndex.store(index + 1, std::memory_order_release);
+}
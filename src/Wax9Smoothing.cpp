@@ -0,0 +1,193 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Smoothing.h"
+
+#include <cmath>
+#include <algorithm>
+
+// weight of the new value in a one-pole low-pass with this cutoff
+static inline float smoothingAlpha(float cutoff, float dt)
+{
+    float r = 2.0f * 3.14159265f * cutoff * dt;
+    return r / (r + 1.0f);
+}
+
+// components that decay towards zero end up as denormals, which are very slow on x86
+static inline float flush(float x)
+{
+    return std::abs(x) < 1e-20f ? 0.0f : x;
+}
+
+static inline ci::vec3 flush(const ci::vec3 &v)
+{
+    return ci::vec3(flush(v.x), flush(v.y), flush(v.z));
+}
+
+static Wax9SmoothSettings validate(const Wax9SmoothSettings &settings)
+{
+    Wax9SmoothSettings s = settings;
+    s.minCutoff = std::max(s.minCutoff, 0.001f);
+    s.dCutoff = std::max(s.dCutoff, 0.001f);
+    s.lag = std::min(std::max(s.lag, 1), WAX9_SMOOTH_MAX_LAG);
+    return s;
+}
+
+// Fixed lag starts with the window full of the first value, as if the signal had been
+// still before it. Returning raw values until it fills would jump back in time once it does
+template<typename T>
+static void prime(T *history, int size, const T &value)
+{
+    for (int i = 0; i < size; i++) history[i] = value;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark vectors
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9VectorSmoother::Wax9VectorSmoother()
+{
+    Wax9SmoothSettings settings = { WAX9_SMOOTH_OFF, 1.0f, 0.0f, 1.0f, 2 };
+    setup(settings);
+}
+
+void Wax9VectorSmoother::setup(const Wax9SmoothSettings &settings)
+{
+    mSettings = validate(settings);
+    reset();
+}
+
+ci::vec3 Wax9VectorSmoother::filter(const ci::vec3 &value, float dt)
+{
+    if (mSettings.mode == WAX9_SMOOTH_ONE_EURO) {
+        if (!bPrimed || dt <= 0.0f) {
+            bPrimed = true;
+            mValue = mPrevious = value;
+            mSpeed = ci::vec3(0);
+            return value;
+        }
+        mSpeed = flush(mSpeed + smoothingAlpha(mSettings.dCutoff, dt) * ((value - mPrevious) * (1.0f / dt) - mSpeed));
+        mPrevious = value;
+        float cutoff = mSettings.minCutoff + mSettings.beta * ci::length(mSpeed);
+        mValue = flush(mValue + smoothingAlpha(cutoff, dt) * (value - mValue));
+        return mValue;
+    }
+    else if (mSettings.mode == WAX9_SMOOTH_FIXED_LAG) {
+        // weights 1, 2 .. lag + 1 .. 2, 1 around the value lag samples ago
+        int size = 2 * mSettings.lag + 1;
+        if (!bPrimed) {
+            prime(mHistory, size, value);
+            bPrimed = true;
+        }
+        mHistory[mHead] = value;
+        if (++mHead == size) mHead = 0;
+
+        ci::vec3 sum(0);
+        int j = mHead;      // oldest
+        for (int i = 0; i < size; i++) {
+            float w = (float)(mSettings.lag + 1 - std::abs(i - mSettings.lag));
+            sum += w * mHistory[j];
+            if (++j == size) j = 0;
+        }
+        return sum / (float)((mSettings.lag + 1) * (mSettings.lag + 1));
+    }
+    return value;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark orientations
+/* -------------------------------------------------------------------------------------------------- */
+
+// q or -q, whichever is closer to reference
+static inline ci::quat align(const ci::quat &q, const ci::quat &reference)
+{
+    return ci::dot(q, reference) < 0.0f ? -q : q;
+}
+
+// nlerp, which is as good as slerp for the small steps between samples and much cheaper
+static inline ci::quat blend(const ci::quat &a, const ci::quat &b, float t)
+{
+    ci::quat c = align(b, a);
+    ci::quat q(flush(a.w + t * (c.w - a.w)), flush(a.x + t * (c.x - a.x)), flush(a.y + t * (c.y - a.y)), flush(a.z + t * (c.z - a.z)));
+    return ci::normalize(q);
+}
+
+Wax9OrientationSmoother::Wax9OrientationSmoother()
+{
+    Wax9SmoothSettings settings = { WAX9_SMOOTH_OFF, 1.0f, 0.0f, 1.0f, 2 };
+    setup(settings);
+}
+
+void Wax9OrientationSmoother::setup(const Wax9SmoothSettings &settings)
+{
+    mSettings = validate(settings);
+    reset();
+}
+
+ci::quat Wax9OrientationSmoother::filter(const ci::quat &value, float dt)
+{
+    if (mSettings.mode == WAX9_SMOOTH_ONE_EURO) {
+        if (!bPrimed || dt <= 0.0f) {
+            bPrimed = true;
+            mValue = mPrevious = value;
+            mSpeed = 0.0f;
+            return value;
+        }
+        // angle between consecutive orientations, 2 asin(|sin(angle / 2)|) ~ 2 sqrt(1 - cos^2) for small steps
+        float d = std::min(std::abs(ci::dot(value, mPrevious)), 1.0f);
+        float speed = 2.0f * std::sqrt(1.0f - d * d) / dt;
+        mSpeed = flush(mSpeed + smoothingAlpha(mSettings.dCutoff, dt) * (speed - mSpeed));
+        mPrevious = value;
+        float cutoff = mSettings.minCutoff + mSettings.beta * mSpeed;
+        mValue = blend(mValue, value, smoothingAlpha(cutoff, dt));
+        return mValue;
+    }
+    else if (mSettings.mode == WAX9_SMOOTH_FIXED_LAG) {
+        int size = 2 * mSettings.lag + 1;
+        if (!bPrimed) {
+            prime(mHistory, size, value);
+            bPrimed = true;
+        }
+        mHistory[mHead] = value;
+        if (++mHead == size) mHead = 0;
+
+        // weighted sum in the hemisphere of the center value, then normalised
+        const ci::quat &center = mHistory[(mHead + mSettings.lag) % size];
+        ci::quat sum(0.0f, 0.0f, 0.0f, 0.0f);
+        int j = mHead;
+        for (int i = 0; i < size; i++) {
+            float w = (float)(mSettings.lag + 1 - std::abs(i - mSettings.lag));
+            if (ci::dot(mHistory[j], center) < 0.0f) w = -w;
+            const ci::quat &q = mHistory[j];
+            sum = ci::quat(sum.w + w * q.w, sum.x + w * q.x, sum.y + w * q.y, sum.z + w * q.z);
+            if (++j == size) j = 0;
+        }
+        return ci::normalize(sum);
+    }
+    return value;
+}
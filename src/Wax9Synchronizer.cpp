@@ -0,0 +1,161 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Synchronizer.h"
+
+#include <cmath>
+#include <limits>
+
+Wax9Synchronizer::Wax9Synchronizer(float frameRate, double maxLatency)
+{
+    mPeriod = 1.0 / max(frameRate, 1.0f);
+    mMaxLatency = maxLatency;
+    reset();
+}
+
+size_t Wax9Synchronizer::addDevice(Wax9 &device)
+{
+    Wax9SyncDeviceStats stats = {};
+    mDevices.push_back(&device);
+    mStats.push_back(stats);
+    mFrame.samples.resize(mDevices.size());
+    mFrame.status.resize(mDevices.size(), WAX9_SYNC_MISSING);
+    return mDevices.size() - 1;
+}
+
+void Wax9Synchronizer::reset()
+{
+    bStarted = false;
+    mNextTick = 0;
+    mNumFrames = 0;
+    mNumSkipped = 0;
+    mLatencySum = 0.0;
+    mLatencyMax = 0.0;
+    for (size_t d = 0; d < mStats.size(); d++) {
+        mStats[d].numLate = 0;
+        mStats[d].numMissing = 0;
+    }
+}
+
+size_t Wax9Synchronizer::update(double hostTime)
+{
+    size_t numDevices = mDevices.size();
+    if (numDevices == 0) return 0;
+
+    // where each device's history starts and ends on the host timeline
+    const double none = -std::numeric_limits<double>::infinity();
+    double watermark = std::numeric_limits<double>::infinity();
+    double newestOfAll = none, oldestCommon = none;
+    mNewest.assign(numDevices, none);
+    mOldest.assign(numDevices, none);
+    for (size_t d = 0; d < numDevices; d++) {
+        Wax9 *device = mDevices[d];
+        if (!device->isConnected() || !device->hasReadings()) continue;
+        mNewest[d] = device->getSampleTime(0);
+        mOldest[d] = device->getSampleTime(device->getNumReadings() - 1);
+        watermark = min(watermark, mNewest[d]);
+        newestOfAll = max(newestOfAll, mNewest[d]);
+        oldestCommon = max(oldestCommon, mOldest[d]);
+    }
+    if (newestOfAll == none) return 0;
+
+    // complete frames up to the slowest device, late ones once they are maxLatency old,
+    // but nothing past the newest reading since there'd be nothing to show
+    double limit = min(max(watermark, hostTime - mMaxLatency), newestOfAll);
+    if (limit < 0.0) return 0;
+
+    if (!bStarted) {
+        // start at the newest frame rather than replaying the histories
+        mNextTick = (uint64_t)floor(limit / mPeriod);
+        bStarted = true;
+    }
+    uint64_t firstTick = oldestCommon > 0.0 ? (uint64_t)ceil(oldestCommon / mPeriod) : 0;
+    if (mNextTick < firstTick) {
+        mNumSkipped += firstTick - mNextTick;
+        mNextTick = firstTick;
+    }
+
+    mTicks.clear();
+    while (mNextTick * mPeriod <= limit) {
+        mTicks.push_back(mNextTick * mPeriod);
+        mNextTick++;
+    }
+    size_t count = mTicks.size();
+    if (count == 0) return 0;
+
+    // one resampling pass per device for all the due frames
+    mSamples.resize(count * numDevices);
+    for (size_t d = 0; d < numDevices; d++) {
+        if (mNewest[d] != none) mDevices[d]->samplesAt(&mTicks[0], count, &mSamples[d * count]);
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        mFrame.index = mNumFrames++;
+        mFrame.time = mTicks[k];
+        mFrame.latency = hostTime - mTicks[k];
+        mFrame.numLate = 0;
+
+        for (size_t d = 0; d < numDevices; d++) {
+            if (mNewest[d] == none) {
+                mFrame.status[d] = WAX9_SYNC_MISSING;
+                mFrame.samples[d] = Wax9Sample();
+                mStats[d].numMissing++;
+                mFrame.numLate++;
+            }
+            else {
+                bool late = mTicks[k] > mNewest[d];
+                mFrame.status[d] = late ? WAX9_SYNC_LATE : WAX9_SYNC_INTERPOLATED;
+                mFrame.samples[d] = mSamples[d * count + k];
+                if (late) {
+                    mStats[d].numLate++;
+                    mFrame.numLate++;
+                }
+            }
+        }
+
+        mLatencySum += mFrame.latency;
+        mLatencyMax = max(mLatencyMax, mFrame.latency);
+        if (mCallback) mCallback(mFrame);
+    }
+
+    updateStats(mTicks[count - 1]);
+    return count;
+}
+
+void Wax9Synchronizer::updateStats(double frameTime)
+{
+    for (size_t d = 0; d < mDevices.size(); d++) {
+        const Wax9ClockMap &clock = mDevices[d]->getClock();
+        Wax9SyncDeviceStats &s = mStats[d];
+        s.offset = clock.isValid() ? clock.getOffset() : 0.0;
+        s.drift = clock.getDrift() * 1e6;
+        s.relativeDrift = s.drift - mStats[0].drift;
+        s.excessDelay = clock.getExcessDelay();
+        s.lag = std::isinf(mNewest[d]) ? 0.0 : frameTime - mNewest[d];
+    }
+}
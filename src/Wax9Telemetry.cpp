@@ -0,0 +1,154 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Telemetry.h"
+#include "Wax9Log.h"
+
+#include <cmath>
+#include <cstdio>
+
+// Battery discharge is estimated over windows of at least this long, otherwise
+// the mV quantization of the readings dominates the slope
+#define DISCHARGE_WINDOW_MS     60000ull
+
+Wax9Telemetry::Wax9Telemetry()
+{
+    bDebug = false;
+    mBatteryLowLevel = 3500.0f;
+    mBatteryCutoff = 3300.0f;
+
+    mTimeConstants[WAX9_TELEMETRY_BATTERY]      = 60.0f;
+    mTimeConstants[WAX9_TELEMETRY_TEMPERATURE]  = 10.0f;
+    mTimeConstants[WAX9_TELEMETRY_PRESSURE]     = 2.0f;
+
+    reset();
+}
+
+void Wax9Telemetry::reset()
+{
+    for (int i = 0; i < WAX9_TELEMETRY_NUM_CHANNELS; i++) {
+        Wax9TelemetryValue &v = mValues[i];
+        v.valid = false;
+        v.value = 0.0f;
+        v.smoothed = 0.0f;
+        v.timestamp = 0;
+        v.ticks = 0;
+        v.changedTicks = 0;
+        v.numReadings = 0;
+    }
+    mDischargeRate = 0.0f;
+    mDischargeRefValue = 0.0f;
+    mDischargeRefTicks = 0;
+}
+
+void Wax9Telemetry::update(unsigned short battery, short temperature, uint32_t pressure, uint32_t timestamp, unsigned long long ticks)
+{
+    if (battery != 0xffff) {
+        updateChannel(WAX9_TELEMETRY_BATTERY, (float)battery, timestamp, ticks);
+        updateDischargeRate(ticks);
+    }
+    if (temperature != -1) {
+        updateChannel(WAX9_TELEMETRY_TEMPERATURE, (float)temperature * 0.1f, timestamp, ticks);
+    }
+    if (pressure != 0xfffffffful) {
+        updateChannel(WAX9_TELEMETRY_PRESSURE, (float)pressure, timestamp, ticks);
+    }
+}
+
+float Wax9Telemetry::getBatteryTimeRemaining() const
+{
+    if (!hasBattery() || mDischargeRate <= 0.0f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    float left = getBatterySmoothed() - mBatteryCutoff;
+    if (left <= 0.0f) return 0.0f;
+    return left / mDischargeRate * 3600.0f;
+}
+
+void Wax9Telemetry::updateChannel(Wax9TelemetryChannel channel, float value, uint32_t timestamp, unsigned long long ticks)
+{
+    Wax9TelemetryValue &v = mValues[channel];
+    float previous = v.value;
+    bool changed = !v.valid || value != previous;
+
+    // exponential smoothing using the real time between readings, since they arrive irregularly
+    if (!v.valid) {
+        v.smoothed = value;
+    }
+    else {
+        float dt = (float)(ticks - v.ticks) / 1000.0f;
+        float alpha = 1.0f - expf(-dt / mTimeConstants[channel]);
+        v.smoothed += (value - v.smoothed) * alpha;
+    }
+
+    v.valid = true;
+    v.value = value;
+    v.timestamp = timestamp;
+    v.ticks = ticks;
+    v.numReadings++;
+
+    if (changed) {
+        v.changedTicks = ticks;
+
+        if (bDebug) {
+            static const char *names[] = { "battery", "temperature", "pressure" };
+            static const char *units[] = { "millivolts", "celsius", "pascals" };
+            static Wax9LogMessage sChanged(WAX9_LOG_DEBUG, "WAX9 - %s: %g %s");
+            Wax9Log::get().log(sChanged, names[channel], value, units[channel]);
+        }
+
+        Wax9TelemetryEvent e;
+        e.channel = channel;
+        e.value = value;
+        e.previous = previous;
+        e.state = v;
+        mSignalChanged.emit(e);
+    }
+}
+
+void Wax9Telemetry::updateDischargeRate(unsigned long long ticks)
+{
+    const Wax9TelemetryValue &v = mValues[WAX9_TELEMETRY_BATTERY];
+
+    if (mDischargeRefTicks == 0 || ticks < mDischargeRefTicks) {
+        mDischargeRefTicks = ticks;
+        mDischargeRefValue = v.smoothed;
+        return;
+    }
+
+    unsigned long long elapsed = ticks - mDischargeRefTicks;
+    if (elapsed < DISCHARGE_WINDOW_MS) return;
+
+    // mV lost per hour over the last window, smoothed with the previous windows
+    float hours = (float)elapsed / 3600000.0f;
+    float rate = (mDischargeRefValue - v.smoothed) / hours;
+    mDischargeRate = (mDischargeRate == 0.0f) ? rate : mDischargeRate * 0.75f + rate * 0.25f;
+
+    mDischargeRefTicks = ticks;
+    mDischargeRefValue = v.smoothed;
+}
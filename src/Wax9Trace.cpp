@@ -0,0 +1,290 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+    #include <intrin.h>
+#endif
+
+static inline int highestBit(uint64_t v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanReverse64(&i, v);
+    return (int)i;
+#elif defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int i = 0;
+    while (v >>= 1) i++;
+    return i;
+#endif
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark histogram
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9LatencyHistogram::reset()
+{
+    memset(mCounts, 0, sizeof(mCounts));
+    mCount = 0;
+    mMin = 0;
+    mMax = 0;
+    mSum = 0.0;
+}
+
+// values below 32 have a bucket each, above that every power of two is split in 32
+size_t Wax9LatencyHistogram::indexOf(uint64_t ns)
+{
+    const uint64_t subCount = (uint64_t)1 << WAX9_HISTOGRAM_SUB_BITS;
+    if (ns < subCount) return (size_t)ns;
+    ns = std::min(ns, ((uint64_t)1 << WAX9_HISTOGRAM_MAX_BITS) - 1);
+
+    int shift = highestBit(ns) - WAX9_HISTOGRAM_SUB_BITS;
+    return (size_t)(((shift + 1) << WAX9_HISTOGRAM_SUB_BITS) + (ns >> shift) - subCount);
+}
+
+uint64_t Wax9LatencyHistogram::highestValue(size_t index)
+{
+    const uint64_t subCount = (uint64_t)1 << WAX9_HISTOGRAM_SUB_BITS;
+    size_t bucket = index >> WAX9_HISTOGRAM_SUB_BITS;
+    uint64_t sub = index & (subCount - 1);
+    if (bucket == 0) return sub;
+    return ((subCount + sub + 1) << (bucket - 1)) - 1;
+}
+
+void Wax9LatencyHistogram::record(uint64_t ns)
+{
+    mCounts[indexOf(ns)]++;
+    mMin = mCount == 0 ? ns : std::min(mMin, ns);
+    mMax = std::max(mMax, ns);
+    mSum += (double)ns;
+    mCount++;
+}
+
+void Wax9LatencyHistogram::merge(const Wax9LatencyHistogram &other)
+{
+    if (other.mCount == 0) return;
+    for (size_t i = 0; i < WAX9_HISTOGRAM_SIZE; i++) mCounts[i] += other.mCounts[i];
+    mMin = mCount == 0 ? other.mMin : std::min(mMin, other.mMin);
+    mMax = std::max(mMax, other.mMax);
+    mSum += other.mSum;
+    mCount += other.mCount;
+}
+
+uint64_t Wax9LatencyHistogram::getPercentile(double percent) const
+{
+    if (mCount == 0) return 0;
+
+    uint64_t target = (uint64_t)ceil(std::min(std::max(percent, 0.0), 100.0) / 100.0 * mCount);
+    target = std::max(target, (uint64_t)1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < WAX9_HISTOGRAM_SIZE; i++) {
+        seen += mCounts[i];
+        if (seen >= target) return std::min(highestValue(i), mMax);
+    }
+    return mMax;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark trace
+/* -------------------------------------------------------------------------------------------------- */
+
+uint64_t Wax9Trace::now()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Wax9Trace::Wax9Trace(size_t capacity)
+{
+    mStart = now();
+    mEvents.resize(std::max(capacity, (size_t)1));
+    mNumEvents = 0;
+}
+
+int Wax9Trace::addTrack(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::unique_ptr<Track> track(new Track());
+    track->name = name;
+    track->lastLatency = 0;
+    mTracks.push_back(std::move(track));
+    return (int)mTracks.size() - 1;
+}
+
+void Wax9Trace::span(int track, Wax9TraceSpan span, uint64_t start, uint64_t end, uint32_t count)
+{
+    uint64_t duration = end > start ? end - start : 0;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    Track &t = *mTracks[track];
+    t.spans[span].record(duration);
+
+    Event &e = mEvents[mNumEvents % mEvents.size()];
+    e.start = start > mStart ? start - mStart : 0;
+    e.duration = duration;
+    e.count = count;
+    e.track = (uint16_t)track;
+    e.span = (uint8_t)span;
+    e.latency = t.lastLatency;
+    mNumEvents++;
+}
+
+void Wax9Trace::latency(int track, Wax9TraceLatency latency, const double *seconds, size_t count)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    Track &t = *mTracks[track];
+    for (size_t i = 0; i < count; i++) {
+        uint64_t ns = seconds[i] > 0.0 ? (uint64_t)(seconds[i] * 1e9) : 0;
+        t.latencies[latency].record(ns);
+        if (latency == WAX9_LATENCY_END_TO_END) t.lastLatency = ns;
+    }
+}
+
+Wax9LatencyHistogram Wax9Trace::getHistogram(int track, Wax9TraceSpan span) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTracks.at(track)->spans[span];
+}
+
+Wax9LatencyHistogram Wax9Trace::getHistogram(int track, Wax9TraceLatency latency) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTracks.at(track)->latencies[latency];
+}
+
+size_t Wax9Trace::getNumTracks() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTracks.size();
+}
+
+uint64_t Wax9Trace::getNumSpans() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mNumEvents;
+}
+
+void Wax9Trace::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mNumEvents = 0;
+    for (size_t i = 0; i < mTracks.size(); i++) {
+        for (int s = 0; s < WAX9_NUM_SPANS; s++) mTracks[i]->spans[s].reset();
+        for (int l = 0; l < WAX9_NUM_LATENCIES; l++) mTracks[i]->latencies[l].reset();
+        mTracks[i]->lastLatency = 0;
+    }
+}
+
+static const char *sSpanNames[WAX9_NUM_SPANS] = { "update", "read", "decode", "parse", "fuse", "store", "deliver" };
+static const char *sLatencyNames[WAX9_NUM_LATENCIES] = { "process", "end to end" };
+
+static void printHistogram(std::ostream &os, const char *name, const Wax9LatencyHistogram &h)
+{
+    os << "  " << std::left << std::setw(12) << name << std::right << std::setw(10) << h.getCount()
+       << std::fixed << std::setprecision(1)
+       << std::setw(10) << h.getPercentile(50.0) / 1000.0
+       << std::setw(10) << h.getPercentile(90.0) / 1000.0
+       << std::setw(10) << h.getPercentile(99.0) / 1000.0
+       << std::setw(10) << h.getPercentile(99.9) / 1000.0
+       << std::setw(10) << h.getMax() / 1000.0 << std::endl;
+}
+
+void Wax9Trace::printReport(std::ostream &os) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (size_t i = 0; i < mTracks.size(); i++) {
+        const Track &t = *mTracks[i];
+        os << t.name << " (us)        count       p50       p90       p99     p99.9       max" << std::endl;
+        for (int s = 0; s < WAX9_NUM_SPANS; s++) printHistogram(os, sSpanNames[s], t.spans[s]);
+        for (int l = 0; l < WAX9_NUM_LATENCIES; l++) printHistogram(os, sLatencyNames[l], t.latencies[l]);
+    }
+}
+
+static void writeJsonString(std::ostream &os, const std::string &s)
+{
+    os << '"';
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') os << '\\' << c;
+        else if (c < 0x20) os << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 15];
+        else os << c;
+    }
+    os << '"';
+}
+
+void Wax9Trace::writeChromeTrace(std::ostream &os) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const char *separator = "\n";
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < mTracks.size(); i++) {
+        os << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1 << ",\"args\":{\"name\":";
+        writeJsonString(os, mTracks[i]->name);
+        os << "}}";
+        separator = ",\n";
+    }
+
+    // ts and dur are in microseconds
+    os << std::fixed << std::setprecision(3);
+    uint64_t size = mEvents.size();
+    uint64_t first = mNumEvents > size ? mNumEvents - size : 0;
+    for (uint64_t n = first; n < mNumEvents; n++) {
+        const Event &e = mEvents[n % size];
+        int tid = e.track + 1;
+        os << separator << "{\"name\":\"" << sSpanNames[e.span] << "\",\"cat\":\"wax9\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+           << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0
+           << ",\"args\":{\"samples\":" << e.count << "}}";
+        separator = ",\n";
+        if (e.span == WAX9_SPAN_UPDATE) {
+            os << separator << "{\"name\":";
+            writeJsonString(os, mTracks[e.track]->name + " latency");
+            os << ",\"ph\":\"C\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << (e.start + e.duration) / 1000.0
+               << ",\"args\":{\"end to end ms\":" << e.latency / 1e6 << "}}";
+        }
+    }
+    os << "\n]}\n";
+}
+
+bool Wax9Trace::writeChromeTrace(const std::string &path) const
+{
+    std::ofstream file(path.c_str());
+    if (!file) return false;
+    writeChromeTrace(file);
+    return (bool)file;
+}
@@ -0,0 +1,434 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WIN32
+    #include <termios.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <poll.h>
+    #include <dirent.h>
+    #include <errno.h>
+    #include <sys/ioctl.h>
+    #if defined(__linux__)
+        #include <linux/serial.h>
+    #elif defined(__APPLE__)
+        #include <IOKit/serial/ioss.h>
+    #endif
+#endif
+
+#include "Wax9Transport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark transport
+/* -------------------------------------------------------------------------------------------------- */
+
+bool Wax9Transport::fill(double timeout)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    mReadPos = 0;
+    mReadEnd = readSome(mReadBuffer, WAX9_TRANSPORT_BUFFER_SIZE, timeout);
+    mReadTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return mReadEnd > 0;
+}
+
+size_t Wax9Transport::read(void *data, size_t size, double timeout)
+{
+    uint8_t *p = (uint8_t *)data;
+    size_t count = std::min(size, mReadEnd - mReadPos);
+    memcpy(p, mReadBuffer + mReadPos, count);
+    mReadPos += count;
+
+    // large reads skip the buffer
+    while (count < size) {
+        size_t n = readSome(p + count, size - count, timeout);
+        if (n == 0) break;
+        count += n;
+    }
+    return count;
+}
+
+std::string Wax9Transport::readLine(double timeout)
+{
+    std::string line;
+    double end = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() + timeout;
+    uint8_t c;
+
+    while (true) {
+        double left = end - std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (left <= 0.0 || !readByte(c, left)) break;
+        if (c == '\n') break;
+        line += (char)c;
+    }
+    return line;
+}
+
+void Wax9Transport::discardInput()
+{
+    mReadPos = mReadEnd = 0;
+    size_t n;
+    while ((n = available()) > 0) {
+        if (readSome(mReadBuffer, std::min(n, (size_t)WAX9_TRANSPORT_BUFFER_SIZE), 0.0) == 0) break;
+    }
+    mReadPos = mReadEnd = 0;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark cinder serial
+/* -------------------------------------------------------------------------------------------------- */
+
+#ifndef WAX9_HEADLESS
+
+Wax9SerialTransportRef Wax9SerialTransport::create(const std::string &portName, int baudRate)
+{
+    try {
+#ifdef CINDER_MSW
+        // finding serial devices is bugged in Windows
+        // see https://github.com/cinder/Cinder/issues/1064
+        ci::Serial::Device device(portName);
+#else
+        ci::Serial::Device device = ci::Serial::findDeviceByNameContains(portName);
+#endif
+        return create(ci::Serial::create(device, baudRate));
+    }
+    catch (const ci::SerialExc &e) {
+        fprintf(stderr, "WARNING: unable to open %s: %s\n", portName.c_str(), e.what());
+    }
+    return Wax9SerialTransportRef();
+}
+
+Wax9SerialTransportRef Wax9SerialTransport::create(ci::SerialRef serial)
+{
+    if (!serial) return Wax9SerialTransportRef();
+    return Wax9SerialTransportRef(new Wax9SerialTransport(serial));
+}
+
+std::string Wax9SerialTransport::getName() const
+{
+    return mSerial ? mSerial->getDevice().getName() : std::string();
+}
+
+size_t Wax9SerialTransport::write(const void *data, size_t size)
+{
+    if (!mSerial) return 0;
+    try {
+        mSerial->writeBytes(data, size);
+        return size;
+    }
+    catch (const ci::SerialExc &e) {
+        return 0;
+    }
+}
+
+size_t Wax9SerialTransport::available()
+{
+    return mSerial ? mSerial->getNumBytesAvailable() : 0;
+}
+
+size_t Wax9SerialTransport::readSome(void *data, size_t size, double timeout)
+{
+    if (!mSerial) return 0;
+
+    // cinder::Serial can only block without a timeout, so poll for the first byte
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(timeout * 1e6));
+    size_t n;
+    while ((n = mSerial->getNumBytesAvailable()) == 0) {
+        if (std::chrono::steady_clock::now() >= end) return 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    try {
+        return mSerial->readAvailableBytes(data, std::min(n, size));
+    }
+    catch (const ci::SerialExc &e) {
+        return 0;
+    }
+}
+
+#endif
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark posix
+/* -------------------------------------------------------------------------------------------------- */
+
+#ifndef _WIN32
+
+static speed_t getSpeed(int baudRate)
+{
+    switch (baudRate) {
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 230400:    return B230400;
+        default:        return B115200;
+    }
+}
+
+Wax9PosixTransport::Wax9PosixTransport()
+{
+    mFd = -1;
+    bLowLatency = false;
+}
+
+Wax9PosixTransport::~Wax9PosixTransport()
+{
+    close();
+}
+
+Wax9PosixTransportRef Wax9PosixTransport::create(const std::string &path, int baudRate)
+{
+    std::string device = findDevice(path);
+    Wax9PosixTransportRef transport(new Wax9PosixTransport());
+    if (device.empty() || !transport->open(device, baudRate)) {
+        fprintf(stderr, "WARNING: unable to open %s: %s\n", path.c_str(), device.empty() ? "no such device" : strerror(errno));
+        return Wax9PosixTransportRef();
+    }
+    return transport;
+}
+
+bool Wax9PosixTransport::open(const std::string &path, int baudRate)
+{
+    // O_NONBLOCK so opening doesn't wait for carrier detect
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) return false;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // raw 8N1, no flow control. VMIN = VTIME = 0 makes read() return whatever is queued
+    // right away, waiting is done with poll() so a single read can take a whole burst
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, getSpeed(baudRate));
+    cfsetospeed(&tio, getSpeed(baudRate));
+
+    if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+        ::close(fd);
+        return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    // ask the driver to hand over bytes as soon as they arrive instead of batching them.
+    // rfcomm and some USB adapters don't support it, which is fine
+#if defined(__linux__)
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        bLowLatency = ioctl(fd, TIOCSSERIAL, &serial) == 0;
+    }
+#elif defined(__APPLE__)
+    unsigned long latency = 1;  // microseconds
+    bLowLatency = ioctl(fd, IOSSDATALAT, &latency) == 0;
+#endif
+
+    tcflush(fd, TCIOFLUSH);
+    mFd = fd;
+    mPath = path;
+    return true;
+}
+
+void Wax9PosixTransport::close()
+{
+    if (mFd >= 0) ::close(mFd);
+    mFd = -1;
+}
+
+size_t Wax9PosixTransport::write(const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    size_t written = 0;
+    while (mFd >= 0 && written < size) {
+        ssize_t n = ::write(mFd, p + written, size - written);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            break;
+        }
+        written += n;
+    }
+    return written;
+}
+
+size_t Wax9PosixTransport::available()
+{
+    int n = 0;
+    if (mFd < 0 || ioctl(mFd, FIONREAD, &n) != 0) return 0;
+    return n > 0 ? (size_t)n : 0;
+}
+
+size_t Wax9PosixTransport::readSome(void *data, size_t size, double timeout)
+{
+    if (mFd < 0) return 0;
+
+    struct pollfd pfd;
+    pfd.fd = mFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ready;
+    do {
+        ready = poll(&pfd, 1, (int)std::ceil(std::max(timeout, 0.0) * 1000.0));
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) return 0;
+
+    if (pfd.revents & POLLIN) {
+        ssize_t n;
+        do {
+            n = ::read(mFd, data, size);
+        } while (n < 0 && errno == EINTR);
+        if (n > 0) return (size_t)n;
+    }
+
+    // readable with nothing to read, or an error: the device went away
+    if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL | POLLIN)) close();
+    return 0;
+}
+
+std::vector<std::string> Wax9PosixTransport::getDevices()
+{
+    static const char *prefixes[] = { "rfcomm", "ttyUSB", "ttyACM", "ttyS", "ttyAMA", "tty.", "cu." };
+    std::vector<std::string> devices;
+
+    DIR *dir = opendir("/dev");
+    if (dir == NULL) return devices;
+    while (struct dirent *entry = readdir(dir)) {
+        for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+            if (strncmp(entry->d_name, prefixes[i], strlen(prefixes[i])) == 0) {
+                devices.push_back(std::string("/dev/") + entry->d_name);
+                break;
+            }
+        }
+    }
+    closedir(dir);
+    std::sort(devices.begin(), devices.end());
+    return devices;
+}
+
+std::string Wax9PosixTransport::findDevice(const std::string &nameContains)
+{
+    if (!nameContains.empty() && nameContains[0] == '/') return nameContains;
+
+    std::vector<std::string> devices = getDevices();
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i].find(nameContains) != std::string::npos) return devices[i];
+    }
+    return std::string();
+}
+
+#endif
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark memory
+/* -------------------------------------------------------------------------------------------------- */
+
+bool Wax9MemoryTransport::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return bOpen;
+}
+
+void Wax9MemoryTransport::close()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    bOpen = false;
+    mCondition.notify_all();
+}
+
+size_t Wax9MemoryTransport::write(const void *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!bOpen) return 0;
+    mWritten.append((const char *)data, size);
+    return size;
+}
+
+void Wax9MemoryTransport::push(const void *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mInput.insert(mInput.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+    mCondition.notify_all();
+}
+
+void Wax9MemoryTransport::pushSlip(const void *packet, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)packet;
+    std::vector<uint8_t> encoded;
+    encoded.reserve(size * 2 + 2);
+    encoded.push_back(0xC0);
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] == 0xC0)       { encoded.push_back(0xDB); encoded.push_back(0xDC); }
+        else if (p[i] == 0xDB)  { encoded.push_back(0xDB); encoded.push_back(0xDD); }
+        else                    encoded.push_back(p[i]);
+    }
+    encoded.push_back(0xC0);
+    push(encoded.data(), encoded.size());
+}
+
+std::string Wax9MemoryTransport::getWritten()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mWritten;
+}
+
+void Wax9MemoryTransport::clearWritten()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mWritten.clear();
+}
+
+size_t Wax9MemoryTransport::available()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mInput.size();
+}
+
+size_t Wax9MemoryTransport::readSome(void *data, size_t size, double timeout)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mInput.empty() && bOpen && timeout > 0.0) {
+        mCondition.wait_for(lock, std::chrono::microseconds((long long)(timeout * 1e6)), [this] { return !mInput.empty() || !bOpen; });
+    }
+
+    size_t n = std::min(size, mInput.size());
+    std::copy(mInput.begin(), mInput.begin() + n, (uint8_t *)data);
+    mInput.erase(mInput.begin(), mInput.begin() + n);
+    return n;
+}
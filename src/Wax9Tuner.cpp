@@ -0,0 +1,320 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9Tuner.h"
+#include "Wax9Recording.h"
+
+#include <cmath>
+
+#define MOTION_WINDOW   0.25f   // seconds over which gyro magnitude is averaged to judge motion
+
+static const char* sProfileNames[Wax9Tuner::NUM_PROFILES] = { "all", "slow", "fast" };
+
+static double secondsNow()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline float clampUnit(float v)  { return v > 1.0f ? 1.0f : (v < -1.0f ? -1.0f : v); }
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark constructors and setup
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9Tuner::Wax9Tuner(int numThreads) : mPool(numThreads)
+{
+    mNumSamples = 0;
+    mSampleFreq = 120.0f;
+    mFusionSettings = Wax9Fusion::getDefaultSettings();
+    mStillGyro = 0.05f;     // rad/s, about 3 deg/s
+    mStillAcc = 0.03f;      // g away from 1
+    mStillSeconds = 0.5f;
+    mFastGyro = 2.0f;       // rad/s, about 115 deg/s
+    mSeconds = 0.0;
+}
+
+bool Wax9Tuner::loadRecording(const std::string &path, size_t maxSamples)
+{
+    Wax9RecordingReader reader;
+    if (!reader.open(path)) return false;
+
+    std::vector<Wax9Sample> samples;
+    std::vector<Wax9RecordedPacket> packets;
+    Wax9ChunkHeader header;
+    while (reader.readChunk(header, packets)) {
+        for (size_t i = 0; i < packets.size(); i++) {
+            if (maxSamples > 0 && samples.size() >= maxSamples) break;
+            Wax9Sample s;
+            Wax9::convertPacket(packets[i].packet, s);
+            samples.push_back(s);
+        }
+        if (maxSamples > 0 && samples.size() >= maxSamples) break;
+    }
+    setSamples(samples, (float)reader.getOutputRate());
+    return !samples.empty();
+}
+
+void Wax9Tuner::setSamples(const std::vector<Wax9Sample> &samples, float sampleFreq)
+{
+    mNumSamples = samples.size();
+    mSampleFreq = sampleFreq;
+    mGyr.resize(mNumSamples * 3);
+    mAcc.resize(mNumSamples * 3);
+    mMag.resize(mNumSamples * 3);
+    mTimestamps.resize(mNumSamples);
+    for (size_t i = 0; i < mNumSamples; i++) {
+        mTimestamps[i] = samples[i].timestamp;
+        for (int k = 0; k < 3; k++) {
+            mGyr[3 * i + k] = samples[i].gyr[k];
+            mAcc[3 * i + k] = samples[i].acc[k];
+            mMag[3 * i + k] = samples[i].mag[k];
+        }
+    }
+}
+
+void Wax9Tuner::addMadgwickSweep(float betaMin, float betaMax, int steps)
+{
+    Config config;
+    config.mode = 0;
+    config.twoKi = 0.0f;
+    for (int i = 0; i < steps; i++) {
+        float t = steps > 1 ? (float)i / (steps - 1) : 0.0f;
+        config.twoKp = betaMin * powf(betaMax / betaMin, t);
+        mConfigs.push_back(config);
+    }
+}
+
+void Wax9Tuner::addMahonySweep(float kpMin, float kpMax, int kpSteps, float kiMin, float kiMax, int kiSteps)
+{
+    Config config;
+    config.mode = 1;
+    for (int i = 0; i < kpSteps; i++) {
+        float s = kpSteps > 1 ? (float)i / (kpSteps - 1) : 0.0f;
+        config.twoKp = kpMin * powf(kpMax / kpMin, s);
+        for (int j = 0; j < kiSteps; j++) {
+            float t = kiSteps > 1 ? (float)j / (kiSteps - 1) : 0.0f;
+            // no integral term is a common choice, so a zero minimum sweeps linearly
+            config.twoKi = kiMin > 0.0f ? kiMin * powf(kiMax / kiMin, t) : kiMin + (kiMax - kiMin) * t;
+            mConfigs.push_back(config);
+        }
+    }
+}
+
+const char* Wax9Tuner::getProfileName(Profile profile)
+{
+    return sProfileNames[profile];
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark scoring
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9Tuner::prepareScoring()
+{
+    size_t n = mNumSamples;
+    mScoreMask.assign(n, 0);
+    mReference.assign(n, vec3(0.0f));
+
+    // motion intensity: gyro magnitude averaged over a short window
+    std::vector<float> motion(n);
+    size_t window = std::max<size_t>(1, (size_t)(MOTION_WINDOW * mSampleFreq));
+    double sum = 0.0;
+    std::vector<float> magnitude(n);
+    for (size_t i = 0; i < n; i++) {
+        vec3 g = vec3(mGyr[3 * i], mGyr[3 * i + 1], mGyr[3 * i + 2]) - mFusionSettings.gyroDelta;
+        magnitude[i] = length(g);
+        sum += magnitude[i];
+        if (i >= window) sum -= magnitude[i - window];
+        motion[i] = (float)(sum / std::min(i + 1, window));
+    }
+
+    if (mGroundTruth.size() == n) {
+        for (size_t i = 0; i < n; i++) {
+            mScoreMask[i] = (1 << PROFILE_ALL) | (1 << (motion[i] >= mFastGyro ? PROFILE_FAST : PROFILE_SLOW));
+        }
+        return;
+    }
+
+    // still periods, scored only after some motion so the initial convergence isn't counted
+    size_t minLength = std::max<size_t>(1, (size_t)(mStillSeconds * mSampleFreq));
+    float peakMotion = 0.0f;
+    size_t i = 0;
+    while (i < n) {
+        size_t start = i;
+        while (i < n) {
+            float accLen = sqrtf(mAcc[3 * i] * mAcc[3 * i] + mAcc[3 * i + 1] * mAcc[3 * i + 1] + mAcc[3 * i + 2] * mAcc[3 * i + 2]);
+            if (magnitude[i] >= mStillGyro || fabsf(accLen - 1.0f) >= mStillAcc) break;
+            i++;
+        }
+        size_t length = i - start;
+
+        if (length >= minLength && peakMotion > 0.0f) {
+            vec3 mean(0.0f);
+            for (size_t k = start; k < i; k++) mean += vec3(mAcc[3 * k], mAcc[3 * k + 1], mAcc[3 * k + 2]);
+            vec3 reference = normalize(mean);
+            uint8_t mask = (1 << PROFILE_ALL) | (1 << (peakMotion >= mFastGyro ? PROFILE_FAST : PROFILE_SLOW));
+            for (size_t k = start; k < i; k++) {
+                mScoreMask[k] = mask;
+                mReference[k] = reference;
+            }
+            peakMotion = 0.0f;
+        }
+        if (i < n) {
+            peakMotion = std::max(peakMotion, motion[i]);
+            i++;
+        }
+    }
+}
+
+void Wax9Tuner::runGroup(size_t first, size_t count)
+{
+    std::vector<Wax9Fusion> fusion(count);
+    double sum[GROUP_SIZE][NUM_PROFILES];
+    uint64_t numScored[NUM_PROFILES] = { 0 };
+    bool groundTruth = mGroundTruth.size() == mNumSamples;
+
+    for (size_t k = 0; k < count; k++) {
+        const Config &config = mConfigs[first + k];
+        Wax9FusionSettings settings = mFusionSettings;
+        settings.algorithm = (Wax9AhrsAlgorithm)config.mode;
+        settings.twoKp = config.twoKp;
+        settings.twoKi = config.twoKi;
+        fusion[k].setup(settings, (int)(mSampleFreq + 0.5f));
+        if (groundTruth) fusion[k].reset(mGroundTruth[0]);
+        for (int p = 0; p < NUM_PROFILES; p++) sum[k][p] = 0.0;
+    }
+
+    Wax9Sample sample = Wax9Sample();
+    for (size_t i = 0; i < mNumSamples; i++) {
+        // fused like a live Wax9, which takes dt from the device clock and the gyro delta off itself
+        sample.timestamp = mTimestamps[i];
+        sample.gyr = vec3(mGyr[3 * i], mGyr[3 * i + 1], mGyr[3 * i + 2]);
+        sample.acc = vec3(mAcc[3 * i], mAcc[3 * i + 1], mAcc[3 * i + 2]);
+        sample.mag = vec3(mMag[3 * i], mMag[3 * i + 1], mMag[3 * i + 2]);
+        quat rot[GROUP_SIZE];
+        for (size_t k = 0; k < count; k++) {
+            fusion[k].fuse(&sample, 1);
+            rot[k] = sample.rotAHRS;
+        }
+
+        uint8_t mask = mScoreMask[i];
+        if (mask == 0) continue;
+
+        for (size_t k = 0; k < count; k++) {
+            const quat &q = rot[k];
+            float angle;
+            if (groundTruth) {
+                const quat &t = mGroundTruth[i];
+                float d = fabsf(q.w * t.w + q.x * t.x + q.y * t.y + q.z * t.z);
+                angle = 2.0f * acosf(clampUnit(d));
+            }
+            else {
+                // gravity as the filter sees it, in the sensor frame
+                const vec3 &r = mReference[i];
+                float vx = 2.0f * (q.x * q.z - q.w * q.y);
+                float vy = 2.0f * (q.w * q.x + q.y * q.z);
+                float vz = q.w * q.w - q.x * q.x - q.y * q.y + q.z * q.z;
+                angle = acosf(clampUnit(vx * r.x + vy * r.y + vz * r.z));
+            }
+            double e = (double)angle * angle;
+            for (int p = 0; p < NUM_PROFILES; p++) {
+                if (mask & (1 << p)) sum[k][p] += e;
+            }
+        }
+        for (int p = 0; p < NUM_PROFILES; p++) {
+            if (mask & (1 << p)) numScored[p]++;
+        }
+    }
+
+    // each group owns its slice of the results
+    for (size_t k = 0; k < count; k++) {
+        Result &result = mResults[first + k];
+        result.config = mConfigs[first + k];
+        for (int p = 0; p < NUM_PROFILES; p++) {
+            result.numScored[p] = numScored[p];
+            result.error[p] = numScored[p] > 0 ? toDegrees(sqrt(sum[k][p] / numScored[p])) : 0.0;
+        }
+    }
+}
+
+bool Wax9Tuner::run()
+{
+    double start = secondsNow();
+    mResults.clear();
+    if (mNumSamples == 0 || mConfigs.empty()) return false;
+
+    prepareScoring();
+    size_t numScored = 0;
+    for (size_t i = 0; i < mNumSamples; i++) if (mScoreMask[i]) numScored++;
+    if (numScored == 0) {
+        fprintf(stderr, "WARNING: Wax9Tuner found no still periods after motion to score against\n");
+        return false;
+    }
+
+    mResults.resize(mConfigs.size());
+    for (size_t first = 0; first < mConfigs.size(); first += GROUP_SIZE) {
+        size_t count = std::min<size_t>(GROUP_SIZE, mConfigs.size() - first);
+        mPool.submit([this, first, count](int) { runGroup(first, count); });
+    }
+    mPool.wait();
+
+    mSeconds = secondsNow() - start;
+    return true;
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark results
+/* -------------------------------------------------------------------------------------------------- */
+
+const Wax9Tuner::Result* Wax9Tuner::getBest(Profile profile) const
+{
+    const Result *best = NULL;
+    for (size_t i = 0; i < mResults.size(); i++) {
+        const Result &r = mResults[i];
+        if (r.numScored[profile] == 0 || r.error[profile] != r.error[profile]) continue;
+        if (best == NULL || r.error[profile] < best->error[profile]) best = &r;
+    }
+    return best;
+}
+
+void Wax9Tuner::printReport() const
+{
+    Wax9::console() << "Tuned " << mResults.size() << " configurations over " << mNumSamples << " samples in " << mSeconds << " s ("
+                   << (mGroundTruth.size() == mNumSamples ? "ground truth" : "still-period gravity") << ")" << std::endl;
+
+    for (int p = 0; p < NUM_PROFILES; p++) {
+        const Result *best = getBest((Profile)p);
+        if (best == NULL) {
+            Wax9::console() << "  " << sProfileNames[p] << ": nothing to score" << std::endl;
+            continue;
+        }
+        Wax9::console() << "  " << sProfileNames[p] << ": " << (best->config.mode == 1 ? "Mahony twoKp " : "Madgwick beta ") << best->config.twoKp;
+        if (best->config.mode == 1) Wax9::console() << " twoKi " << best->config.twoKi;
+        Wax9::console() << ", error " << best->error[p] << " deg over " << best->numScored[p] << " samples" << std::endl;
+    }
+}
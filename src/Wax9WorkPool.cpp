@@ -0,0 +1,178 @@
+/*
+ Created by Adrià Navarro at Red Paper Heart
+ 
+ Copyright (c) 2015, Red Paper Heart
+ All rights reserved.
+ 
+ This code is designed for use with the Cinder C++ library, http://libcinder.org
+ 
+ To contact Red Paper Heart, email hello@redpaperheart.com or tweet @redpaperhearts
+ 
+ Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ the following conditions are met:
+ 
+ * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ the following disclaimer in the documentation and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Wax9WorkPool.h"
+
+#include <chrono>
+
+static double secondsNow()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark constructors and setup
+/* -------------------------------------------------------------------------------------------------- */
+
+Wax9WorkPool::Wax9WorkPool(int numThreads)
+{
+    if (numThreads <= 0) numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    mNextWorker = 0;
+    mNumQueued = 0;
+    mNumPending = 0;
+    bRunning = true;
+
+    for (int i = 0; i < numThreads; i++) {
+        mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+        mWorkers.back()->numTasks = 0;
+        mWorkers.back()->numStolen = 0;
+        mWorkers.back()->busySeconds = 0.0;
+    }
+    // start the threads once every deque exists, they steal from each other
+    for (int i = 0; i < numThreads; i++) {
+        mWorkers[i]->thread = std::thread(&Wax9WorkPool::threadedWork, this, i);
+    }
+}
+
+Wax9WorkPool::~Wax9WorkPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bRunning = false;
+    }
+    mWorkAvailable.notify_all();
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        if (mWorkers[i]->thread.joinable()) mWorkers[i]->thread.join();
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark public interface
+/* -------------------------------------------------------------------------------------------------- */
+
+void Wax9WorkPool::submit(const Task &task)
+{
+    Worker &w = *mWorkers[mNextWorker++ % mWorkers.size()];
+    mNumPending++;
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_back(task);
+    }
+    {
+        // taken so a worker can't check mNumQueued and go to sleep in between
+        std::lock_guard<std::mutex> lock(mMutex);
+        mNumQueued++;
+    }
+    mWorkAvailable.notify_one();
+}
+
+void Wax9WorkPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (mNumPending > 0) mAllDone.wait(lock);
+}
+
+Wax9WorkPool::WorkerStats Wax9WorkPool::getStats(int worker) const
+{
+    WorkerStats stats;
+    const Worker &w = *mWorkers[worker];
+    stats.numTasks = w.numTasks;
+    stats.numStolen = w.numStolen;
+    stats.busySeconds = w.busySeconds;
+    return stats;
+}
+
+void Wax9WorkPool::resetStats()
+{
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->numTasks = 0;
+        mWorkers[i]->numStolen = 0;
+        mWorkers[i]->busySeconds = 0.0;
+    }
+}
+
+/* -------------------------------------------------------------------------------------------------- */
+#pragma mark workers
+/* -------------------------------------------------------------------------------------------------- */
+
+bool Wax9WorkPool::takeTask(int worker, Task &task)
+{
+    // own deque first, newest task
+    {
+        Worker &w = *mWorkers[worker];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            task = w.tasks.back();
+            w.tasks.pop_back();
+            mNumQueued--;
+            return true;
+        }
+    }
+    // then the oldest task of the others
+    for (size_t k = 1; k < mWorkers.size(); k++) {
+        Worker &victim = *mWorkers[(worker + k) % mWorkers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            mNumQueued--;
+            mWorkers[worker]->numStolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Wax9WorkPool::threadedWork(int worker)
+{
+    Worker &w = *mWorkers[worker];
+    Task task;
+
+    while (true)
+    {
+        if (!takeTask(worker, task)) {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (bRunning && mNumQueued == 0) mWorkAvailable.wait(lock);
+            if (!bRunning && mNumQueued == 0) return;
+            continue;
+        }
+
+        double start = secondsNow();
+        task(worker);
+        task = Task();      // release captures before reporting completion
+        w.busySeconds = w.busySeconds + (secondsNow() - start);
+        w.numTasks++;
+
+        if (--mNumPending == 0) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mAllDone.notify_all();
+        }
+    }
+}
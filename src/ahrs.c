@@ -24,6 +24,7 @@
 #endif
 
 #include <math.h>
+#include <stdint.h>
 #include "ahrs.h"
 
 
@@ -524,6 +525,246 @@ if (mx == 0 && my == 0 && mz == 0)
 }
 
 
+//=====================================================================================================
+// Fixed-point variants (modes 2 and 3)
+//=====================================================================================================
+//
+// Same filters as MadgwickAHRSupdateIMU and MahonyAHRSupdateIMU, for hosts without a fast FPU.
+// Quaternion, normalised vectors and gains are Q2.30 in int32, products accumulate in int64.
+// The gyro is pre-multiplied by half the sample period, which keeps every intermediate in range
+// for rotations up to several thousand degrees per second.
+// Normalisation uses a table-seeded Newton inverse square root, no division and no sqrt.
+//
+//=====================================================================================================
+
+#define FX_ONE          (1 << 30)
+#define FX_HALF         (1 << 29)
+#define FX_INPUT_ONE    65536.0f                                    // Q16.16 for the float interface
+#define FX_INTEGRAL     46                                          // Mahony integral term, it grows in tiny steps
+#define FXMUL(a, b)     (((int64_t)(a) * (int64_t)(b) + FX_HALF) >> 30)       // rounded, truncation would bias the integration
+
+// 1/sqrt(m) in Q30 for m = (i + 0.5) / 8, i = 8..31
+static const uint32_t fxInvSqrtTable[24] = {
+    1041682578, 985333074, 937238702, 895562589, 858993459, 826566842, 797555404, 771398898,
+    747657839, 725981977, 706088274, 687745184, 670761200, 654976372, 640255922, 626485368,
+    613566757, 601415717, 589959130, 579133272, 568882316, 559157115, 549914212, 541115017
+};
+
+static int fxMsb(uint64_t x)
+{
+    int n = 0;
+    if (x >> 32) { x >>= 32; n += 32; }
+    if (x >> 16) { x >>= 16; n += 16; }
+    if (x >> 8)  { x >>= 8;  n += 8; }
+    if (x >> 4)  { x >>= 4;  n += 4; }
+    if (x >> 2)  { x >>= 2;  n += 2; }
+    if (x >> 1)  { n += 1; }
+    return n;
+}
+
+// Inverse square root of x / 2^q (q even). Returns the mantissa in Q30 and sets *k so that
+// the result is mantissa * 2^-k. Three Newton steps from the table reach the Q30 resolution
+static uint32_t fxInvSqrt(uint64_t x, int q, int *k)
+{
+    int b = fxMsb(x);
+    int s = 60 - b;
+    int i;
+    uint64_t m, y, t;
+    if ((60 - q - s) & 1) s++;
+    m = (s >= 0 ? x << s : x >> -s) >> 30;                          // [1, 4) in Q30
+    *k = (60 - q - s) / 2;
+
+    y = fxInvSqrtTable[(m >> 27) - 8];
+    for (i = 0; i < 3; i++)
+    {
+        t = (m * ((y * y) >> 30)) >> 30;
+        y = (y * ((3ull << 30) - t)) >> 31;
+    }
+    return (uint32_t)y;
+}
+
+// Scales n values from Q(p) to a unit vector in Q30, given the sum of their squares in Q(2p)
+static int fxNormalize(int64_t *v, int n, int p, uint64_t sumSquares)
+{
+    int i, k, shift;
+    uint32_t y;
+    if (sumSquares == 0) return 0;
+    y = fxInvSqrt(sumSquares, 2 * p, &k);
+    shift = p + k;
+    for (i = 0; i < n; i++)
+    {
+        v[i] = (shift >= 0) ? (v[i] * (int64_t)y) >> shift : (v[i] * (int64_t)y) << -shift;
+    }
+    return 1;
+}
+
+// Gains and period in fixed point, recomputed when the float settings change
+static void fxUpdateConstants(ahrs_t *ahrs)
+{
+    float dt = 1.0f / ahrs->sampleFreq;
+    if (ahrs->sampleFreq == ahrs->fixedFreq && ahrs->twoKp == ahrs->fixedKp && ahrs->twoKi == ahrs->fixedKi) return;
+    ahrs->fixedFreq = ahrs->sampleFreq;
+    ahrs->fixedKp = ahrs->twoKp;
+    ahrs->fixedKi = ahrs->twoKi;
+    ahrs->halfDtFixed = (int32_t)(0.5f * dt * FX_ONE);
+    ahrs->kpFixed = (int32_t)(ahrs->twoKp * (ahrs->mode == 2 ? dt : 0.5f * dt) * FX_ONE);    // Madgwick: beta dt, Mahony: twoKp dt/2
+    ahrs->kiFixed = (int64_t)((double)ahrs->twoKi * dt * 0.5 * dt * (double)(1ull << FX_INTEGRAL));
+}
+
+static void fxNormalizeAccel(const int32_t *accel, int64_t *a, int *valid)
+{
+    int p = 16;
+    a[0] = accel[0]; a[1] = accel[1]; a[2] = accel[2];
+
+    // drop precision on huge readings so the squares can't overflow
+    while (a[0] >= (1 << 29) || a[0] <= -(1 << 29) || a[1] >= (1 << 29) || a[1] <= -(1 << 29) || a[2] >= (1 << 29) || a[2] <= -(1 << 29))
+    {
+        a[0] >>= 1; a[1] >>= 1; a[2] >>= 1;
+        p--;
+    }
+    *valid = fxNormalize(a, 3, p, (uint64_t)(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]));
+}
+
+static void fxNormalizeQuaternion(ahrs_t *ahrs, int64_t *q)
+{
+    if (fxNormalize(q, 4, 30, (uint64_t)(q[0] * q[0]) + (uint64_t)(q[1] * q[1]) + (uint64_t)(q[2] * q[2]) + (uint64_t)(q[3] * q[3])))
+    {
+        ahrs->qFixed[0] = (int32_t)q[0]; ahrs->qFixed[1] = (int32_t)q[1]; ahrs->qFixed[2] = (int32_t)q[2]; ahrs->qFixed[3] = (int32_t)q[3];
+    }
+    ahrs->q[0] = ahrs->qFixed[0] * (1.0f / FX_ONE);
+    ahrs->q[1] = ahrs->qFixed[1] * (1.0f / FX_ONE);
+    ahrs->q[2] = ahrs->qFixed[2] * (1.0f / FX_ONE);
+    ahrs->q[3] = ahrs->qFixed[3] * (1.0f / FX_ONE);
+}
+
+static void MadgwickAHRSupdateIMUFixed(ahrs_t *ahrs, const int32_t *gyro, const int32_t *accel)
+{
+    const int32_t *q = ahrs->qFixed;
+    int64_t hx, hy, hz, d[4], a[3], s[4], n[4];
+    int64_t q0q0, q1q1, q2q2, q3q3;
+    int valid;
+
+    // gyro (Q16 rad/s) times dt/2, in Q30
+    hx = ((int64_t)gyro[0] * ahrs->halfDtFixed + 0x8000) >> 16;
+    hy = ((int64_t)gyro[1] * ahrs->halfDtFixed + 0x8000) >> 16;
+    hz = ((int64_t)gyro[2] * ahrs->halfDtFixed + 0x8000) >> 16;
+
+    // rate of change of quaternion times dt
+    d[0] = -FXMUL(q[1], hx) - FXMUL(q[2], hy) - FXMUL(q[3], hz);
+    d[1] =  FXMUL(q[0], hx) + FXMUL(q[2], hz) - FXMUL(q[3], hy);
+    d[2] =  FXMUL(q[0], hy) - FXMUL(q[1], hz) + FXMUL(q[3], hx);
+    d[3] =  FXMUL(q[0], hz) + FXMUL(q[1], hy) - FXMUL(q[2], hx);
+
+    fxNormalizeAccel(accel, a, &valid);
+    if (valid)
+    {
+        q0q0 = FXMUL(q[0], q[0]);
+        q1q1 = FXMUL(q[1], q[1]);
+        q2q2 = FXMUL(q[2], q[2]);
+        q3q3 = FXMUL(q[3], q[3]);
+
+        // gradient decent corrective step, small integer factors applied after the product
+        s[0] = 4 * FXMUL(q[0], q2q2) + 2 * FXMUL(q[2], a[0]) + 4 * FXMUL(q[0], q1q1) - 2 * FXMUL(q[1], a[1]);
+        s[1] = 4 * FXMUL(q[1], q3q3) - 2 * FXMUL(q[3], a[0]) + 4 * FXMUL(q0q0, q[1]) - 2 * FXMUL(q[0], a[1]) - 4 * (int64_t)q[1]
+             + 8 * FXMUL(q[1], q1q1) + 8 * FXMUL(q[1], q2q2) + 4 * FXMUL(q[1], a[2]);
+        s[2] = 4 * FXMUL(q0q0, q[2]) + 2 * FXMUL(q[0], a[0]) + 4 * FXMUL(q[2], q3q3) - 2 * FXMUL(q[3], a[1]) - 4 * (int64_t)q[2]
+             + 8 * FXMUL(q[2], q1q1) + 8 * FXMUL(q[2], q2q2) + 4 * FXMUL(q[2], a[2]);
+        s[3] = 4 * FXMUL(q1q1, q[3]) - 2 * FXMUL(q[1], a[0]) + 4 * FXMUL(q2q2, q[3]) - 2 * FXMUL(q[2], a[1]);
+
+        // normalise step magnitude, in Q24 so the squares fit
+        s[0] >>= 6; s[1] >>= 6; s[2] >>= 6; s[3] >>= 6;
+        if (fxNormalize(s, 4, 24, (uint64_t)(s[0] * s[0] + s[1] * s[1] + s[2] * s[2] + s[3] * s[3])))
+        {
+            d[0] -= FXMUL(ahrs->kpFixed, s[0]);
+            d[1] -= FXMUL(ahrs->kpFixed, s[1]);
+            d[2] -= FXMUL(ahrs->kpFixed, s[2]);
+            d[3] -= FXMUL(ahrs->kpFixed, s[3]);
+        }
+    }
+
+    n[0] = q[0] + d[0];
+    n[1] = q[1] + d[1];
+    n[2] = q[2] + d[2];
+    n[3] = q[3] + d[3];
+    fxNormalizeQuaternion(ahrs, n);
+}
+
+static void MahonyAHRSupdateIMUFixed(ahrs_t *ahrs, const int32_t *gyro, const int32_t *accel)
+{
+    const int32_t *q = ahrs->qFixed;
+    int64_t hx, hy, hz, a[3], n[4];
+    int64_t halfvx, halfvy, halfvz, halfex, halfey, halfez;
+    int valid;
+
+    // everything below is scaled by dt/2, including the feedback terms
+    hx = ((int64_t)gyro[0] * ahrs->halfDtFixed + 0x8000) >> 16;
+    hy = ((int64_t)gyro[1] * ahrs->halfDtFixed + 0x8000) >> 16;
+    hz = ((int64_t)gyro[2] * ahrs->halfDtFixed + 0x8000) >> 16;
+
+    fxNormalizeAccel(accel, a, &valid);
+    if (valid)
+    {
+        // estimated direction of gravity
+        halfvx = FXMUL(q[1], q[3]) - FXMUL(q[0], q[2]);
+        halfvy = FXMUL(q[0], q[1]) + FXMUL(q[2], q[3]);
+        halfvz = FXMUL(q[0], q[0]) - FX_HALF + FXMUL(q[3], q[3]);
+
+        // error is cross product between estimated and measured direction of gravity
+        halfex = FXMUL(a[1], halfvz) - FXMUL(a[2], halfvy);
+        halfey = FXMUL(a[2], halfvx) - FXMUL(a[0], halfvz);
+        halfez = FXMUL(a[0], halfvy) - FXMUL(a[1], halfvx);
+
+        if (ahrs->kiFixed > 0)
+        {
+            ahrs->integralFixed[0] += FXMUL(ahrs->kiFixed, halfex);
+            ahrs->integralFixed[1] += FXMUL(ahrs->kiFixed, halfey);
+            ahrs->integralFixed[2] += FXMUL(ahrs->kiFixed, halfez);
+            hx += (ahrs->integralFixed[0] + (1 << (FX_INTEGRAL - 31))) >> (FX_INTEGRAL - 30);
+            hy += (ahrs->integralFixed[1] + (1 << (FX_INTEGRAL - 31))) >> (FX_INTEGRAL - 30);
+            hz += (ahrs->integralFixed[2] + (1 << (FX_INTEGRAL - 31))) >> (FX_INTEGRAL - 30);
+        }
+        else
+        {
+            ahrs->integralFixed[0] = 0;
+            ahrs->integralFixed[1] = 0;
+            ahrs->integralFixed[2] = 0;
+        }
+
+        hx += FXMUL(ahrs->kpFixed, halfex);
+        hy += FXMUL(ahrs->kpFixed, halfey);
+        hz += FXMUL(ahrs->kpFixed, halfez);
+    }
+
+    n[0] = q[0] - FXMUL(q[1], hx) - FXMUL(q[2], hy) - FXMUL(q[3], hz);
+    n[1] = q[1] + FXMUL(q[0], hx) + FXMUL(q[2], hz) - FXMUL(q[3], hy);
+    n[2] = q[2] + FXMUL(q[0], hy) - FXMUL(q[1], hz) + FXMUL(q[3], hx);
+    n[3] = q[3] + FXMUL(q[0], hz) + FXMUL(q[1], hy) - FXMUL(q[2], hx);
+    fxNormalizeQuaternion(ahrs, n);
+}
+
+static int32_t fxFromFloat(float v)
+{
+    float scaled = v * FX_INPUT_ONE;
+    if (scaled > 2147483520.0f) return 0x7fffff80;
+    if (scaled < -2147483520.0f) return -0x7fffff80;
+    return (int32_t)(scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f);
+}
+
+// Update with Q16.16 inputs, for callers that convert sensor counts with integer maths
+void AhrsUpdateFixed(ahrs_t *ahrs, const int32_t *gyro, const int32_t *accel)
+{
+    fxUpdateConstants(ahrs);
+    if (ahrs->mode == 3)
+    {
+        MahonyAHRSupdateIMUFixed(ahrs, gyro, accel);
+    }
+    else
+    {
+        MadgwickAHRSupdateIMUFixed(ahrs, gyro, accel);
+    }
+}
+
+
 // Initialize AHRS tracker
 void AhrsInit(ahrs_t *ahrs, char mode, float frequency, float beta)
 {
@@ -531,6 +772,7 @@ void AhrsInit(ahrs_t *ahrs, char mode, float frequency, float beta)
     ahrs->sampleFreq = frequency;
     ahrs->twoKp = beta;     // e.g. For 512Hz: 0.1 in Madgwick, 1.0 in Mahony (old: 10*2)
     ahrs->twoKi = 0.0f;     // e.g. 0 in Mahony (old: 0.005*2)
+    ahrs->fixedFreq = 0.0f; // fixed-point constants are computed on the first update
     float quat[4] = {1.0f, 0.0f, 0.0f, 0.0f};
     AhrsReset(ahrs, quat);
 }
@@ -541,6 +783,9 @@ void AhrsReset(ahrs_t *ahrs, float *quat)
 {
     ahrs->q[0] = quat[0]; ahrs->q[1] = quat[1]; ahrs->q[2] = quat[2]; ahrs->q[3] = quat[3];
     ahrs->integralFB[0] = 0.0f; ahrs->integralFB[1] = 0.0f; ahrs->integralFB[2] = 0.0f; 
+    ahrs->qFixed[0] = (int32_t)(quat[0] * FX_ONE); ahrs->qFixed[1] = (int32_t)(quat[1] * FX_ONE);
+    ahrs->qFixed[2] = (int32_t)(quat[2] * FX_ONE); ahrs->qFixed[3] = (int32_t)(quat[3] * FX_ONE);
+    ahrs->integralFixed[0] = 0; ahrs->integralFixed[1] = 0; ahrs->integralFixed[2] = 0;
 }
 
 
@@ -554,7 +799,27 @@ float *AhrsGetQuaternion(ahrs_t *ahrs)
 // Update the AHRS tracker with accelerometer, gyroscope and (optional) magnetometer data
 void AhrsUpdate(ahrs_t *ahrs, float *gyro, float *accel, float *mag)
 {
-    if (ahrs->mode == -1)
+    if (ahrs->mode == 2 || ahrs->mode == 3)  // 2, 3 = fixed-point Madgwick, Mahony
+    {
+        if (!mag)
+        {
+            int32_t g[3] = { fxFromFloat(gyro[0]), fxFromFloat(gyro[1]), fxFromFloat(gyro[2]) };
+            int32_t a[3] = { fxFromFloat(accel[0]), fxFromFloat(accel[1]), fxFromFloat(accel[2]) };
+            AhrsUpdateFixed(ahrs, g, a);
+        }
+        else
+        {
+            // magnetometer fusion has no fixed-point version, run the float filter on the same state
+            float halfDt = 0.5f / ahrs->sampleFreq;
+            int i;
+            for (i = 0; i < 3; i++) ahrs->integralFB[i] = (float)(ahrs->integralFixed[i] / (double)(1ull << FX_INTEGRAL) / halfDt);
+            if (ahrs->mode == 3) MahonyAHRSupdate(ahrs, gyro, accel, mag);
+            else MadgwickAHRSupdate(ahrs, gyro, accel, mag);
+            for (i = 0; i < 4; i++) ahrs->qFixed[i] = (int32_t)(ahrs->q[i] * FX_ONE);
+            for (i = 0; i < 3; i++) ahrs->integralFixed[i] = (int64_t)((double)ahrs->integralFB[i] * halfDt * (double)(1ull << FX_INTEGRAL));
+        }
+    }
+    else if (ahrs->mode == -1)
     {
         MayhonyOldAHRSupdate(ahrs, gyro, accel, mag);
     }
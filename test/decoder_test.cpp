@@ -0,0 +1,160 @@
+// Wax9 decoder test
+// Feeds a stream with a bad SLIP escape, two frames merged by a lost SLIP_END, a truncated packet,
+// an out-of-range gyro reading and a gyro spike through Wax9MemoryTransport. Checks the
+// Wax9DecodeStats counters, and that the AHRS output matches a clean stream of only the valid
+// packets, so nothing that was dropped reached AhrsUpdate().
+//
+// Build and run from the block folder:
+//     c++ -std=c++11 -DWAX9_HEADLESS -I$CINDER_PATH/include -Iinclude test/decoder_test.cpp src/*.cpp src/ahrs.c -lpthread -o decoder_test && ./decoder_test
+
+#include "Wax9.h"
+#include "Wax9Log.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+static int numFailures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); numFailures++; } } while (0)
+
+#define SLIP_END        0xC0
+#define SLIP_ESC        0xDB
+
+// an extended packet of a device lying flat and turning slowly, 120 Hz
+static std::vector<uint8_t> makePacket(int i, short gyroX = 100)
+{
+    std::vector<uint8_t> b(36, 0);
+    uint32_t timestamp = (uint32_t)i * 546;
+    short accZ = 4096, magX = 200, magZ = -400;
+    unsigned short battery = 3900;
+
+    b[0] = '9';
+    b[1] = 2;
+    b[2] = (uint8_t)i;
+    b[3] = (uint8_t)(i >> 8);
+    memcpy(&b[4], &timestamp, 4);
+    memcpy(&b[12], &accZ, 2);
+    memcpy(&b[14], &gyroX, 2);
+    memcpy(&b[20], &magX, 2);
+    memcpy(&b[24], &magZ, 2);
+    memcpy(&b[26], &battery, 2);
+    return b;
+}
+
+// SLIP escapes without the surrounding SLIP_END bytes
+static std::vector<uint8_t> escape(const std::vector<uint8_t> &packet)
+{
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < packet.size(); i++) {
+        if (packet[i] == SLIP_END)      { out.push_back(SLIP_ESC); out.push_back(0xDC); }
+        else if (packet[i] == SLIP_ESC) { out.push_back(SLIP_ESC); out.push_back(0xDD); }
+        else                            out.push_back(packet[i]);
+    }
+    return out;
+}
+
+static void pushFrame(Wax9MemoryTransportRef mem, const std::vector<uint8_t> &escaped)
+{
+    std::vector<uint8_t> frame;
+    frame.push_back(SLIP_END);
+    frame.insert(frame.end(), escaped.begin(), escaped.end());
+    frame.push_back(SLIP_END);
+    mem->push(frame.data(), frame.size());
+}
+
+int main()
+{
+    Wax9MemoryTransportRef mem = Wax9MemoryTransport::create();
+    Wax9 device;
+    device.setup(mem, 1000);
+
+    std::vector<int> valid;
+    int i = 0;
+
+    for (; i < 20; i++) {
+        std::vector<uint8_t> p = makePacket(i);
+        mem->pushSlip(p.data(), p.size());
+        valid.push_back(i);
+    }
+
+    // packet 20 has an escape byte followed by something that is neither ESC_END nor ESC_ESC
+    {
+        std::vector<uint8_t> e = escape(makePacket(i++));
+        e.insert(e.begin() + 10, SLIP_ESC);
+        e.insert(e.begin() + 11, 0x11);
+        pushFrame(mem, e);
+    }
+
+    // packets 21 and 22 merged by a lost SLIP_END
+    {
+        std::vector<uint8_t> e = escape(makePacket(i));
+        std::vector<uint8_t> e2 = escape(makePacket(i + 1));
+        e.insert(e.end(), e2.begin(), e2.end());
+        pushFrame(mem, e);
+        valid.push_back(i++);
+        valid.push_back(i++);
+    }
+
+    // packet 23 a gyro spike within the range, packet 24 beyond the 2000 deg/s range of the gyro
+    {
+        std::vector<uint8_t> p = makePacket(i++, 22000);
+        mem->pushSlip(p.data(), p.size());
+        p = makePacket(i++, 32000);
+        mem->pushSlip(p.data(), p.size());
+    }
+
+    // packet 25 truncated
+    {
+        std::vector<uint8_t> p = makePacket(i++);
+        p.resize(30);
+        mem->pushSlip(p.data(), p.size());
+    }
+
+    for (; i < 60; i++) {
+        std::vector<uint8_t> p = makePacket(i);
+        mem->pushSlip(p.data(), p.size());
+        valid.push_back(i);
+    }
+
+    int numRead = device.update();
+    const Wax9DecodeStats &stats = device.getDecodeStats();
+
+    CHECK(numRead == (int)valid.size());
+    CHECK(stats.numCorrupt == 1);
+    CHECK(stats.numSplit == 1);
+    CHECK(stats.numMalformed == 1);
+    CHECK(stats.numOutOfRange == 1);
+    CHECK(stats.numImplausible == 1);
+    CHECK(stats.numResyncs == 0);
+    CHECK(device.getNumRejected() == 4);
+
+    // the history holds exactly the valid packets, newest first
+    CHECK(device.getNumReadings() == (int)valid.size());
+    for (int k = 0; k < device.getNumReadings() && k < (int)valid.size(); k++) {
+        const Wax9Sample &s = device.getReading(k);
+        CHECK(s.sampleNumber == valid[valid.size() - 1 - k]);
+        CHECK(fabsf(s.gyr.x) < toRadians(2000.0f));
+    }
+
+    // the same valid packets on a clean stream must give the same orientations
+    Wax9MemoryTransportRef cleanMem = Wax9MemoryTransport::create();
+    Wax9 clean;
+    clean.setup(cleanMem, 1000);
+    for (size_t k = 0; k < valid.size(); k++) {
+        std::vector<uint8_t> p = makePacket(valid[k]);
+        cleanMem->pushSlip(p.data(), p.size());
+    }
+    CHECK(clean.update() == (int)valid.size());
+    CHECK(clean.getNumReadings() == device.getNumReadings());
+    for (int k = 0; k < clean.getNumReadings() && k < device.getNumReadings(); k++) {
+        const quat &a = device.getReading(k).rotAHRS;
+        const quat &b = clean.getReading(k).rotAHRS;
+        CHECK(a.w == b.w && a.x == b.x && a.y == b.y && a.z == b.z);
+    }
+
+    Wax9Log::get().flush();
+    printf(numFailures ? "%d checks failed\n" : "all checks passed\n", numFailures);
+    return numFailures ? 1 : 0;
+}
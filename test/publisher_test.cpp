@@ -0,0 +1,181 @@
+// Wax9Publisher test
+// Publishes synthetic samples to a UDP socket bound on 127.0.0.1 and checks batching,
+// MTU splitting and sequence numbers of the binary and OSC datagrams. POSIX only.
+//
+// Build and run from the block folder:
+//     c++ -std=c++11 -DWAX9_HEADLESS -I$CINDER_PATH/include -Iinclude test/publisher_test.cpp src/*.cpp src/ahrs.c -lpthread -o publisher_test && ./publisher_test
+
+#include "Wax9Publisher.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+
+static int numFailures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); numFailures++; } } while (0)
+
+static uint16_t getLE16(const char *p)  { return (uint16_t)((uint8_t)p[0] | ((uint8_t)p[1] << 8)); }
+static uint32_t getLE32(const char *p)  { return getLE16(p) | ((uint32_t)getLE16(p + 2) << 16); }
+static uint32_t getBE32(const char *p)  { return ((uint32_t)(uint8_t)p[0] << 24) | ((uint8_t)p[1] << 16) | ((uint8_t)p[2] << 8) | (uint8_t)p[3]; }
+
+// a receiver on an ephemeral localhost port
+static int openReceiver(uint16_t &port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0) return -1;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || getsockname(fd, (sockaddr *)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// returns the datagram length, or 0 if nothing arrived within the timeout
+static int receive(int fd, char *buf, size_t size, double timeout)
+{
+    timeval tv;
+    tv.tv_sec = (long)timeout;
+    tv.tv_usec = (long)((timeout - tv.tv_sec) * 1e6);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ssize_t n = recv(fd, buf, size, 0);
+    return n > 0 ? (int)n : 0;
+}
+
+static Wax9Sample makeSample(uint16_t sampleNumber)
+{
+    Wax9Sample s = Wax9Sample();
+    s.sampleNumber = sampleNumber;
+    s.timestamp = sampleNumber * 546;
+    s.acc = vec3(0.0f, 0.0f, 1.0f);
+    s.rotOGL = quat();
+    return s;
+}
+
+static void testBinary(int fd, uint16_t port)
+{
+    // room for exactly 4 samples per datagram
+    const size_t perDatagram = 4;
+    const size_t mtu = Wax9Publisher::BINARY_HEADER_SIZE + perDatagram * Wax9Publisher::BINARY_SAMPLE_SIZE;
+    Wax9PublisherRef pub = Wax9Publisher::create(Wax9Publisher::FORMAT_BINARY, mtu);
+    CHECK(pub->isOpen());
+    CHECK(pub->getSamplesPerDatagram() == perDatagram);
+    CHECK(pub->addDestination("127.0.0.1", port));
+
+    char buf[2048];
+
+    // batching: a partial datagram waits for the latency to run out
+    pub->setMaxLatency(0.3);
+    for (uint16_t i = 0; i < 3; i++) pub->publish(makeSample(i), 7);
+    CHECK(receive(fd, buf, sizeof(buf), 0.1) == 0);
+
+    int len = receive(fd, buf, sizeof(buf), 1.0);
+    CHECK(len == (int)(Wax9Publisher::BINARY_HEADER_SIZE + 3 * Wax9Publisher::BINARY_SAMPLE_SIZE));
+    CHECK(buf[0] == 'W' && buf[1] == '9' && buf[2] == 1);
+    CHECK(buf[3] == 3);
+    CHECK(getLE32(buf + 4) == 0);
+    for (int k = 0; k < 3; k++) {
+        const char *s = buf + Wax9Publisher::BINARY_HEADER_SIZE + k * Wax9Publisher::BINARY_SAMPLE_SIZE;
+        CHECK((uint8_t)s[0] == 7);
+        CHECK(getLE16(s + 2) == k);
+    }
+
+    // splitting: however the sender picks up the queue, no datagram exceeds the mtu and
+    // samples and sequence numbers arrive in order
+    const uint16_t numSamples = 50;
+    for (uint16_t i = 0; i < numSamples; i++) pub->publish(makeSample(3 + i), 7);
+
+    uint32_t expectedSeq = 1;
+    uint16_t expectedSample = 3;
+    while (expectedSample < 3 + numSamples) {
+        len = receive(fd, buf, sizeof(buf), 1.0);
+        CHECK(len > 0);
+        if (len <= 0) break;
+
+        int count = (uint8_t)buf[3];
+        CHECK(len <= (int)mtu);
+        CHECK(count >= 1 && count <= (int)perDatagram);
+        CHECK(len == (int)(Wax9Publisher::BINARY_HEADER_SIZE + count * Wax9Publisher::BINARY_SAMPLE_SIZE));
+        CHECK(getLE32(buf + 4) == expectedSeq);
+        expectedSeq++;
+
+        for (int k = 0; k < count; k++) {
+            const char *s = buf + Wax9Publisher::BINARY_HEADER_SIZE + k * Wax9Publisher::BINARY_SAMPLE_SIZE;
+            CHECK(getLE16(s + 2) == expectedSample);
+            expectedSample++;
+        }
+    }
+    CHECK(expectedSeq >= 1 + (numSamples + perDatagram - 1) / perDatagram);
+
+    pub.reset();
+    CHECK(receive(fd, buf, sizeof(buf), 0.1) == 0);
+}
+
+static void testOsc(int fd, uint16_t port)
+{
+    Wax9PublisherRef pub = Wax9Publisher::create(Wax9Publisher::FORMAT_OSC, 400);
+    size_t perDatagram = pub->getSamplesPerDatagram();
+    CHECK(pub->isOpen());
+    CHECK(perDatagram == 3);
+    CHECK(pub->addDestination("127.0.0.1", port));
+
+    const int numSamples = 10;
+    for (int i = 0; i < numSamples; i++) pub->publish(makeSample(i));
+
+    char buf[2048];
+    uint32_t expectedSeq = 0;
+    int received = 0;
+    while (received < numSamples) {
+        int len = receive(fd, buf, sizeof(buf), 1.0);
+        CHECK(len > 0);
+        if (len <= 0) break;
+
+        // "#bundle", timetag, then the sequence message
+        CHECK(len <= 400);
+        CHECK(strcmp(buf, "#bundle") == 0);
+        CHECK(strcmp(buf + 20, "/wax9/seq") == 0);
+        CHECK(getBE32(buf + 36) == expectedSeq);
+        expectedSeq++;
+
+        int count = (len - 40) / 112;
+        CHECK(len == 40 + count * 112);
+        CHECK(count >= 1 && count <= (int)perDatagram);
+        for (int k = 0; k < count; k++) {
+            const char *element = buf + 40 + k * 112;
+            CHECK(strcmp(element + 4, "/wax9/sample") == 0);
+            CHECK(getBE32(element + 44) == (uint32_t)received);
+            received++;
+        }
+    }
+    CHECK(received == numSamples);
+    CHECK(pub->getNumSendErrors() == 0);
+}
+
+int main()
+{
+    uint16_t port = 0;
+    int fd = openReceiver(port);
+    if (fd < 0) {
+        printf("unable to bind a UDP socket on 127.0.0.1\n");
+        return 1;
+    }
+
+    testBinary(fd, port);
+    testOsc(fd, port);
+    close(fd);
+
+    printf(numFailures ? "%d checks failed\n" : "all checks passed\n", numFailures);
+    return numFailures ? 1 : 0;
+}
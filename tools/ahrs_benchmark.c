@@ -0,0 +1,121 @@
+// AHRS benchmark
+// Per-update cost of the float and fixed-point filters on this host, and how far the
+// fixed-point quaternion strays from the float one over a synthetic session.
+//
+// Build and run from the block folder:
+//     cc -O2 -Iinclude tools/ahrs_benchmark.c src/ahrs.c -lm -o ahrs_benchmark && ./ahrs_benchmark
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ahrs.h"
+
+#ifndef M_PI                            // not declared by strict C99 or MSVC
+#define M_PI            3.14159265358979323846
+#endif
+
+#define NUM_SAMPLES     (120 * 600)     // ten minutes at 120 Hz
+#define SAMPLE_FREQ     120.0f
+#define NUM_REPEATS     20
+
+static float gyro[NUM_SAMPLES][3];
+static float accel[NUM_SAMPLES][3];
+
+static float noise(void)
+{
+    return ((float)rand() / RAND_MAX - 0.5f) * 2.0f;
+}
+
+// alternating rotations and rests, sensor data in g and rad/s with noise and gyro bias
+static void generate(void)
+{
+    float q[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+    float w[3] = { 0.0f, 0.0f, 0.0f };
+    int i, k;
+
+    srand(1);
+    for (i = 0; i < NUM_SAMPLES; i++)
+    {
+        float n, d[4];
+        if (i % 360 == 0)
+        {
+            float speed = (i / 360) % 2 ? 0.0f : 3.0f * (float)rand() / RAND_MAX;
+            for (k = 0; k < 3; k++) w[k] = noise() * speed;
+        }
+        d[0] = 0.5f * (-q[1] * w[0] - q[2] * w[1] - q[3] * w[2]);
+        d[1] = 0.5f * (q[0] * w[0] + q[2] * w[2] - q[3] * w[1]);
+        d[2] = 0.5f * (q[0] * w[1] - q[1] * w[2] + q[3] * w[0]);
+        d[3] = 0.5f * (q[0] * w[2] + q[1] * w[1] - q[2] * w[0]);
+        for (k = 0; k < 4; k++) q[k] += d[k] / SAMPLE_FREQ;
+        n = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (k = 0; k < 4; k++) q[k] /= n;
+
+        accel[i][0] = 2.0f * (q[1] * q[3] - q[0] * q[2]) + 0.02f * noise();
+        accel[i][1] = 2.0f * (q[0] * q[1] + q[2] * q[3]) + 0.02f * noise();
+        accel[i][2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3] + 0.02f * noise();
+        for (k = 0; k < 3; k++) gyro[i][k] = w[k] + 0.01f * noise() + 0.005f;
+    }
+}
+
+static double secondsNow(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static double benchmark(char mode, float gain)
+{
+    ahrs_t ahrs;
+    double start;
+    int r, i;
+
+    AhrsInit(&ahrs, mode, SAMPLE_FREQ, gain);
+    start = secondsNow();
+    for (r = 0; r < NUM_REPEATS; r++)
+    {
+        for (i = 0; i < NUM_SAMPLES; i++) AhrsUpdate(&ahrs, gyro[i], accel[i], NULL);
+    }
+    return (secondsNow() - start) / ((double)NUM_REPEATS * NUM_SAMPLES) * 1e9;
+}
+
+// angle between the float and fixed-point estimates, in degrees
+static void compare(char floatMode, char fixedMode, float gain, float twoKi)
+{
+    ahrs_t a, b;
+    double maxError = 0.0, sumSquares = 0.0;
+    int i;
+
+    AhrsInit(&a, floatMode, SAMPLE_FREQ, gain);
+    AhrsInit(&b, fixedMode, SAMPLE_FREQ, gain);
+    a.twoKi = b.twoKi = twoKi;
+    for (i = 0; i < NUM_SAMPLES; i++)
+    {
+        double d, angle;
+        AhrsUpdate(&a, gyro[i], accel[i], NULL);
+        AhrsUpdate(&b, gyro[i], accel[i], NULL);
+        d = fabs((double)a.q[0] * b.q[0] + (double)a.q[1] * b.q[1] + (double)a.q[2] * b.q[2] + (double)a.q[3] * b.q[3]);
+        angle = 2.0 * acos(d > 1.0 ? 1.0 : d) * 180.0 / M_PI;
+        if (angle > maxError) maxError = angle;
+        sumSquares += angle * angle;
+    }
+    printf("  mode %d vs %d (gain %.2f, twoKi %.2f): max %.4f deg, rms %.4f deg\n", fixedMode, floatMode, gain, twoKi,
+           maxError, sqrt(sumSquares / NUM_SAMPLES));
+}
+
+int main(void)
+{
+    generate();
+
+    printf("Per update, %d samples x %d:\n", NUM_SAMPLES, NUM_REPEATS);
+    printf("  Madgwick float  %6.1f ns\n", benchmark(0, 0.1f));
+    printf("  Madgwick fixed  %6.1f ns\n", benchmark(2, 0.1f));
+    printf("  Mahony float    %6.1f ns\n", benchmark(1, 1.0f));
+    printf("  Mahony fixed    %6.1f ns\n", benchmark(3, 1.0f));
+
+    printf("Fixed-point error against the float filter over %d samples:\n", NUM_SAMPLES);
+    compare(0, 2, 0.1f, 0.0f);
+    compare(0, 2, 0.5f, 0.0f);
+    compare(1, 3, 1.0f, 0.0f);
+    compare(1, 3, 1.0f, 0.1f);
+    return 0;
+}